@@ -0,0 +1,100 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "BuildPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+BuildPool::BuildPool(int num_threads)
+	: m_quit(false)
+{
+	for (int i = 1; i < num_threads; ++i)
+		m_workers.push_back(thread(&BuildPool::workerLoop, this));
+}
+
+BuildPool::~BuildPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_quit = true;
+		m_wake.notify_all();
+	}
+	for (size_t i = 0; i < m_workers.size(); ++i)
+		m_workers[i].join();
+}
+
+void BuildPool::run(Group& group, const function<void()>& task)
+{
+	if (m_workers.empty())
+	{
+		task();
+		return;
+	}
+
+	lock_guard<mutex> lock(m_mutex);
+	Task t = { task, &group };
+	m_tasks.push_back(t);
+	++group.m_pending;
+	m_wake.notify_one();
+}
+
+void BuildPool::wait(Group& group)
+{
+	unique_lock<mutex> lock(m_mutex);
+	while (group.m_pending > 0)
+	{
+		if (m_tasks.empty())
+		{
+			m_wake.wait(lock);
+			continue;
+		}
+
+		// Take the newest task: it is the smallest, and most likely one of ours
+		Task task = m_tasks.back();
+		m_tasks.pop_back();
+		runTask(task, lock);
+	}
+}
+
+void BuildPool::parallelFor(int count, int grain, const function<void(int, int)>& body)
+{
+	Group group;
+	for (int begin = 0; begin < count; begin += grain)
+	{
+		int end = min(count, begin + grain);
+		run(group, [&body, begin, end] { body(begin, end); });
+	}
+	wait(group);
+}
+
+// Called and returns with the lock held
+void BuildPool::runTask(Task& task, unique_lock<mutex>& lock)
+{
+	lock.unlock();
+	task.func();
+	lock.lock();
+	if (--task.group->m_pending == 0)
+		m_wake.notify_all();
+}
+
+void BuildPool::workerLoop()
+{
+	unique_lock<mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_wake.wait(lock, [this] { return m_quit || !m_tasks.empty(); });
+		if (m_tasks.empty())
+			return;
+
+		// Workers take the oldest tasks, which are the biggest subtrees
+		Task task = m_tasks.front();
+		m_tasks.pop_front();
+		runTask(task, lock);
+	}
+}
@@ -0,0 +1,72 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#ifndef __BUILDPOOL_H__
+#define __BUILDPOOL_H__
+
+// Threads for building acceleration structures.  Builders hand it tasks
+// (whole meshes, or subtrees big enough to be worth it) in groups, and wait
+// on a group to know its tasks are done.  A thread waiting on a group runs
+// queued tasks itself in the meantime, so tasks may queue and wait on more
+// tasks without tying up the pool.
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class BuildPool
+{
+public:
+	// A set of tasks to wait on together
+	class Group
+	{
+	public:
+		Group() : m_pending(0) {}
+
+	private:
+		friend class BuildPool;
+		int m_pending;		// guarded by the pool's mutex
+	};
+
+	// num_threads includes the thread calling wait(), so a pool of one thread
+	// starts no workers and runs every task as soon as it is queued
+	explicit BuildPool(int num_threads);
+	~BuildPool();
+
+	void run(Group& group, const std::function<void()>& task);
+	void wait(Group& group);
+
+	// Call body(begin, end) on ranges of at most grain items covering [0, count)
+	// and wait for all of them
+	void parallelFor(int count, int grain, const std::function<void(int, int)>& body);
+
+	int threadCount() const { return m_workers.size() + 1; }
+
+private:
+	struct Task
+	{
+		std::function<void()> func;
+		Group* group;
+	};
+
+	void runTask(Task& task, std::unique_lock<std::mutex>& lock);
+	void workerLoop();
+
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;		// a task was queued, a group finished, or the pool is shutting down
+
+	// Guarded by m_mutex
+	std::deque<Task> m_tasks;
+	bool m_quit;
+};
+
+#endif // __BUILDPOOL_H__
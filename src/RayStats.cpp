@@ -0,0 +1,66 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "RayStats.h"
+
+#include <list>
+#include <mutex>
+
+using namespace std;
+
+// Every thread's counters, kept after the thread exits so nothing it counted is lost
+static list<RayCounts> s_threadCounts;
+static mutex s_threadMutex;
+
+bool RayStats::s_countTests = false;
+
+void RayCounts::clear()
+{
+	for (int i = 0; i < RAY_TYPES; ++i)
+		rays[i] = 0;
+	nodeTests = 0;
+	triangleTests = 0;
+}
+
+void RayCounts::merge(const RayCounts& other)
+{
+	for (int i = 0; i < RAY_TYPES; ++i)
+		rays[i] += other.rays[i];
+	nodeTests += other.nodeTests;
+	triangleTests += other.triangleTests;
+}
+
+long RayCounts::totalRays() const
+{
+	long total = 0;
+	for (int i = 0; i < RAY_TYPES; ++i)
+		total += rays[i];
+	return total;
+}
+
+RayCounts RayStats::total()
+{
+	lock_guard<mutex> lock(s_threadMutex);
+	RayCounts sum;
+	for (list<RayCounts>::const_iterator c = s_threadCounts.begin(); c != s_threadCounts.end(); ++c)
+		sum.merge(*c);
+	return sum;
+}
+
+void RayStats::reset()
+{
+	lock_guard<mutex> lock(s_threadMutex);
+	for (list<RayCounts>::iterator c = s_threadCounts.begin(); c != s_threadCounts.end(); ++c)
+		c->clear();
+}
+
+RayCounts* RayStats::addThread()
+{
+	lock_guard<mutex> lock(s_threadMutex);
+	s_threadCounts.push_back(RayCounts());
+	return &s_threadCounts.back();
+}
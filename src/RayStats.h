@@ -0,0 +1,60 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#ifndef __RAYSTATS_H__
+#define __RAYSTATS_H__
+
+// Counters for the benchmark mode: rays traced by type, and how many tree
+// nodes and triangles they were tested against.  Every thread counts into
+// its own copy so the hot paths never touch shared memory; the copies are
+// summed once the threads are done with a render.  Node and triangle tests
+// are only counted while countTests() is on, which the traversals check
+// once per ray.
+
+struct RayCounts
+{
+	enum { RAY_TYPES = 4 };		// one slot per ray::RayType
+
+	RayCounts() { clear(); }
+
+	void clear();
+	void merge(const RayCounts& other);
+	long totalRays() const;
+
+	long rays[RAY_TYPES];
+	long nodeTests;			// ray-box tests against tree nodes (per ray, so a packet test counts each lane)
+	long triangleTests;		// ray-triangle tests, counted the same way
+};
+
+class RayStats
+{
+public:
+	// This thread's counters
+	static RayCounts& local()
+	{
+		static thread_local RayCounts* counts = 0;
+		if (!counts)
+			counts = addThread();
+		return *counts;
+	}
+
+	// This thread's counters if node and triangle tests are being counted,
+	// otherwise NULL
+	static RayCounts* testCounts() { return s_countTests ? &local() : 0; }
+
+	// Only call these while no thread is tracing
+	static RayCounts total();
+	static void reset();
+	static void countTests(bool on) { s_countTests = on; }
+
+private:
+	static RayCounts* addThread();
+
+	static bool s_countTests;
+};
+
+#endif // __RAYSTATS_H__
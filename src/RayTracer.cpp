@@ -13,6 +13,10 @@
 #include "scene/light.h"
 #include "scene/material.h"
 #include "scene/ray.h"
+#include "scene/packet.h"
+#include "scene/sampling.h"
+#include "scene/textureCache.h"
+#include "RayStats.h"
 
 #include "parser/Tokenizer.h"
 #include "parser/Parser.h"
@@ -20,6 +24,8 @@
 #include "ui/TraceUI.h"
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <vector>
 
 extern TraceUI* traceUI;
 
@@ -38,13 +44,20 @@ bool debugMode = false;
 // enter the main ray-tracing method, getting things started by plugging
 // in an initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
 
-Vec3d RayTracer::trace(double x, double y)
+Vec3d RayTracer::trace(double x, double y, const SceneObject** hitObject)
 {
   // Clear out the ray cache in the scene for debugging purposes,
   if (TraceUI::m_debug) scene->intersectCache.clear();
   ray r(Vec3d(0,0,0), Vec3d(0,0,0), ray::VISIBILITY);
   scene->getCamera().rayThrough(x,y,r);
-  Vec3d ret = traceRay(r, traceUI->getDepth());
+
+  // traceRay(), keeping hold of what the camera ray hit
+  isect i;
+  ++RayStats::local().rays[r.type()];
+  bool hit = scene->intersect(r, i);
+  if (hitObject)
+    *hitObject = hit ? i.obj : NULL;
+  Vec3d ret = hit ? shade(r, i, traceUI->getDepth()) : background(r);
   ret.clamp();
   return ret;
 }
@@ -58,8 +71,6 @@ Vec3d RayTracer::tracePixel(int i, int j)
 	double x = double(i)/double(buffer_width);
 	double y = double(j)/double(buffer_height);
 
-	unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
-
 	// Anti-aliasing
 	int num_aa_samples_sqrt = traceUI->getAASampleSqrt();
 	if (num_aa_samples_sqrt > 1)
@@ -90,126 +101,503 @@ Vec3d RayTracer::tracePixel(int i, int j)
 		col = trace(x, y);
 	}
 
+	setPixel(i, j, col);
+	return col;
+}
+
+void RayTracer::setPixel(int i, int j, const Vec3d& col)
+{
+	unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
+
 	pixel[0] = (int)( 255.0 * col[0]);
 	pixel[1] = (int)( 255.0 * col[1]);
 	pixel[2] = (int)( 255.0 * col[2]);
-	return col;
 }
 
-
-// Do recursive ray tracing!  You'll want to insert a lot of code here
-// (or places called from here) to handle reflection, refraction, etc etc.
-Vec3d RayTracer::traceRay(ray& r, int depth)
+// Trace up to PACKET_SIZE camera rays through the normalized window points
+// (xs[k], ys[k]) together.  They're intersected with the scene as one
+// packet; each hit is then shaded on its own exactly like trace() would.
+void RayTracer::tracePacket(const double* xs, const double* ys, int count, Vec3d* colors, const SceneObject** hitObjects)
 {
-	isect i;
+	ray rays[PACKET_SIZE] = { ray(Vec3d(0,0,0), Vec3d(0,0,0)), ray(Vec3d(0,0,0), Vec3d(0,0,0)),
+		ray(Vec3d(0,0,0), Vec3d(0,0,0)), ray(Vec3d(0,0,0), Vec3d(0,0,0)) };
+	for (int k = 0; k < count; ++k)
+		scene->getCamera().rayThrough(xs[k], ys[k], rays[k]);
+
+	RayStats::local().rays[ray::VISIBILITY] += count;
 
-	if(scene->intersect(r, i)) 
+	RayPacket packet;
+	packet.set(rays, count);
+	PacketHit hit;
+	scene->intersectPacket(packet, (1 << count) - 1, hit);
+
+	int depth = traceUI->getDepth();
+	for (int k = 0; k < count; ++k)
 	{
-		// YOUR CODE HERE
+		colors[k] = (hit.mask & (1 << k)) ? shade(rays[k], hit.i[k], depth) : background(rays[k]);
+		colors[k].clamp();
+		if (hitObjects)
+			hitObjects[k] = (hit.mask & (1 << k)) ? hit.i[k].obj : NULL;
+	}
+}
 
-		// An intersection occurred!  We've got work to do.  For now,
-		// this code gets the material for the surface that was intersected,
-		// and asks that material to provide a color for the ray.  
+// trace() each of the window points (xs[k], ys[k]), in packets unless
+// they're turned off
+void RayTracer::traceSamples(const double* xs, const double* ys, int count, Vec3d* colors, const SceneObject** hitObjects)
+{
+	if (usePackets())
+	{
+		for (int s = 0; s < count; s += PACKET_SIZE)
+			tracePacket(xs + s, ys + s, min((int)PACKET_SIZE, count - s), colors + s, hitObjects ? hitObjects + s : NULL);
+		return;
+	}
 
-		// This is a great place to insert code for recursive ray tracing.
-		// Instead of just returning the result of shade(), add some
-		// more steps: add in the contributions from reflected and refracted
-		// rays.
+	for (int s = 0; s < count; ++s)
+		colors[s] = trace(xs[s], ys[s], hitObjects ? hitObjects + s : NULL);
+}
 
-		const Material& m = i.getMaterial();
-		Vec3d color = m.shade(scene, r, i);
+// Whether the samples at a pixel's four corners (indices into colors and
+// objects) are close enough that the pixel can do without supersampling:
+// all on the same object, or all missing everything, and no channel
+// varying by more than threshold
+static bool cornersAgree(const Vec3d* colors, const SceneObject* const* objects, const int corner[4], double threshold)
+{
+	for (int k = 1; k < 4; ++k)
+		if (objects[corner[k]] != objects[corner[0]])
+			return false;
 
-		// If we've reached the end of recursion, return the color of the fragment that we intersected
-		if (!depth)
-			return color;
+	for (int c = 0; c < 3; ++c)
+	{
+		double lo = colors[corner[0]][c];
+		double hi = lo;
+		for (int k = 1; k < 4; ++k)
+		{
+			lo = min(lo, colors[corner[k]][c]);
+			hi = max(hi, colors[corner[k]][c]);
+		}
+		if (hi - lo > threshold)
+			return false;
+	}
+	return true;
+}
 
-		Vec3d p = r.at(i.t);
-		Vec3d nV = r.d;
+// Anti-aliasing that only supersamples where it shows.  Every pixel corner
+// of the tile is traced once and shared by the pixels around it.  A pixel
+// whose corners agree (see cornersAgree()) is their average; any other
+// gets the same grid of samples as tracePixel(), the first of which is its
+// top-left corner and isn't traced again.
+void RayTracer::tracePixelsAdaptive(int x0, int y0, int x1, int y1)
+{
+	const int n = traceUI->getAASampleSqrt();
+	const double threshold = traceUI->getAAThreshold();
+
+	// The (x1 - x0 + 1) x (y1 - y0 + 1) corners of the tile's pixels
+	const int cw = x1 - x0 + 1;
+	const int ch = y1 - y0 + 1;
+	vector<double> xs(cw * ch), ys(cw * ch);
+	for (int j = 0; j < ch; ++j)
+	{
+		for (int i = 0; i < cw; ++i)
+		{
+			xs[j * cw + i] = double(x0 + i)/double(buffer_width);
+			ys[j * cw + i] = double(y0 + j)/double(buffer_height);
+		}
+	}
+	vector<Vec3d> corners(cw * ch);
+	vector<const SceneObject*> objects(cw * ch);
+	traceSamples(&xs[0], &ys[0], cw * ch, &corners[0], &objects[0]);
+
+	const double x_aa_sample_inc = (1.0 / ((double)buffer_width * (double)n));
+	const double y_aa_sample_inc = (1.0 / ((double)buffer_height * (double)n));
+	const int num_samples = n * n;
+	vector<double> sample_xs(num_samples), sample_ys(num_samples);
+	vector<Vec3d> samples(num_samples);
 
-		// Don't bother with reflection unless kr vector isn't the 0 vector
-		if (!m.kr(i).iszero())
+	for (int j = y0; j < y1; ++j)
+	{
+		for (int i = x0; i < x1; ++i)
 		{
-			// Find the reflection of the view vector about the normal
-			Vec3d R = (nV - (2.0 * i.N) * (nV * i.N));
-			R.normalize();
+			int c = (j - y0) * cw + (i - x0);
+			int corner[4] = { c, c + 1, c + cw, c + cw + 1 };
 
-			// Build and trace reflection ray
-			ray reflect_ray(p, R, ray::REFLECTION);
-			Vec3d reflect_color = traceRay(reflect_ray, depth - 1);
+			Vec3d col(0,0,0);
+			if (cornersAgree(&corners[0], &objects[0], corner, threshold))
+			{
+				for (int k = 0; k < 4; ++k)
+					col += corners[corner[k]];
+				col /= 4.0;
+			}
+			else
+			{
+				double x = double(i)/double(buffer_width);
+				double y = double(j)/double(buffer_height);
+				for (int s = 1; s < num_samples; ++s)
+				{
+					sample_xs[s - 1] = x + ((double)(s % n) * x_aa_sample_inc);
+					sample_ys[s - 1] = y + ((double)(s / n) * y_aa_sample_inc);
+				}
+				traceSamples(&sample_xs[0], &sample_ys[0], num_samples - 1, &samples[0], NULL);
+
+				col = corners[c];
+				for (int s = 0; s < num_samples - 1; ++s)
+					col += samples[s];
+				col /= num_samples;
+			}
+			setPixel(i, j, col);
+		}
+	}
+}
+
+// A well mixed hash of (i, j, pass, axis) mapped to [0, 1): the same pixel
+// gets the same jitter on every run, so progressive renders are repeatable
+static double jitter(int i, int j, int pass, int axis)
+{
+	unsigned h = (unsigned)i * 73856093u ^ (unsigned)j * 19349663u ^ (unsigned)pass * 83492791u ^ (unsigned)axis * 2654435761u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return (h >> 8) * (1.0 / 16777216.0);
+}
+
+// One pass of a progressive render over a tile.  Pass 0 is the preview:
+// one sample per PREVIEW_BLOCK x PREVIEW_BLOCK block of pixels, painted over
+// the whole block and not kept.  Every later pass adds one sample per pixel
+// to accumBuffer and shows the average; pass 1 samples the same spot as a
+// render without anti-aliasing and the rest are jittered across the pixel.
+void RayTracer::traceProgressive(int pass, int x0, int y0, int x1, int y1)
+{
+	const int PREVIEW_BLOCK = 4;
+	const int step = pass ? 1 : PREVIEW_BLOCK;
 
-			// Add reflection ray's color
-			color += prod(reflect_color, m.kr(i));
+	vector<double> xs, ys;
+	for (int j = y0; j < y1; j += step)
+	{
+		for (int i = x0; i < x1; i += step)
+		{
+			double dx = pass > 1 ? jitter(i, j, pass, 0) : 0.0;
+			double dy = pass > 1 ? jitter(i, j, pass, 1) : 0.0;
+			xs.push_back((i + dx)/double(buffer_width));
+			ys.push_back((j + dy)/double(buffer_height));
 		}
+	}
+	vector<Vec3d> colors(xs.size());
+	traceSamples(&xs[0], &ys[0], xs.size(), &colors[0], NULL);
 
-		// Don't bother with refraction unless kt vector isn't the 0 vector
-		if (!m.kt(i).iszero())
+	int s = 0;
+	for (int j = y0; j < y1; j += step)
+	{
+		for (int i = x0; i < x1; i += step, ++s)
 		{
-			// Determine status of current ray
-			Vec3d V = -1.0 * nV;
-			double cos_i = (i.N * V);
-			bool entering_obj = (cos_i > 0.0);
-			bool exiting_obj = (cos_i < 0.0);
-
-			// Build index of refraction
-			double n = (entering_obj 
-				? 1.0 / m.index(i)
-				: (exiting_obj
-					? m.index(i)
-					: 0.0)
-				);
-
-			// We need to adjust the normal if the ray from inside the obejct
-			Vec3d N = (entering_obj
-				? i.N
-				: (exiting_obj
-					? -1.0 * i.N
-					: Vec3d(0.0, 0.0, 0.0))
-				);
-
-			double cos_t_sq = (1.0 - n * n * (1 - cos_i * cos_i));
-
-			// Only use refraction when we don't have Total Internal Reflection
-			if (cos_t_sq > 0.0 && (entering_obj || exiting_obj))
+			if (!pass)
 			{
-				// Find refraction vector
-				double cos_t = sqrt(cos_t_sq);
-				Vec3d T = (((n * cos_i) - cos_t) * N) - (n * V);
-				T.normalize();
+				for (int bj = j; bj < min(j + step, y1); ++bj)
+					for (int bi = i; bi < min(i + step, x1); ++bi)
+						setPixel(bi, bj, colors[s]);
+				continue;
+			}
 
-				// Build and trace refraction ray
-				ray refract_ray(p, T, ray::REFRACTION);
-				Vec3d refract_color = traceRay(refract_ray, depth - 1);
+			float* sum = &accumBuffer[(i + j * buffer_width) * 3];
+			for (int c = 0; c < 3; ++c)
+				sum[c] += (float)colors[s][c];
+			setPixel(i, j, Vec3d(sum[0], sum[1], sum[2]) / pass);
+		}
+	}
+}
+
+// Packets are used whenever the debugging view isn't recording every ray
+bool RayTracer::usePackets() const
+{
+	return traceUI->usingPackets() && !TraceUI::m_debug;
+}
+
+// Same image as calling tracePixel() on every pixel of the tile, but with
+// camera rays traced in packets: 2x2 pixel blocks without anti-aliasing, or
+// runs of a pixel's sub-pixel samples with it
+void RayTracer::tracePixelsPacketed(int x0, int y0, int x1, int y1)
+{
+	double xs[PACKET_SIZE], ys[PACKET_SIZE];
+	Vec3d colors[PACKET_SIZE];
 
-				// Add refraction ray's color
-				color += prod(refract_color, m.kt(i));
+	int num_aa_samples_sqrt = traceUI->getAASampleSqrt();
+	if (num_aa_samples_sqrt > 1)
+	{
+		const double x_aa_sample_inc = (1.0 / ((double)buffer_width * (double)num_aa_samples_sqrt));
+		const double y_aa_sample_inc = (1.0 / ((double)buffer_height * (double)num_aa_samples_sqrt));
+		const int num_samples = num_aa_samples_sqrt * num_aa_samples_sqrt;
+
+		for (int j = y0; j < y1; ++j)
+		{
+			for (int i = x0; i < x1; ++i)
+			{
+				double x = double(i)/double(buffer_width);
+				double y = double(j)/double(buffer_height);
+				Vec3d col(0,0,0);
+
+				// Samples go out in the same order tracePixel() adds them up in
+				for (int s = 0; s < num_samples; s += PACKET_SIZE)
+				{
+					int count = min((int)PACKET_SIZE, num_samples - s);
+					for (int k = 0; k < count; ++k)
+					{
+						xs[k] = x + ((double)((s + k) % num_aa_samples_sqrt) * x_aa_sample_inc);
+						ys[k] = y + ((double)((s + k) / num_aa_samples_sqrt) * y_aa_sample_inc);
+					}
+					tracePacket(xs, ys, count, colors);
+					for (int k = 0; k < count; ++k)
+						col += colors[k];
+				}
+
+				col /= num_samples;
+				setPixel(i, j, col);
 			}
 		}
+		return;
+	}
 
-		return color;
-	} 
-	else 
+	for (int j = y0; j < y1; j += 2)
 	{
-		// No intersection.  This ray travels to infinity, so we color it according to the background color.
-		if (traceUI->usingCubeMap() && traceUI->gotCubeMap())
+		for (int i = x0; i < x1; i += 2)
 		{
-			// Cube-mapping - see wherever our ray intersects with the cube map and color our pixel using that
-			return cubemap->getColor(r);
+			int pi[PACKET_SIZE], pj[PACKET_SIZE];
+			int count = 0;
+			for (int dj = 0; dj < 2 && j + dj < y1; ++dj)
+			{
+				for (int di = 0; di < 2 && i + di < x1; ++di)
+				{
+					pi[count] = i + di;
+					pj[count] = j + dj;
+					xs[count] = double(i + di)/double(buffer_width);
+					ys[count] = double(j + dj)/double(buffer_height);
+					++count;
+				}
+			}
+
+			tracePacket(xs, ys, count, colors);
+			for (int k = 0; k < count; ++k)
+				setPixel(pi[k], pj[k], colors[k]);
 		}
+	}
+}
+
+
+// Do recursive ray tracing!  You'll want to insert a lot of code here
+// (or places called from here) to handle reflection, refraction, etc etc.
+Vec3d RayTracer::traceRay(ray& r, int depth)
+{
+	isect i;
+
+	++RayStats::local().rays[r.type()];
+	if (scene->intersect(r, i))
+		return shade(r, i, depth);
+	else
+		return background(r);
+}
+
+// A reflection or refraction ray waiting to be traced by shade(): what it
+// sees reaches the camera scaled by weight
+struct RayTracer::PendingRay
+{
+	PendingRay(const ray& r, const Vec3d& weight, int depth, int reflections, int refractions)
+		: r(r), weight(weight), depth(depth), reflections(reflections), refractions(refractions) {}
+
+	ray r;
+	Vec3d weight;
+	int depth;			// bounces left before the recursion depth runs out
+	int reflections;	// reflection rays on the path to r, r included
+	int refractions;	// same for refraction rays
+};
+
+// Rays that would be worth less than this to every channel are the ones
+// Russian roulette (TraceUI::russianRoulette()) plays with
+static const double ROULETTE_WEIGHT = 0.1;
+
+// Color of the surface hit by r at i, including what it reflects and
+// refracts.  Instead of recursing, the reflection and refraction rays wait
+// on a stack along with how much of what they see makes it to the camera,
+// so that a ray past the depth limit of its type or too faint to matter
+// (see pushRay()) is never traced.
+Vec3d RayTracer::shade(ray& r, isect& i, int depth)
+{
+	Vec3d color(0.0, 0.0, 0.0);
+	vector<PendingRay> pending;
+	PendingRay cur(r, Vec3d(1.0, 1.0, 1.0), depth, 0, 0);
+	isect hit = i;
+	bool found = true;
+	for (;;)
+	{
+		if (found)
+			color += prod(cur.weight, shadeSurface(cur, hit, pending));
 		else
+			color += prod(cur.weight, background(cur.r));
+
+		if (pending.empty())
+			return color;
+		cur = pending.back();
+		pending.pop_back();
+
+		++RayStats::local().rays[cur.r.type()];
+		found = scene->intersect(cur.r, hit);
+	}
+}
+
+// The light of p.r's hit i itself, leaving the rays it reflects and
+// refracts on pending
+Vec3d RayTracer::shadeSurface(const PendingRay& p, isect& i, vector<PendingRay>& pending)
+{
+	// YOUR CODE HERE
+
+	// An intersection occurred!  We've got work to do.  For now,
+	// this code gets the material for the surface that was intersected,
+	// and asks that material to provide a color for the ray.  
+
+	// This is a great place to insert code for recursive ray tracing.
+	// Instead of just returning the result of shade(), add some
+	// more steps: add in the contributions from reflected and refracted
+	// rays.
+
+	const ray& r = p.r;
+
+	// How much of the surface's texture the ray's cone covers here.  Where
+	// it meets the surface at a slant it spreads over more of it; the cone
+	// is kept round, so this takes the mean of the two axes of its ellipse.
+	double width = r.coneWidth + r.coneSpread * i.t;
+	if (width > 0.0)
+		i.uvFootprint = width / sqrt(max(fabs(i.N * r.d), 1e-3)) * i.obj->uvPerWorldUnit(r, i);
+
+	Material interpolated;
+	i.resolveMaterial(interpolated);
+	const Material& m = i.getMaterial();
+	Vec3d color = m.shade(scene, r, i);
+
+	// If we've reached the end of recursion, return the color of the fragment that we intersected
+	if (!p.depth)
+		return color;
+
+	Vec3d pt = r.at(i.t);
+	Vec3d nV = r.d;
+
+	Vec3d kr = m.kr(i);
+	Vec3d kt = m.kt(i);
+
+	// The refraction ray goes on the stack first so the reflection ray is
+	// traced first, as it was when this recursed
+
+	// Don't bother with refraction unless kt vector isn't the 0 vector
+	if (!kt.iszero())
+	{
+		// Determine status of current ray
+		Vec3d V = -1.0 * nV;
+		double cos_i = (i.N * V);
+		bool entering_obj = (cos_i > 0.0);
+		bool exiting_obj = (cos_i < 0.0);
+
+		// Build index of refraction
+		double n = (entering_obj 
+			? 1.0 / m.index(i)
+			: (exiting_obj
+				? m.index(i)
+				: 0.0)
+			);
+
+		// We need to adjust the normal if the ray from inside the obejct
+		Vec3d N = (entering_obj
+			? i.N
+			: (exiting_obj
+				? -1.0 * i.N
+				: Vec3d(0.0, 0.0, 0.0))
+			);
+
+		double cos_t_sq = (1.0 - n * n * (1 - cos_i * cos_i));
+
+		// Only use refraction when we don't have Total Internal Reflection
+		if (cos_t_sq > 0.0 && (entering_obj || exiting_obj))
 		{
-			// No background
-			return Vec3d(0.0, 0.0, 0.0);
+			// Find refraction vector
+			double cos_t = sqrt(cos_t_sq);
+			Vec3d T = (((n * cos_i) - cos_t) * N) - (n * V);
+			T.normalize();
+
+			// Queue up refraction ray, its cone going on from where this one's is
+			ray refracted(pt, T, ray::REFRACTION);
+			refracted.setCone(width, r.coneSpread);
+			pushRay(pending, p, refracted, prod(p.weight, kt));
 		}
-			
+	}
+
+	// Don't bother with reflection unless kr vector isn't the 0 vector
+	if (!kr.iszero())
+	{
+		// Find the reflection of the view vector about the normal
+		Vec3d R = (nV - (2.0 * i.N) * (nV * i.N));
+		R.normalize();
+
+		// Queue up reflection ray
+		ray reflected(pt, R, ray::REFLECTION);
+		reflected.setCone(width, r.coneSpread);
+		pushRay(pending, p, reflected, prod(p.weight, kr));
+	}
+
+	return color;
+}
+
+// Queue s, a ray leaving the hit of from.r, for shade() to trace; weight is
+// how much of what it sees reaches the camera.  It's dropped if the path
+// already has as many rays of its type as TraceUI::getTypeDepth() allows,
+// or if no channel of weight is at least TraceUI::getMinContribution().
+// With Russian roulette on, a ray fainter than ROULETTE_WEIGHT is dropped
+// at random instead, and the ones that are kept count for more to make up
+// for the others.
+void RayTracer::pushRay(vector<PendingRay>& pending, const PendingRay& from, const ray& s, const Vec3d& weight)
+{
+	int reflections = from.reflections + (s.type() == ray::REFLECTION ? 1 : 0);
+	int refractions = from.refractions + (s.type() == ray::REFRACTION ? 1 : 0);
+	int limit = traceUI->getTypeDepth(s.type());
+	if (limit >= 0 && (s.type() == ray::REFLECTION ? reflections : refractions) > limit)
+		return;
+
+	double contribution = max(weight[0], max(weight[1], weight[2]));
+	if (contribution <= 0.0 || contribution < traceUI->getMinContribution())
+		return;
+
+	Vec3d w = weight;
+	if (traceUI->russianRoulette() && contribution < ROULETTE_WEIGHT)
+	{
+		double survival = contribution / ROULETTE_WEIGHT;
+		if (uniformRandom() >= survival)
+			return;
+		w /= survival;
+	}
+
+	pending.push_back(PendingRay(s, w, from.depth - 1, reflections, refractions));
+}
+
+// Color seen along a ray that doesn't hit anything
+Vec3d RayTracer::background(const ray& r)
+{
+	// No intersection.  This ray travels to infinity, so we color it according to the background color.
+	if (traceUI->usingCubeMap() && traceUI->gotCubeMap())
+	{
+		// Cube-mapping - see wherever our ray intersects with the cube map and color our pixel using that
+		return cubemap->getColor(r);
+	}
+	else
+	{
+		// No background
+		return Vec3d(0.0, 0.0, 0.0);
 	}
 }
 
 RayTracer::RayTracer()
-	: scene(0), buffer(0), buffer_width(256), buffer_height(256), m_bBufferReady(false), cubemap(0)
+	: buffer(0), buffer_width(256), buffer_height(256), scene(0), cubemap(0), m_bBufferReady(false), m_buildTime(0.0), m_refitRebuilt(false), m_progressive(false)
 {}
 
 RayTracer::~RayTracer()
 {
+	// The workers may still be writing into the buffer
+	stopRender();
+
 	if (cubemap)
 		delete cubemap;
 	
@@ -230,8 +618,9 @@ double RayTracer::aspectRatio()
 }
 
 bool RayTracer::loadScene( char* fn ) {
-	ifstream ifs( fn );
-	if( !ifs ) {
+	// Call this with 'true' for debug output from the tokenizer
+	Tokenizer tokenizer( fn, false );
+	if( !tokenizer.good() ) {
 		string msg( "Error: couldn't read scene file " );
 		msg.append( fn );
 		traceUI->alert( msg );
@@ -243,13 +632,17 @@ bool RayTracer::loadScene( char* fn ) {
 	if( path.find_last_of( "\\/" ) == string::npos ) path = ".";
 	else path = path.substr(0, path.find_last_of( "\\/" ));
 
-	// Call this with 'true' for debug output from the tokenizer
-	Tokenizer tokenizer( ifs, false );
     Parser parser( tokenizer, path );
+
+	// Don't pull the scene out from under a render in progress
+	stopRender();
+
 	try {
 		delete scene;
 		scene = 0;
 		scene = parser.parseScene();
+		if (scene)
+			scene->loadTextures();
 	} 
 	catch( SyntaxErrorException& pe ) {
 		traceUI->alert( pe.formattedMessage() );
@@ -262,6 +655,8 @@ bool RayTracer::loadScene( char* fn ) {
 		return false;
 	}
 	catch( TextureMapException e ) {
+		delete scene;
+		scene = 0;
 		string msg( "Texture mapping exception: " );
 		msg.append( e.message() );
 		traceUI->alert( msg );
@@ -270,13 +665,97 @@ bool RayTracer::loadScene( char* fn ) {
 
 	if( !sceneLoaded() ) return false;
 
-	scene->buildKdTree();
+	buildAccelerator();
 
 	return true;
 }
 
+double RayTracer::buildAccelerator()
+{
+	if (!sceneLoaded())
+		return 0.0;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	scene->buildKdTree();
+	m_buildTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return m_buildTime;
+}
+
+double RayTracer::refitAccelerator(bool rebuild)
+{
+	if (!sceneLoaded())
+		return 0.0;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	m_refitRebuilt = scene->refitKdTree(rebuild);
+	m_buildTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return m_buildTime;
+}
+
+long RayTracer::castPrimaryRays(int w, int h, std::vector<double>* depths)
+{
+	long hits = 0;
+	if (!sceneLoaded())
+		return hits;
+	if (depths)
+		depths->assign((size_t)w * h, -1.0);
+
+	if (usePackets())
+	{
+		// 2x2 blocks of pixels per packet, as in tracePixelsPacketed()
+		for (int j = 0; j < h; j += 2)
+		{
+			for (int i = 0; i < w; i += 2)
+			{
+				ray rays[PACKET_SIZE] = { ray(Vec3d(0,0,0), Vec3d(0,0,0)), ray(Vec3d(0,0,0), Vec3d(0,0,0)),
+					ray(Vec3d(0,0,0), Vec3d(0,0,0)), ray(Vec3d(0,0,0), Vec3d(0,0,0)) };
+				int pixels[PACKET_SIZE];
+				int count = 0;
+				for (int dj = 0; dj < 2 && j + dj < h; ++dj)
+					for (int di = 0; di < 2 && i + di < w; ++di)
+					{
+						pixels[count] = (j + dj) * w + i + di;
+						scene->getCamera().rayThrough((i + di + 0.5) / w, (j + dj + 0.5) / h, rays[count++]);
+					}
+
+				RayPacket packet;
+				packet.set(rays, count);
+				PacketHit hit;
+				scene->intersectPacket(packet, (1 << count) - 1, hit);
+				for (int k = 0; k < count; ++k)
+					if (hit.mask & (1 << k))
+					{
+						++hits;
+						if (depths)
+							(*depths)[pixels[k]] = hit.i[k].t;
+					}
+			}
+		}
+		return hits;
+	}
+
+	for (int j = 0; j < h; ++j)
+	{
+		for (int i = 0; i < w; ++i)
+		{
+			ray r(Vec3d(0,0,0), Vec3d(0,0,0), ray::VISIBILITY);
+			scene->getCamera().rayThrough((i + 0.5) / w, (j + 0.5) / h, r);
+			isect isect_info;
+			if (scene->intersect(r, isect_info))
+			{
+				++hits;
+				if (depths)
+					(*depths)[j * w + i] = isect_info.t;
+			}
+		}
+	}
+	return hits;
+}
+
 void RayTracer::traceSetup(int w, int h)
 {
+	stopRender();
+
 	if (buffer_width != w || buffer_height != h)
 	{
 		buffer_width = w;
@@ -289,3 +768,79 @@ void RayTracer::traceSetup(int w, int h)
 	m_bBufferReady = true;
 }
 
+
+void RayTracer::startRender(int num_threads)
+{
+	// Stop the last render before changing anything it reads
+	stopRender();
+	int passes = traceUI->getProgressivePasses();
+	m_progressive = passes > 0;
+	if (sceneLoaded())
+	{
+		scene->buildLightGrid(traceUI->getMinContribution());
+		TextureCache::global().setBudget((size_t)traceUI->getTextureCacheMB() << 20);
+
+		// Camera rays' cones are one sample wide, for texture filtering
+		int samples = m_progressive ? 1 : max(1, traceUI->getAASampleSqrt());
+		scene->getCamera().setImageSize(buffer_width * samples, buffer_height * samples);
+	}
+
+	if (!m_progressive)
+	{
+		renderPool.start(num_threads, buffer_width, buffer_height, traceTile, this);
+		return;
+	}
+
+	accumBuffer.assign(buffer_width * buffer_height * 3, 0.0f);
+	{
+		lock_guard<mutex> lock(passMutex);
+		passImage.clear();
+	}
+	renderPool.start(num_threads, buffer_width, buffer_height, traceTile, this, passes + 1, passDone);
+}
+
+// Runs while every worker is between passes, so the buffer is consistent
+void RayTracer::passDone(void* data, int /*passesDone*/)
+{
+	RayTracer* tracer = (RayTracer*)data;
+	lock_guard<mutex> lock(tracer->passMutex);
+	tracer->passImage.assign(tracer->buffer, tracer->buffer + tracer->buffer_width * tracer->buffer_height * 3);
+}
+
+bool RayTracer::getPassImage(vector<unsigned char>& image)
+{
+	lock_guard<mutex> lock(passMutex);
+	if (passImage.empty())
+		return false;
+	image = passImage;
+	return true;
+}
+
+void RayTracer::traceTile(void* data, int pass, int x0, int y0, int x1, int y1)
+{
+	RayTracer* tracer = (RayTracer*)data;
+	if (!tracer->sceneLoaded())
+		return;
+
+	if (tracer->m_progressive)
+	{
+		tracer->traceProgressive(pass, x0, y0, x1, y1);
+		return;
+	}
+
+	if (traceUI->adaptiveAA() && traceUI->getAASampleSqrt() > 1)
+	{
+		tracer->tracePixelsAdaptive(x0, y0, x1, y1);
+		return;
+	}
+
+	if (tracer->usePackets())
+	{
+		tracer->tracePixelsPacketed(x0, y0, x1, y1);
+		return;
+	}
+
+	for (int y = y0; y < y1; ++y)
+		for (int x = x0; x < x1; ++x)
+			tracer->tracePixel(x, y);
+}
@@ -12,10 +12,14 @@
 
 #include "scene/ray.h"
 #include "scene/cubeMap.h"
+#include "RenderPool.h"
 #include <time.h>
 #include <queue>
+#include <vector>
+#include <mutex>
 
 class Scene;
+class SceneObject;
 
 class RayTracer
 {
@@ -24,21 +28,69 @@ public:
         ~RayTracer();
 
 	Vec3d tracePixel(int i, int j);
-	Vec3d trace(double x, double y);
+
+	// Color seen through normalized window coordinates (x,y); if hitObject
+	// is given it's set to the object the camera ray hit (NULL for none)
+	Vec3d trace(double x, double y, const SceneObject** hitObject = NULL);
 	Vec3d traceRay(ray& r, int depth);
 
+	// traceRay() split in two: shading a hit that's already been found,
+	// along with everything it reflects and refracts, and the color of a
+	// ray that escapes the scene
+	Vec3d shade(ray& r, isect& i, int depth);
+	Vec3d background(const ray& r);
+
 	void getBuffer(unsigned char *&buf, int &w, int &h);
 	double aspectRatio();
 
 	void traceSetup( int w, int h );
 
+	// Rendering the whole buffer happens on a pool of worker threads that is
+	// kept alive between frames.  startRender() returns right away; use
+	// waitRender() to block until the image is done (or for at most the
+	// given number of seconds) and cancelRender() to stop early.
+	void startRender(int num_threads);
+	bool waitRender(double seconds = -1.0) { return renderPool.wait(seconds); }
+	void cancelRender() { renderPool.cancel(); }
+	void stopRender() { renderPool.cancel(); renderPool.wait(); }
+	double renderProgress() const { return renderPool.progress(); }
+	bool rendering() const { return renderPool.busy(); }
+
+	// With TraceUI::getProgressivePasses() set, the render is a quick coarse
+	// preview followed by that many passes over the image, each adding one
+	// jittered sample to every pixel; the buffer holds the running average
+	// after each.  This is how many of those passes (counting the preview
+	// as the first) are finished, or 1 once a normal render is.
+	int renderPassesDone() const { return renderPool.passesDone(); }
+
+	// The buffer as it was when the last progressive pass was finished, for
+	// saving while the next one is drawn over it; false if there's none yet
+	bool getPassImage(std::vector<unsigned char>& image);
+
 	bool loadScene(char* fn);
 	bool sceneLoaded() { return scene != 0; }
 
+	// (Re)build the scene's acceleration structure; returns the build time in seconds
+	double buildAccelerator();
+	double lastBuildTime() const { return m_buildTime; }
+
+	// Bring the acceleration structure up to date after transforms in the
+	// scene have been changed, refitting it where it can (or building the
+	// scene's tree again if rebuild is set); returns the time in seconds
+	double refitAccelerator(bool rebuild = false);
+	bool lastRefitRebuilt() const { return m_refitRebuilt; }
+
+	// Cast one primary ray through the center of every pixel of a w x h image
+	// without shading (in packets unless they're turned off); returns how
+	// many of them hit something.  If depths is given it gets the distance
+	// to each pixel's hit, row by row, or -1 where nothing was hit.
+	long castPrimaryRays(int w, int h, std::vector<double>* depths = NULL);
+
 	void setReady(bool ready) { m_bBufferReady = ready; }
 	bool isReady() const { return m_bBufferReady; }
 
-	const Scene& getScene() { return *scene; }
+	const Scene& getScene() const { return *scene; }
+	Scene& getScene() { return *scene; }
 
         void setCubeMap(CubeMap* m) {
             if (cubemap) delete cubemap;
@@ -55,6 +107,36 @@ public:
         CubeMap* cubemap;
 
         bool m_bBufferReady;
+
+private:
+        double m_buildTime;
+        bool m_refitRebuilt;
+
+        static void traceTile(void* data, int pass, int x0, int y0, int x1, int y1);
+
+        void setPixel(int i, int j, const Vec3d& col);
+        bool usePackets() const;
+        void tracePacket(const double* xs, const double* ys, int count, Vec3d* colors, const SceneObject** hitObjects = NULL);
+        void tracePixelsPacketed(int x0, int y0, int x1, int y1);
+
+        // Adaptive anti-aliasing (see TraceUI::adaptiveAA())
+        void traceSamples(const double* xs, const double* ys, int count, Vec3d* colors, const SceneObject** hitObjects);
+        void tracePixelsAdaptive(int x0, int y0, int x1, int y1);
+
+        // shade() keeps the rays it still has to trace on a stack
+        struct PendingRay;
+        Vec3d shadeSurface(const PendingRay& p, isect& i, std::vector<PendingRay>& pending);
+        void pushRay(std::vector<PendingRay>& pending, const PendingRay& from, const ray& s, const Vec3d& weight);
+
+        // Progressive rendering (see renderPassesDone())
+        void traceProgressive(int pass, int x0, int y0, int x1, int y1);
+        static void passDone(void* data, int passesDone);
+        std::vector<float> accumBuffer;	// sum of the samples of each pixel so far
+        bool m_progressive;
+        std::vector<unsigned char> passImage;
+        std::mutex passMutex;		// guards passImage
+
+        RenderPool renderPool;
 };
 
 #endif // __RAYTRACER_H__
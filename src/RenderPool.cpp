@@ -0,0 +1,173 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "RenderPool.h"
+
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+RenderPool::RenderPool()
+	: m_tiles(NULL), m_func(NULL), m_data(NULL), m_job(0), m_active(0), m_quit(false),
+	  m_passes(1), m_passFunc(NULL), m_pass(0), m_waiting(0), m_nextPass(false), m_tilesDone(0)
+{}
+
+RenderPool::~RenderPool()
+{
+	cancel();
+	wait();
+	shutdown();
+	delete m_tiles;
+}
+
+void RenderPool::start(int num_threads, int width, int height, TileFunc func, void* data,
+	int passes, PassFunc passFunc)
+{
+	cancel();
+	wait();
+
+	// Threads are only started or stopped when the requested count changes
+	resize(max(1, num_threads));
+
+	lock_guard<mutex> lock(m_mutex);
+	delete m_tiles;
+	m_tiles = new TileScheduler(width, height);
+	m_func = func;
+	m_data = data;
+	m_passes = max(1, passes);
+	m_passFunc = passFunc;
+	m_pass = 0;
+	m_waiting = 0;
+	m_nextPass = true;
+	m_tilesDone = 0;
+	m_active = m_workers.size();
+	++m_job;
+	m_wake.notify_all();
+}
+
+void RenderPool::cancel()
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_tiles)
+		m_tiles->cancel();
+}
+
+bool RenderPool::wait(double seconds)
+{
+	unique_lock<mutex> lock(m_mutex);
+	if (seconds < 0.0)
+	{
+		m_idle.wait(lock, [this] { return m_active == 0; });
+		return true;
+	}
+	return m_idle.wait_for(lock, chrono::duration<double>(seconds), [this] { return m_active == 0; });
+}
+
+bool RenderPool::busy() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_active > 0;
+}
+
+double RenderPool::progress() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_tiles || m_tiles->tileCount() == 0)
+		return 1.0;
+	return (double)m_tilesDone / ((double)m_tiles->tileCount() * m_passes);
+}
+
+int RenderPool::passesDone() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_pass;
+}
+
+// seen is the last job posted before this worker was started
+void RenderPool::workerLoop(unsigned seen)
+{
+	for (;;)
+	{
+		TileScheduler* tiles;
+		TileFunc func;
+		void* data;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_quit || m_job != seen; });
+			if (m_quit)
+				return;
+			seen = m_job;
+			tiles = m_tiles;
+			func = m_func;
+			data = m_data;
+		}
+
+		for (int pass = 0; ; ++pass)
+		{
+			int x0, y0, x1, y1;
+			while (tiles->nextTile(x0, y0, x1, y1))
+			{
+				func(data, pass, x0, y0, x1, y1);
+				++m_tilesDone;
+			}
+
+			// Wait for the others to finish this pass.  The last one in
+			// decides for everybody whether there's another, so they all
+			// leave the job together.
+			unique_lock<mutex> lock(m_mutex);
+			if (++m_waiting == m_active)
+			{
+				m_waiting = 0;
+				m_nextPass = pass + 1 < m_passes && !tiles->cancelled();
+				if (m_nextPass)
+					tiles->restart();
+				if (!tiles->cancelled())
+				{
+					m_pass = pass + 1;
+					if (m_passFunc)
+						m_passFunc(data, m_pass);
+				}
+				m_passDone.notify_all();
+			}
+			else
+				m_passDone.wait(lock, [&] { return m_pass != pass || !m_nextPass; });
+			if (!m_nextPass)
+				break;
+		}
+
+		lock_guard<mutex> lock(m_mutex);
+		if (--m_active == 0)
+			m_idle.notify_all();
+	}
+}
+
+// Only called between jobs
+void RenderPool::resize(int num_threads)
+{
+	if ((int)m_workers.size() == num_threads)
+		return;
+
+	shutdown();
+	for (int i = 0; i < num_threads; ++i)
+		m_workers.push_back(thread(&RenderPool::workerLoop, this, m_job));
+}
+
+void RenderPool::shutdown()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_quit = true;
+		m_wake.notify_all();
+	}
+	for (size_t i = 0; i < m_workers.size(); ++i)
+		m_workers[i].join();
+	m_workers.clear();
+
+	lock_guard<mutex> lock(m_mutex);
+	m_quit = false;
+}
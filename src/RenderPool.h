@@ -0,0 +1,92 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#ifndef __RENDERPOOL_H__
+#define __RENDERPOOL_H__
+
+// A set of rendering threads that stay alive between frames.  Each job
+// splits an image into tiles (see TileScheduler) and the workers trace them
+// until the image is done or the job is cancelled; in between jobs the
+// workers sleep.  A job can make several passes over the image; every tile
+// of one pass is finished before any tile of the next is started.
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "TileScheduler.h"
+
+class RenderPool
+{
+public:
+	// Renders the tile [x0, x1) x [y0, y1) for the given pass (counting
+	// from 0); called on a worker thread
+	typedef void (*TileFunc)(void* data, int pass, int x0, int y0, int x1, int y1);
+
+	// Called once all the tiles of a pass are done and before any tile of
+	// the next is started, with the number of passes done so far
+	typedef void (*PassFunc)(void* data, int passesDone);
+
+	RenderPool();
+	~RenderPool();
+
+	// Start rendering a width x height image with num_threads workers, in
+	// the given number of passes, and return right away.  Any job still
+	// running is cancelled first.  passFunc, if given, is called after every
+	// pass that wasn't cancelled.
+	void start(int num_threads, int width, int height, TileFunc func, void* data,
+		int passes = 1, PassFunc passFunc = NULL);
+
+	// Stop handing out tiles; the workers finish the tiles they are on
+	void cancel();
+
+	// Wait for the current job to finish, or for at most the given number of
+	// seconds if it isn't negative.  Returns true once no job is running.
+	bool wait(double seconds = -1.0);
+
+	bool busy() const;
+
+	// Fraction of the current (or last) job's tiles that have been traced,
+	// over all of its passes
+	double progress() const;
+
+	// Passes of the current (or last) job that are completely done
+	int passesDone() const;
+
+	int threadCount() const { return m_workers.size(); }
+
+private:
+	void workerLoop(unsigned seen);
+	void resize(int num_threads);
+	void shutdown();
+
+	std::vector<std::thread> m_workers;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_wake;		// a job was posted or the pool is shutting down
+	std::condition_variable m_idle;		// the last worker left the current job
+
+	// Guarded by m_mutex
+	TileScheduler* m_tiles;
+	TileFunc m_func;
+	void* m_data;
+	unsigned m_job;		// bumped for every new job
+	int m_active;		// workers still on the current job
+	bool m_quit;
+	int m_passes;		// in the current job
+	PassFunc m_passFunc;
+	int m_pass;			// the pass being traced
+	int m_waiting;		// workers done with the tiles of m_pass
+	bool m_nextPass;	// false once the job has no more passes to trace
+	std::condition_variable m_passDone;
+
+	std::atomic<int> m_tilesDone;
+};
+
+#endif // __RENDERPOOL_H__
@@ -0,0 +1,48 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "MeshInstance.h"
+
+// The mesh does all the work in its own local space, which is the
+// instance's local space too; hits are then claimed for the instance so its
+// material is the one that's used.
+bool MeshInstance::intersectLocal(ray& r, isect& i) const
+{
+	if (!mesh->intersectLocal(r, i))
+		return false;
+	i.obj = this;
+	i.setMaterial(getMaterial());
+	return true;
+}
+
+void MeshInstance::intersectLocalPacket(const RayPacket& rp, int active, PacketHit& hit) const
+{
+	mesh->intersectLocalPacket(rp, active, hit);
+	for (int k = 0; k < PACKET_SIZE; ++k)
+	{
+		if ((hit.mask & (1 << k)) && hit.i[k].obj == mesh)
+		{
+			hit.i[k].obj = this;
+			hit.i[k].setMaterial(getMaterial());
+		}
+	}
+}
+
+bool MeshInstance::occludesLocal(ray& r, double tmax) const
+{
+	return mesh->occludesLocal(r, tmax);
+}
+
+bool MeshInstance::opaque() const
+{
+	return mesh->opaque() && material->Opaque();
+}
+
+bool MeshInstance::interpolateMaterial(const isect& i, Material& m) const
+{
+	return mesh->interpolateMaterial(i, m);
+}
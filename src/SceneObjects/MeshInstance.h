@@ -0,0 +1,48 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#ifndef __MESHINSTANCE_H__
+#define __MESHINSTANCE_H__
+
+#include "../scene/scene.h"
+#include "trimesh.h"
+
+// Another copy of a named trimesh under its own transform (and optionally
+// its own material).  The instance keeps nothing of the mesh but a pointer:
+// the vertices, faces and tree all belong to the mesh, so any number of
+// instances cost the geometry memory of one.  The scene's tree holds the
+// instances, each with its transform, and every instance shares the mesh's
+// tree below that.
+class MeshInstance
+	: public MaterialSceneObject
+{
+public:
+	// The mesh belongs to the scene and must outlive the instance
+	MeshInstance( Scene *scene, Material *mat, Trimesh *mesh )
+		: MaterialSceneObject( scene, mat ), mesh( mesh )
+	{
+	}
+
+	virtual bool intersectLocal(ray& r, isect& i) const;
+	virtual void intersectLocalPacket(const RayPacket& rp, int active, PacketHit& hit) const;
+	virtual bool occludesLocal(ray& r, double tmax) const;
+	virtual bool opaque() const;
+	virtual double uvPerUnit(const isect& i) const { return mesh->uvPerUnit(i); }
+
+	virtual bool interpolateMaterial(const isect& i, Material& m) const;
+
+	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual BoundingBox ComputeLocalBoundingBox() { return mesh->ComputeLocalBoundingBox(); }
+
+protected:
+	void glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const;
+
+private:
+	Trimesh* mesh;
+};
+
+#endif // __MESHINSTANCE_H__
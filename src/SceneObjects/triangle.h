@@ -0,0 +1,303 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// triangle.h
+//
+// Ray-triangle tests used by Trimesh besides its original plane test.
+// Each one is a template on the precision the arithmetic is done in; the
+// vertices and edges come in whatever precision the mesh stores (Real), and
+// the results are always doubles.  A hit fills in t and the barycentric
+// weights of the three vertices (alpha for the first).
+//
+
+#ifndef __TRIANGLE_H__
+#define __TRIANGLE_H__
+
+#include <cmath>
+#include <cfloat>
+
+#include "../scene/ray.h"
+#include "../scene/packet.h"
+
+// Hits closer than this are treated as the ray leaving the surface it
+// started on.  In double precision that's RAY_EPSILON as everywhere else.
+// Single precision t is much rougher, mostly for rays that leave a surface
+// at a shallow angle, and so are single precision edges, so if either the
+// test or the mesh is single precision the cutoff grows with the distance
+// to the triangle (the largest component of a vertex minus the ray origin).
+template <class Real>
+inline double triangleMinT(double distance)
+{
+  return std::max(surfaceEpsilon<Real>(distance), surfaceEpsilon< ::Real >(distance));
+}
+
+// The same for four lanes of double precision arithmetic, given each
+// lane's vertex minus ray origin
+inline Double4 triangleMinT4(const Double4 s[3])
+{
+  if (sizeof(Real) == sizeof(double))
+    return d4Set(RAY_EPSILON);
+  Double4 distance = d4Max(d4Abs(s[0]), d4Max(d4Abs(s[1]), d4Abs(s[2])));
+  return d4Set(RAY_EPSILON) + d4Set(4096.0 * FLT_EPSILON) * distance;
+}
+
+inline double maxAbsComponent(const Vec3d& v)
+{
+  return std::max(std::fabs(v[0]), std::max(std::fabs(v[1]), std::fabs(v[2])));
+}
+
+// Moller-Trumbore: solves for t and the barycentrics directly from the
+// edges e1 = b - a and e2 = c - a, with a single division.
+template <class Real, class Stored>
+inline bool intersectMollerTrumbore(const ray& r, const Vec3<Stored>& a, const Vec3<Stored>& e1, const Vec3<Stored>& e2,
+                                    double& t, double& alpha, double& beta, double& gamma)
+{
+  Vec3<Real> d = Vec3<Real>(Real(r.d[0]), Real(r.d[1]), Real(r.d[2]));
+  Vec3<Real> E1 = Vec3<Real>(Real(e1[0]), Real(e1[1]), Real(e1[2]));
+  Vec3<Real> E2 = Vec3<Real>(Real(e2[0]), Real(e2[1]), Real(e2[2]));
+
+  // Relative to the first vertex, which keeps the single precision version
+  // accurate away from the origin
+  Vec3d ap = r.p - toVec3d(a);
+  Vec3<Real> s = Vec3<Real>(Real(ap[0]), Real(ap[1]), Real(ap[2]));
+
+  Vec3<Real> pvec = d ^ E2;
+  Real det = E1 * pvec;
+
+  // Parallel to the plane of the triangle (or the triangle has no area)
+  if (det == Real(0))
+    return false;
+  Real inv_det = Real(1) / det;
+
+  Real b = (s * pvec) * inv_det;
+  if (b < Real(0) || b > Real(1))
+    return false;
+
+  Vec3<Real> qvec = s ^ E1;
+  Real g = (d * qvec) * inv_det;
+  if (g < Real(0) || b + g > Real(1))
+    return false;
+
+  t = (E2 * qvec) * inv_det;
+  if (t < triangleMinT<Real>(maxAbsComponent(ap)))
+    return false;
+
+  beta = b;
+  gamma = g;
+  alpha = 1.0 - (beta + gamma);
+  return true;
+}
+
+// Per-ray setup for the watertight test of Woop, Benthin and Wald: the
+// axis the ray mostly travels along becomes z, and a shear maps the ray
+// onto that axis so the triangle can be tested in 2D.
+struct WatertightRay
+{
+  WatertightRay() {}
+  WatertightRay(const ray& r)
+  {
+    kz = 0;
+    if (std::fabs(r.d[1]) > std::fabs(r.d[kz])) kz = 1;
+    if (std::fabs(r.d[2]) > std::fabs(r.d[kz])) kz = 2;
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+
+    // Keep the winding of the triangle the same after the permutation
+    if (r.d[kz] < 0.0)
+      std::swap(kx, ky);
+
+    Sx = r.d[kx] / r.d[kz];
+    Sy = r.d[ky] / r.d[kz];
+    Sz = 1.0 / r.d[kz];
+  }
+
+  int kx, ky, kz;
+  double Sx, Sy, Sz;
+};
+
+// The watertight test.  Edges shared by two triangles are computed the
+// same way for both, so a ray can't slip between them; when single
+// precision can't decide which side of an edge the ray is on, the edge
+// functions are redone in double precision.
+template <class Real, class Stored>
+inline bool intersectWatertight(const ray& r, const WatertightRay& w, const Vec3<Stored>& a, const Vec3<Stored>& b, const Vec3<Stored>& c,
+                                double& t, double& alpha, double& beta, double& gamma)
+{
+  Vec3d A = toVec3d(a) - r.p;
+  Vec3d B = toVec3d(b) - r.p;
+  Vec3d C = toVec3d(c) - r.p;
+
+  Real Sx = Real(w.Sx), Sy = Real(w.Sy);
+  Real Ax = Real(A[w.kx]) - Sx * Real(A[w.kz]);
+  Real Ay = Real(A[w.ky]) - Sy * Real(A[w.kz]);
+  Real Bx = Real(B[w.kx]) - Sx * Real(B[w.kz]);
+  Real By = Real(B[w.ky]) - Sy * Real(B[w.kz]);
+  Real Cx = Real(C[w.kx]) - Sx * Real(C[w.kz]);
+  Real Cy = Real(C[w.ky]) - Sy * Real(C[w.kz]);
+
+  // Scaled barycentrics: how far the ray is inside each edge
+  double U = Cx * By - Cy * Bx;
+  double V = Ax * Cy - Ay * Cx;
+  double W = Bx * Ay - By * Ax;
+
+  if (sizeof(Real) < sizeof(double) && (U == 0.0 || V == 0.0 || W == 0.0))
+  {
+    double dAx = A[w.kx] - w.Sx * A[w.kz], dAy = A[w.ky] - w.Sy * A[w.kz];
+    double dBx = B[w.kx] - w.Sx * B[w.kz], dBy = B[w.ky] - w.Sy * B[w.kz];
+    double dCx = C[w.kx] - w.Sx * C[w.kz], dCy = C[w.ky] - w.Sy * C[w.kz];
+    U = dCx * dBy - dCy * dBx;
+    V = dAx * dCy - dAy * dCx;
+    W = dBx * dAy - dBy * dAx;
+  }
+
+  // Outside one edge or another; hits count from either side of the triangle
+  if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0))
+    return false;
+
+  double det = U + V + W;
+  if (det == 0.0)
+    return false;
+
+  Real Az = Real(w.Sz) * Real(A[w.kz]);
+  Real Bz = Real(w.Sz) * Real(B[w.kz]);
+  Real Cz = Real(w.Sz) * Real(C[w.kz]);
+  double T = U * Az + V * Bz + W * Cz;
+
+  double inv_det = 1.0 / det;
+  t = T * inv_det;
+  if (t < triangleMinT<Real>(maxAbsComponent(A)))
+    return false;
+
+  alpha = U * inv_det;
+  beta = V * inv_det;
+  gamma = W * inv_det;
+  return true;
+}
+
+// Moller-Trumbore for four triangles and one ray.  The triangles are given
+// lane by lane (a, e1 and e2 one component at a time) and each lane is
+// computed the same way as intersectMollerTrumbore<double>.  Returns the
+// lanes in active that hit, with their t and barycentrics, which are left
+// alone when none do.
+inline int intersectMollerTrumbore4(const ray& r, const Double4 a[3], const Double4 e1[3], const Double4 e2[3], int active,
+                                    Double4& t, Double4& beta, Double4& gamma)
+{
+  Double4 d[3] = { d4Set(r.d[0]), d4Set(r.d[1]), d4Set(r.d[2]) };
+  Double4 s[3];
+  for (int k = 0; k < 3; ++k)
+    s[k] = d4Set(r.p[k]) - a[k];
+
+  // pvec = d ^ e2, det = e1 * pvec
+  Double4 pvec[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+  Double4 det = e1[0] * pvec[0] + e1[1] * pvec[1] + e1[2] * pvec[2];
+
+  Double4 zero = d4Set(0.0);
+  Double4 one = d4Set(1.0);
+  active &= ~d4Equal(det, zero);
+  if (!active)
+    return 0;
+  Double4 inv_det = one / det;
+
+  beta = (s[0] * pvec[0] + s[1] * pvec[1] + s[2] * pvec[2]) * inv_det;
+  active &= ~(d4Less(beta, zero) | d4Less(one, beta));
+  if (!active)
+    return 0;
+
+  // qvec = s ^ e1
+  Double4 qvec[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+  gamma = (d[0] * qvec[0] + d[1] * qvec[1] + d[2] * qvec[2]) * inv_det;
+  active &= ~(d4Less(gamma, zero) | d4Less(one, beta + gamma));
+  if (!active)
+    return 0;
+
+  t = (e2[0] * qvec[0] + e2[1] * qvec[1] + e2[2] * qvec[2]) * inv_det;
+  return active & ~d4Less(t, triangleMinT4(s));
+}
+
+// The watertight test for four triangles and one ray, each lane computed
+// the same way as intersectWatertight<double>.  a, b and c are the
+// triangles' vertices, lane by lane.  Returns the lanes in active that hit;
+// t and the barycentrics are left alone when none do.
+inline int intersectWatertight4(const ray& r, const WatertightRay& w, const Double4 a[3], const Double4 b[3], const Double4 c[3], int active,
+                                Double4& t, Double4& alpha, Double4& beta, Double4& gamma)
+{
+  Double4 px = d4Set(r.p[w.kx]), py = d4Set(r.p[w.ky]), pz = d4Set(r.p[w.kz]);
+  Double4 Sx = d4Set(w.Sx), Sy = d4Set(w.Sy), Sz = d4Set(w.Sz);
+
+  Double4 Akz = a[w.kz] - pz, Bkz = b[w.kz] - pz, Ckz = c[w.kz] - pz;
+  Double4 Ax = (a[w.kx] - px) - Sx * Akz;
+  Double4 Ay = (a[w.ky] - py) - Sy * Akz;
+  Double4 Bx = (b[w.kx] - px) - Sx * Bkz;
+  Double4 By = (b[w.ky] - py) - Sy * Bkz;
+  Double4 Cx = (c[w.kx] - px) - Sx * Ckz;
+  Double4 Cy = (c[w.ky] - py) - Sy * Ckz;
+
+  Double4 U = Cx * By - Cy * Bx;
+  Double4 V = Ax * Cy - Ay * Cx;
+  Double4 W = Bx * Ay - By * Ax;
+
+  Double4 zero = d4Set(0.0);
+  int negative = d4Less(U, zero) | d4Less(V, zero) | d4Less(W, zero);
+  int positive = d4Less(zero, U) | d4Less(zero, V) | d4Less(zero, W);
+  active &= ~(negative & positive);
+  if (!active)
+    return 0;
+
+  Double4 det = U + V + W;
+  active &= ~d4Equal(det, zero);
+  if (!active)
+    return 0;
+
+  Double4 T = U * (Sz * Akz) + V * (Sz * Bkz) + W * (Sz * Ckz);
+  Double4 inv_det = d4Set(1.0) / det;
+  t = T * inv_det;
+  alpha = U * inv_det;
+  beta = V * inv_det;
+  gamma = W * inv_det;
+  Double4 A[3] = { a[0] - d4Set(r.p[0]), a[1] - d4Set(r.p[1]), a[2] - d4Set(r.p[2]) };
+  return active & ~d4Less(t, triangleMinT4(A));
+}
+
+// Moller-Trumbore for the four rays of a packet against one triangle, each
+// lane computed the same way as intersectMollerTrumbore<double>.  Returns
+// the lanes in active that hit and their t; t is left alone when none do.
+inline int intersectMollerTrumbore(const RayPacket& rp, const Vec3r& a, const Vec3r& e1, const Vec3r& e2, int active, Double4& t)
+{
+  Double4 E1[3] = { d4Set(e1[0]), d4Set(e1[1]), d4Set(e1[2]) };
+  Double4 E2[3] = { d4Set(e2[0]), d4Set(e2[1]), d4Set(e2[2]) };
+  Double4 s[3];
+  for (int k = 0; k < 3; ++k)
+    s[k] = rp.p[k] - d4Set(a[k]);
+
+  const Double4* d = rp.d;
+  Double4 pvec[3] = { d[1] * E2[2] - d[2] * E2[1], d[2] * E2[0] - d[0] * E2[2], d[0] * E2[1] - d[1] * E2[0] };
+  Double4 det = E1[0] * pvec[0] + E1[1] * pvec[1] + E1[2] * pvec[2];
+
+  Double4 zero = d4Set(0.0);
+  Double4 one = d4Set(1.0);
+  active &= ~d4Equal(det, zero);
+  if (!active)
+    return 0;
+  Double4 inv_det = one / det;
+
+  Double4 beta = (s[0] * pvec[0] + s[1] * pvec[1] + s[2] * pvec[2]) * inv_det;
+  active &= ~(d4Less(beta, zero) | d4Less(one, beta));
+  if (!active)
+    return 0;
+
+  Double4 qvec[3] = { s[1] * E1[2] - s[2] * E1[1], s[2] * E1[0] - s[0] * E1[2], s[0] * E1[1] - s[1] * E1[0] };
+  Double4 gamma = (d[0] * qvec[0] + d[1] * qvec[1] + d[2] * qvec[2]) * inv_det;
+  active &= ~(d4Less(gamma, zero) | d4Less(one, beta + gamma));
+  if (!active)
+    return 0;
+
+  t = (E2[0] * qvec[0] + E2[1] * qvec[1] + E2[2] * qvec[2]) * inv_det;
+  return active & ~d4Less(t, triangleMinT4(s));
+}
+
+#endif // __TRIANGLE_H__
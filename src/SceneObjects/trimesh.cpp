@@ -11,6 +11,7 @@
 #include <assert.h>
 #include "trimesh.h"
 #include "../ui/TraceUI.h"
+#include "../RayStats.h"
 #include "../scene/bbox.h"
 extern TraceUI* traceUI;
 
@@ -20,6 +21,8 @@ Trimesh::~Trimesh()
 {
     if (kdtree)
         delete kdtree;
+    if (bvh)
+        delete bvh;
 
 	for( Materials::iterator i = materials.begin(); i != materials.end(); ++i )
 		delete *i;
@@ -28,7 +31,8 @@ Trimesh::~Trimesh()
 // must add vertices, normals, and materials IN ORDER
 void Trimesh::addVertex( const Vec3d &v )
 {
-    vertices.push_back( v );
+    vertices.push_back( toVec3r(v) );
+    localBoundsValid = false;
 }
 
 void Trimesh::addMaterial( Material *m )
@@ -38,7 +42,7 @@ void Trimesh::addMaterial( Material *m )
 
 void Trimesh::addNormal( const Vec3d &n )
 {
-    normals.push_back( n );
+    normals.push_back( toVec3r(n) );
 }
 
 // Returns false if the vertices a,b,c don't all exist
@@ -48,14 +52,71 @@ bool Trimesh::addFace( int a, int b, int c )
 
     if( a >= vcnt || b >= vcnt || c >= vcnt ) return false;
 
-    TrimeshFace *newFace = new TrimeshFace( scene, new Material(*this->material), this, a, b, c );
-    newFace->setTransform(this->transform);
-    if (!newFace->degen) faces.push_back( newFace );
+    Vec3d a_coords = toVec3d(vertices[a]);
+    Vec3d b_coords = toVec3d(vertices[b]);
+    Vec3d c_coords = toVec3d(vertices[c]);
+
+    Vec3d vab = (b_coords - a_coords);
+    Vec3d vac = (c_coords - a_coords);
+    Vec3d vcb = (b_coords - c_coords);
+
+    // Faces with coincident vertices can't be hit, so they aren't kept
+    if (vab.iszero() || vac.iszero() || vcb.iszero())
+        return true;
+
+    // Precompute constant values for ray-triangle intersection code, in
+    // double and only then rounded to how they're stored
+    FaceEdges edges;
+    edges.u = toVec3r(vab);
+    edges.v = toVec3r(vac);
+    double u_dot_u = vab.length2();
+    double v_dot_v = vac.length2();
+    double u_dot_v = vab * vac;
+    edges.u_dot_u = Real(u_dot_u);
+    edges.v_dot_v = Real(v_dot_v);
+    edges.u_dot_v = Real(u_dot_v);
+    edges.tri_area = Real((u_dot_v * u_dot_v) - (u_dot_u * v_dot_v));
+
+    // Compute the face normal here, not on the fly
+    Vec3d normal = (vab ^ vac);
+    normal.normalize();
+    edges.normal = toVec3r(normal);
+
+    faceIds.push_back(a);
+    faceIds.push_back(b);
+    faceIds.push_back(c);
+    faceEdges.push_back(edges);
+    return true;
+}
+
+void Trimesh::buildKdTree(BuildPool* pool)
+{
+    if (kdtree)
+        delete kdtree;
+    if (bvh)
+        delete bvh;
+    kdtree = NULL;
+    bvh = NULL;
 
+    kernel = traceUI->getTriangleKernel();
+    floatKernel = traceUI->floatTriangles();
 
-    // Don't add faces to the scene's object list so we can cull by bounding box
-    // scene->add(newFace);
-    return true;
+    if (traceUI->getAccelType() == TraceUI::ACCEL_BVH)
+        bvh = new Bvh<Trimesh>(*this, pool, traceUI->getCacheDir());
+    else
+        kdtree = new KdTree<Trimesh>(*this, pool);
+
+    allOpaque = material->Opaque();
+    for (Materials::const_iterator m = materials.begin(); m != materials.end(); ++m)
+        allOpaque = allOpaque && (*m)->Opaque();
+}
+
+void Trimesh::getAccelStats(AccelStats& stats) const
+{
+    if (kdtree)
+        kdtree->getStats(stats);
+    if (bvh)
+        bvh->getStats(stats);
 }
 
 char* Trimesh::doubleCheck()
@@ -70,21 +131,32 @@ char* Trimesh::doubleCheck()
     return 0;
 }
 
+double Trimesh::uvPerUnit(const isect& i) const
+{
+    if (i.face < 0)
+        return 1.0;
+
+    // One over the geometric mean of the two edge lengths
+    const FaceEdges& e = faceEdges[i.face];
+    return 1.0 / sqrt(sqrt(double(e.u_dot_u) * double(e.v_dot_v)));
+}
+
 bool Trimesh::intersectLocal(ray& r, isect& i) const
 {
 	bool have_one = false;
 
-    if (kdtree && traceUI->usingKdTree())
+    if (bvh && traceUI->usingKdTree())
+        bvh->intersect(r, i, have_one);
+    else if (kdtree && traceUI->usingKdTree())
         kdtree->intersect(r, i, have_one); // Pass have_one in by reference
     else
     {
-        double tmin = 0.0;
-        double tmax = 0.0;
-        typedef Faces::const_iterator iter;
-        for( iter j = faces.begin(); j != faces.end(); ++j )
+        RaySetup setup = raySetup(r);
+        int num_faces = primitiveCount();
+        for( int j = 0; j < num_faces; ++j )
         {
             isect cur;
-            if( (*j)->intersectLocal( r, cur ) )
+            if( intersectPrimitive( j, r, setup, cur ) )
             {
                 if( !have_one || (cur.t < i.t) )
                 {
@@ -98,24 +170,227 @@ bool Trimesh::intersectLocal(ray& r, isect& i) const
 	return have_one;
 }
 
-bool TrimeshFace::intersect(ray& r, isect& i) const {
-  return intersectLocal(r, i);
+void Trimesh::intersectLocalPacket(const RayPacket& rp, int active, PacketHit& hit) const
+{
+    PacketHit faceHit;
+
+    if (bvh && traceUI->usingKdTree())
+        bvh->intersectPacket(rp, active, faceHit);
+    else if (kdtree && traceUI->usingKdTree())
+        kdtree->intersectPacket(rp, active, faceHit);
+    else
+    {
+        PacketSetup setup = packetSetup(rp);
+        int num_faces = primitiveCount();
+        for (int j = 0; j < num_faces; ++j)
+            intersectPrimitivePacket(j, rp, setup, active, faceHit);
+    }
+
+    // Fill in the normal, material etc. only for the face each ray ends up hitting
+    for (int k = 0; k < PACKET_SIZE; ++k)
+    {
+        if (!(faceHit.mask & (1 << k)))
+            continue;
+
+        ray r = rp.get(k);
+        isect cur;
+        if (intersectPrimitive(faceHit.i[k].face, r, raySetup(r), cur))
+            hit.update(k, cur);
+    }
 }
 
-// Intersect ray r with the triangle abc.  If it hits returns true,
-// and put the parameter in t and the barycentric coordinates of the
-// intersection in u (alpha) and v (beta).
-bool TrimeshFace::intersectLocal(ray& r, isect& i) const
+bool Trimesh::occludesLocal(ray& r, double tmax) const
 {
-    const Vec3d& a = parent->vertices[ids[0]];
-    const Vec3d& b = parent->vertices[ids[1]];
-    const Vec3d& c = parent->vertices[ids[2]];
+    if (bvh && traceUI->usingKdTree())
+        return bvh->occluded(r, tmax);
+    else if (kdtree && traceUI->usingKdTree())
+        return kdtree->occluded(r, tmax);
+
+    RaySetup setup = raySetup(r);
+    int num_faces = primitiveCount();
+    for (int j = 0; j < num_faces; ++j)
+        if (occludesPrimitive(j, r, setup, tmax))
+            return true;
+    return false;
+}
+
+bool Trimesh::occludesPrimitive(int face, ray& r, const RaySetup& setup, double tmax) const
+{
+    double t, alpha, beta, gamma;
+    return intersectTriangle(face, r, setup, t, alpha, beta, gamma) && t < tmax;
+}
+
+Trimesh::RaySetup Trimesh::raySetup(const ray& r) const
+{
+    RaySetup setup;
+    if (kernel == TraceUI::TRIANGLE_WATERTIGHT)
+        setup.w = WatertightRay(r);
+    setup.counts = RayStats::testCounts();
+    return setup;
+}
+
+Trimesh::PacketSetup Trimesh::packetSetup(const RayPacket& rp) const
+{
+    PacketSetup setup;
+    setup.counts = RayStats::testCounts();
+    for (int k = 0; k < PACKET_SIZE; ++k)
+    {
+        if (kernel == TraceUI::TRIANGLE_WATERTIGHT)
+            setup.lane[k].w = WatertightRay(rp.get(k));
+        setup.lane[k].counts = setup.counts;
+    }
+    return setup;
+}
+
+// The same test as intersectTriangle() done for four rays at once, with the
+// operations kept in the same order so each lane gets the scalar answer
+void Trimesh::intersectPrimitivePacket(int face, const RayPacket& rp, const PacketSetup& setup, int active, PacketHit& hit) const
+{
+    const FaceEdges& e = faceEdges[face];
+
+    if (kernel == TraceUI::TRIANGLE_MOLLER && !floatKernel)
+    {
+        if (setup.counts)
+            setup.counts->triangleTests += packetLaneCount(active);
+        Double4 t = hit.t;
+        active = intersectMollerTrumbore(rp, vertices[faceIds[3 * face]], e.u, e.v, active, t);
+        if (!active)
+            return;
+        active &= d4Less(t, hit.t);
+        if (!active)
+            return;
+        double ts[PACKET_SIZE];
+        d4Store(ts, t);
+        for (int k = 0; k < PACKET_SIZE; ++k)
+        {
+            if (active & (1 << k))
+            {
+                hit.i[k].obj = this;
+                hit.i[k].face = face;
+                hit.i[k].t = ts[k];
+            }
+        }
+        hit.t = d4Select(active, t, hit.t);
+        hit.mask |= active;
+        return;
+    }
+    else if (kernel != TraceUI::TRIANGLE_PLANE)
+    {
+        // The other kernels have no packet version; test the rays one at a time
+        double ts[PACKET_SIZE];
+        d4Store(ts, hit.t);
+        for (int k = 0; k < PACKET_SIZE; ++k)
+        {
+            double t, alpha, beta, gamma;
+            if ((active & (1 << k)) && intersectTriangle(face, rp.get(k), setup.lane[k], t, alpha, beta, gamma) && t < ts[k])
+            {
+                isect cur;
+                cur.obj = this;
+                cur.face = face;
+                cur.t = t;
+                hit.update(k, cur);
+            }
+        }
+        return;
+    }
+
+    if (setup.counts)
+        setup.counts->triangleTests += packetLaneCount(active);
+    if (abs(e.tri_area) < RAY_EPSILON)
+        return;
+
+    const Vec3r& normal = e.normal;
+    const Vec3r& u = e.u;
+    const Vec3r& v = e.v;
+    const Vec3r& a = vertices[faceIds[3 * face]];
+    Double4 eps = d4Set(RAY_EPSILON);
+    Double4 zero = d4Set(0.0);
+
+    Double4 cos_plane_r = d4Set(normal[0]) * rp.d[0] + d4Set(normal[1]) * rp.d[1] + d4Set(normal[2]) * rp.d[2];
+    active &= ~d4Less(d4Abs(cos_plane_r), eps);
+    if (!active)
+        return;
+
+    Double4 ap[3];
+    for (int k = 0; k < 3; ++k)
+        ap[k] = d4Set(a[k]) - rp.p[k];
+    Double4 t = (d4Set(normal[0]) * ap[0] + d4Set(normal[1]) * ap[1] + d4Set(normal[2]) * ap[2]) / cos_plane_r;
+
+    // In front of the ray and closer than what each ray has already hit
+    active &= ~d4Less(t, triangleMinT4(ap)) & d4Less(t, hit.t);
+    if (!active)
+        return;
+
+    Double4 w[3];
+    for (int k = 0; k < 3; ++k)
+        w[k] = (rp.d[k] * t + rp.p[k]) - d4Set(a[k]);
+    Double4 w_dot_v = w[0] * d4Set(v[0]) + w[1] * d4Set(v[1]) + w[2] * d4Set(v[2]);
+    Double4 w_dot_u = w[0] * d4Set(u[0]) + w[1] * d4Set(u[1]) + w[2] * d4Set(u[2]);
+
+    Double4 area = d4Set(e.tri_area);
+    Double4 beta = (d4Set(e.u_dot_v) * w_dot_v - d4Set(e.v_dot_v) * w_dot_u) / area;
+    Double4 gamma = (d4Set(e.u_dot_v) * w_dot_u - d4Set(e.u_dot_u) * w_dot_v) / area;
+    Double4 alpha = d4Set(1.0) - (beta + gamma);
+
+    active &= ~(d4Less(alpha, zero) | d4Less(beta, zero) | d4Less(gamma, zero));
+    if (!active)
+        return;
+
+    double ts[PACKET_SIZE];
+    d4Store(ts, t);
+    for (int k = 0; k < PACKET_SIZE; ++k)
+    {
+        if (active & (1 << k))
+        {
+            hit.i[k].obj = this;
+            hit.i[k].face = face;
+            hit.i[k].t = ts[k];
+        }
+    }
+    hit.t = d4Select(active, t, hit.t);
+    hit.mask |= active;
+}
+
+// Intersect ray r with the triangle abc of the given face.  If it hits
+// returns true, and put the parameter in t and the barycentric coordinates
+// of the intersection in alpha, beta and gamma.
+bool Trimesh::intersectTriangle(int face, const ray& r, const RaySetup& setup, double& t, double& alpha, double& beta, double& gamma) const
+{
+    if (setup.counts)
+        ++setup.counts->triangleTests;
+    const int* ids = &faceIds[3 * face];
+    switch (kernel)
+    {
+    case TraceUI::TRIANGLE_MOLLER:
+        if (floatKernel)
+            return intersectMollerTrumbore<float>(r, vertices[ids[0]], faceEdges[face].u, faceEdges[face].v, t, alpha, beta, gamma);
+        return intersectMollerTrumbore<double>(r, vertices[ids[0]], faceEdges[face].u, faceEdges[face].v, t, alpha, beta, gamma);
+
+    case TraceUI::TRIANGLE_WATERTIGHT:
+        if (floatKernel)
+            return intersectWatertight<float>(r, setup.w, vertices[ids[0]], vertices[ids[1]], vertices[ids[2]], t, alpha, beta, gamma);
+        return intersectWatertight<double>(r, setup.w, vertices[ids[0]], vertices[ids[1]], vertices[ids[2]], t, alpha, beta, gamma);
+
+    default:
+        return intersectTrianglePlane(face, r, t, alpha, beta, gamma);
+    }
+}
+
+// The original test: find where the ray meets the plane of the triangle,
+// then work out the barycentric coordinates of that point.
+bool Trimesh::intersectTrianglePlane(int face, const ray& r, double& t, double& alpha, double& beta, double& gamma) const
+{
+    const FaceEdges& e = faceEdges[face];
+    Vec3d a = toVec3d(vertices[faceIds[3 * face]]);
+    Vec3d normal = toVec3d(e.normal);
+    Vec3d u = toVec3d(e.u);
+    Vec3d v = toVec3d(e.v);
 
     // YOUR CODE HERE
 
     // Following code is based on this article: http://geomalgorithms.com/a06-_intersect-2.html
     // First off, make sure testing for intersection with the triangle even makes sense (make sure we haven't a zero area triangle)
-    if (abs(tri_area) < RAY_EPSILON)
+    if (abs(e.tri_area) < RAY_EPSILON)
         return false;
 
     // Check to see if we intersect with the plane that the triangle resides in
@@ -126,10 +401,10 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
         return false;
 
     // Compute the t value at which the ray intersects the plane
-    double t = (normal * (a - r.p)) / cos_plane_r;
+    t = (normal * (a - r.p)) / cos_plane_r;
 
     // Behind us or at the starting point of the ray
-    if (t < RAY_EPSILON)
+    if (t < triangleMinT<double>(maxAbsComponent(a - r.p)))
         return false;
 
     // We intersect the plane, now find if the point intersects with the triangle
@@ -138,14 +413,124 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
     double w_dot_u = w * u;
 
     // Compute barycentric coordinates of intersection point
-    double beta = ((u_dot_v * w_dot_v) - (v_dot_v * w_dot_u)) / tri_area;
-    double gamma = ((u_dot_v * w_dot_u) - (u_dot_u * w_dot_v)) / tri_area;
-    double alpha = 1.0 - (beta + gamma);
+    beta = ((e.u_dot_v * w_dot_v) - (e.v_dot_v * w_dot_u)) / e.tri_area;
+    gamma = ((e.u_dot_v * w_dot_u) - (e.u_dot_u * w_dot_v)) / e.tri_area;
+    alpha = 1.0 - (beta + gamma);
 
     // If any of the barycentric coordinates are less than 0 then we did not intersect the triangle
-    if (alpha < 0.0 || beta < 0.0 || gamma < 0.0)
+    return !(alpha < 0.0 || beta < 0.0 || gamma < 0.0);
+}
+
+BoundingBox Trimesh::primitiveBounds(int face) const
+{
+    const int* ids = &faceIds[3 * face];
+    BoundingBox localbounds;
+    Vec3d a = toVec3d(vertices[ids[0]]);
+    Vec3d b = toVec3d(vertices[ids[1]]);
+    Vec3d c = toVec3d(vertices[ids[2]]);
+    localbounds.setMax(maximum( a, b ));
+    localbounds.setMin(minimum( a, b ));
+
+    localbounds.setMax(maximum( c, localbounds.getMax()));
+    localbounds.setMin(minimum( c, localbounds.getMin()));
+    return localbounds;
+}
+
+// Intersect ray r with the given face.  If it hits returns true,
+// and put the parameter in t and the barycentric coordinates of the
+// intersection in u (alpha) and v (beta).
+bool Trimesh::intersectPrimitive(int face, ray& r, const RaySetup& setup, isect& i) const
+{
+    double t, alpha, beta, gamma;
+    if (!intersectTriangle(face, r, setup, t, alpha, beta, gamma))
         return false;
 
+    setHit(face, t, alpha, beta, gamma, i);
+    return true;
+}
+
+void Trimesh::intersectLeaf(const int* faces, int count, ray& r, const RaySetup& setup, isect& i, bool& have_one) const
+{
+    if ((kernel == TraceUI::TRIANGLE_MOLLER || kernel == TraceUI::TRIANGLE_WATERTIGHT) && !floatKernel)
+    {
+        for (int j = 0; j < count; j += PACKET_SIZE)
+            intersectFaces4(faces + j, std::min((int)PACKET_SIZE, count - j), r, setup, i, have_one);
+        return;
+    }
+
+    isect cur;
+    for (int j = 0; j < count; ++j)
+    {
+        if (intersectPrimitive(faces[j], r, setup, cur) && (!have_one || cur.t < i.t))
+        {
+            i = cur;
+            have_one = true;
+        }
+    }
+}
+
+void Trimesh::intersectFaces4(const int* faces, int count, const ray& r, const RaySetup& setup, isect& i, bool& have_one) const
+{
+    if (setup.counts)
+        setup.counts->triangleTests += count;
+
+    // Gather the faces a component at a time; unused lanes repeat the last face
+    double comp[9][PACKET_SIZE];
+    bool watertight = (kernel == TraceUI::TRIANGLE_WATERTIGHT);
+    for (int k = 0; k < PACKET_SIZE; ++k)
+    {
+        int face = faces[k < count ? k : count - 1];
+        const int* ids = &faceIds[3 * face];
+        const Vec3r& a = vertices[ids[0]];
+        const Vec3r& b = watertight ? vertices[ids[1]] : faceEdges[face].u;
+        const Vec3r& c = watertight ? vertices[ids[2]] : faceEdges[face].v;
+        for (int n = 0; n < 3; ++n)
+        {
+            comp[n][k] = a[n];
+            comp[3 + n][k] = b[n];
+            comp[6 + n][k] = c[n];
+        }
+    }
+    Double4 a[3], b[3], c[3];
+    for (int n = 0; n < 3; ++n)
+    {
+        a[n] = d4Load(comp[n]);
+        b[n] = d4Load(comp[3 + n]);
+        c[n] = d4Load(comp[6 + n]);
+    }
+
+    int active = (1 << count) - 1;
+    Double4 t, alpha, beta, gamma;
+    if (watertight)
+        active = intersectWatertight4(r, setup.w, a, b, c, active, t, alpha, beta, gamma);
+    else
+        active = intersectMollerTrumbore4(r, a, b, c, active, t, beta, gamma);
+    if (!active)
+        return;
+    if (!watertight)
+        alpha = d4Set(1.0) - (beta + gamma);
+
+    // Only the closest of the four is worth filling in
+    double ts[PACKET_SIZE], as[PACKET_SIZE], bs[PACKET_SIZE], gs[PACKET_SIZE];
+    d4Store(ts, t);
+    d4Store(as, alpha);
+    d4Store(bs, beta);
+    d4Store(gs, gamma);
+    int best = -1;
+    for (int k = 0; k < count; ++k)
+    {
+        if ((active & (1 << k)) && (best < 0 || ts[k] < ts[best]))
+            best = k;
+    }
+    if (!have_one || ts[best] < i.t)
+    {
+        setHit(faces[best], ts[best], as[best], bs[best], gs[best], i);
+        have_one = true;
+    }
+}
+
+void Trimesh::setHit(int face, double t, double alpha, double beta, double gamma, isect& i) const
+{
     // We have an intersection!
     // Set t value, barycentric coordinates, uv coordinates, intersected object pointer, and material pointer
     i.t = t;
@@ -155,13 +540,15 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
     i.uvCoordinates[0] = beta;
     i.uvCoordinates[1] = gamma;
     i.obj = this;
+    i.face = face;
 
     // Interpolate vertex normals to find normal at point or just take surface normal
-    if (parent->vertNorms)
+    if (vertNorms)
     {
-        const Vec3d& na = parent->normals[ids[0]];
-        const Vec3d& nb = parent->normals[ids[1]];
-        const Vec3d& nc = parent->normals[ids[2]];
+        const int* ids = &faceIds[3 * face];
+        Vec3d na = toVec3d(normals[ids[0]]);
+        Vec3d nb = toVec3d(normals[ids[1]]);
+        Vec3d nc = toVec3d(normals[ids[2]]);
 
         // Barycentric interpolation is some cool shit
         i.N = ((alpha * na) + (beta * nb) + (gamma * nc));
@@ -169,27 +556,30 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
     }
     else
     {
-        i.N = normal;
+        i.N = toVec3d(faceEdges[face].normal);
         i.N.normalize();
     }
 
+    // Per-vertex materials are blended later, and only for the closest hit (see interpolateMaterial)
+    i.setMaterial(this->getMaterial());
+}
+
+bool Trimesh::interpolateMaterial(const isect& i, Material& m) const
+{
     // Interpolate vertex materials if possible
-    if (!parent->materials.empty())
-    {
-        // The overloaded operators for materials suck
-        Material ma(*parent->materials[ids[0]]);
-        Material mb(*parent->materials[ids[1]]);
-        Material mc(*parent->materials[ids[2]]);
+    if (materials.empty() || i.face < 0)
+        return false;
 
-        Material m;
-        m += (alpha * ma);
-        m += (beta * mb);
-        m += (gamma * mc);
+    // The overloaded operators for materials suck
+    const int* ids = &faceIds[3 * i.face];
+    Material ma(*materials[ids[0]]);
+    Material mb(*materials[ids[1]]);
+    Material mc(*materials[ids[2]]);
 
-        i.setMaterial(m);
-    }
-    else
-        i.setMaterial(this->getMaterial());
+    m = Material();
+    m += (i.bary[0] * ma);
+    m += (i.bary[1] * mb);
+    m += (i.bary[2] * mc);
 
     return true;
 }
@@ -203,14 +593,15 @@ void Trimesh::generateNormals()
     int *numFaces = new int[ cnt ]; // the number of faces assoc. with each vertex
     memset( numFaces, 0, sizeof(int)*cnt );
     
-    for( Faces::iterator fi = faces.begin(); fi != faces.end(); ++fi )
+    int num_faces = primitiveCount();
+    for( int f = 0; f < num_faces; ++f )
     {
-		Vec3d faceNormal = (**fi).getNormal();
+		Vec3r faceNormal = faceEdges[f].normal;
         
         for( int i = 0; i < 3; ++i )
         {
-            normals[(**fi)[i]] += faceNormal;
-            ++numFaces[(**fi)[i]];
+            normals[faceIds[3 * f + i]] += faceNormal;
+            ++numFaces[faceIds[3 * f + i]];
         }
     }
 
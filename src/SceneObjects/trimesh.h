@@ -14,30 +14,89 @@
 #include "../scene/ray.h"
 #include "../scene/material.h"
 #include "../scene/scene.h"
+#include "../ui/TraceUI.h"
+#include "triangle.h"
 
-class TrimeshFace;
+struct RayCounts;
 
 class Trimesh : public MaterialSceneObject
 {
-    friend class TrimeshFace;
-    typedef std::vector<Vec3d> Normals;
-    typedef std::vector<Vec3d> Vertices;
-    typedef std::vector<TrimeshFace*> Faces;
+public:
+    // Worked out once per ray rather than once per triangle: the watertight
+    // kernel's shear (only when that kernel is selected), and where to count
+    // triangle tests if they're being counted
+    struct RaySetup
+    {
+        WatertightRay w;
+        RayCounts* counts;
+    };
+    struct PacketSetup
+    {
+        RaySetup lane[PACKET_SIZE];
+        RayCounts* counts;
+    };
+
+private:
+    // Stored in Real, which is float in a SINGLE_PRECISION build
+    typedef std::vector<Vec3r> Normals;
+    typedef std::vector<Vec3r> Vertices;
     typedef std::vector<Material*> Materials;
 
+    // Everything the ray-triangle test needs about a face that doesn't
+    // depend on the ray: the two edges out of its first vertex, their dot
+    // products and the face normal
+    struct FaceEdges
+    {
+        Vec3r normal;
+        Vec3r u;
+        Vec3r v;
+        Real u_dot_u;
+        Real v_dot_v;
+        Real u_dot_v;
+        Real tri_area;
+    };
+
+    // Faces aren't objects of their own.  They're kept in flat arrays
+    // indexed by face number (three vertex indices apiece in faceIds, the
+    // precomputed edges in faceEdges), and the trees refer to them by that
+    // number.
     Vertices vertices;
-    Faces faces;
+    std::vector<int> faceIds;
+    std::vector<FaceEdges> faceEdges;
     Normals normals;
     Materials materials;
 	BoundingBox localBounds;
+	bool localBoundsValid;	// cleared by addVertex(); refits ask for these every frame
+
+    KdTree<Trimesh> * kdtree;
+    Bvh<Trimesh> * bvh;
+
+    // Whether the mesh material and every per-vertex material are opaque,
+    // found when the tree is built
+    bool allOpaque;
 
-    KdTree<TrimeshFace> * kdtree;
+    // The ray-triangle test selected in the UI, picked up when the tree is built
+    TraceUI::TriangleKernel kernel;
+    bool floatKernel;
+
+    // Ray-triangle test shared by the intersection and occlusion queries;
+    // runs whichever kernel is selected
+    bool intersectTriangle(int face, const ray& r, const RaySetup& setup, double& t, double& alpha, double& beta, double& gamma) const;
+    bool intersectTrianglePlane(int face, const ray& r, double& t, double& alpha, double& beta, double& gamma) const;
+
+    // Fill in i for a hit on face found by intersectTriangle()
+    void setHit(int face, double t, double alpha, double beta, double gamma, isect& i) const;
+
+    // Up to four faces of a leaf against one ray with the 4-wide kernels
+    void intersectFaces4(const int* faces, int count, const ray& r, const RaySetup& setup, isect& i, bool& have_one) const;
 
 public:
     Trimesh( Scene *scene, Material *mat, TransformNode *transform )
-        : MaterialSceneObject(scene, mat), 
+        : MaterialSceneObject(scene, mat), localBoundsValid(false),
+			kdtree(NULL), bvh(NULL), allOpaque(false),
+			kernel(TraceUI::TRIANGLE_PLANE), floatKernel(false),
 			displayListWithMaterials(0),
-			displayListWithoutMaterials(0), kdtree(NULL)
+			displayListWithoutMaterials(0)
     {
       this->transform = transform;
       vertNorms = false;
@@ -46,6 +105,12 @@ public:
     bool vertNorms;
 
     bool intersectLocal(ray& r, isect& i) const;
+    void intersectLocalPacket(const RayPacket& rp, int active, PacketHit& hit) const;
+    bool occludesLocal(ray& r, double tmax) const;
+    bool opaque() const { return allOpaque; }
+
+    // Per-vertex materials are blended for the face recorded in i
+    bool interpolateMaterial(const isect& i, Material& m) const;
 
     ~Trimesh();
     
@@ -60,120 +125,61 @@ public:
     void generateNormals();
 
     virtual bool isTrimesh() const { return true; }
-    virtual void buildKdTree()
-    {
-        if (kdtree)
-            delete kdtree;
+    virtual void buildKdTree(BuildPool* pool);
+    virtual void getAccelStats(AccelStats& stats) const;
 
-        kdtree = new KdTree<TrimeshFace>(faces, 0);
-    }
+    // The mesh is the primitive source for its own trees, one primitive per
+    // face.  Everything here is in the mesh's local space.
+    int primitiveCount() const { return faceEdges.size(); }
+    BoundingBox primitiveBounds(int face) const;
+    bool intersectPrimitive(int face, ray& r, const RaySetup& setup, isect& i) const;
+
+    RaySetup raySetup(const ray& r) const;
+    PacketSetup packetSetup(const RayPacket& rp) const;
+
+    // Closest hit among the faces of a leaf.  The double precision
+    // Moller-Trumbore and watertight kernels test them four at a time.
+    void intersectLeaf(const int* faces, int count, ray& r, const RaySetup& setup, isect& i, bool& have_one) const;
+
+    // Only used for opaque meshes, so no material is looked at
+    bool occludesPrimitive(int face, ray& r, const RaySetup& setup, double tmax) const;
+
+    // Tests all the rays of a packet against one face at once.  Only t, obj
+    // and face are filled in for the lanes it hits; intersectLocalPacket()
+    // fills in the rest for the face that ends up closest.
+    void intersectPrimitivePacket(int face, const RayPacket& rp, const PacketSetup& setup, int active, PacketHit& hit) const;
 
     bool hasBoundingBoxCapability() const { return true; }
+
+    // The uv coordinates of a hit are its barycentrics, which go from 0 to 1
+    // across the face: about one over the face's size per unit
+    virtual double uvPerUnit(const isect& i) const;
       
     BoundingBox ComputeLocalBoundingBox()
     {
+        if (localBoundsValid) return localBounds;
         BoundingBox localbounds;
 		if (vertices.size() == 0) return localbounds;
-		localbounds.setMax(vertices[0]);
-		localbounds.setMin(vertices[0]);
+		localbounds.setMax(toVec3d(vertices[0]));
+		localbounds.setMin(toVec3d(vertices[0]));
 		Vertices::const_iterator viter;
 		for (viter = vertices.begin(); viter != vertices.end(); ++viter)
 	  {
-	    localbounds.setMax(maximum( localbounds.getMax(), *viter));
-	    localbounds.setMin(minimum( localbounds.getMin(), *viter));
+	    localbounds.setMax(maximum( localbounds.getMax(), toVec3d(*viter)));
+	    localbounds.setMin(minimum( localbounds.getMin(), toVec3d(*viter)));
 	  }
 		localBounds = localbounds;
+		localBoundsValid = true;
         return localbounds;
     }
 
 protected:
+	// Instances draw the mesh's display lists under their own transforms
+	friend class MeshInstance;
+
 	void glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const;
 	mutable int displayListWithMaterials;
 	mutable int displayListWithoutMaterials;
 };
 
-class TrimeshFace : public MaterialSceneObject
-{
-    Trimesh *parent;
-    int ids[3];
-    Vec3d normal;
-    double dist;
-    Vec3d u;
-    Vec3d v;
-    double u_dot_u;
-    double v_dot_v;
-    double u_dot_v;
-    double tri_area;
-
-public:
-    TrimeshFace( Scene *scene, Material *mat, Trimesh *parent, int a, int b, int c) 
-        : MaterialSceneObject( scene, mat )
-    {
-        this->parent = parent;
-        ids[0] = a;
-        ids[1] = b;
-        ids[2] = c;
-
-        // Compute the face normal here, not on the fly
-        Vec3d a_coords = parent->vertices[a];
-        Vec3d b_coords = parent->vertices[b];
-        Vec3d c_coords = parent->vertices[c];
-
-        Vec3d vab = (b_coords - a_coords);
-        Vec3d vac = (c_coords - a_coords);
-        Vec3d vcb = (b_coords - c_coords);
-
-        // Precompute constant values for ray-triangle intersection code
-        u = vab;
-        v = vac;
-        u_dot_u = u.length2();
-        v_dot_v = v.length2();
-        u_dot_v = u * v;
-        tri_area = (u_dot_v * u_dot_v) - (u_dot_u * v_dot_v);
-        
-        // Compute normal
-        if (vab.iszero() || vac.iszero() || vcb.iszero()) degen = true;
-        else {
-            degen = false;
-            normal = ((b_coords - a_coords) ^ (c_coords - a_coords));
-            normal.normalize();
-            dist = normal * a_coords;
-        }
-        localbounds = ComputeLocalBoundingBox();
-        bounds = localbounds;
-    }
-
-    BoundingBox localbounds;
-    bool degen;
-
-    int operator[]( int i ) const
-    {
-        return ids[i];
-    }
-
-    Vec3d getNormal()
-    {
-        return normal;
-    }
-
-    bool intersect(ray& r, isect& i ) const;
-    bool intersectLocal(ray& r, isect& i ) const;
-
-    bool hasBoundingBoxCapability() const { return true; }
-      
-    BoundingBox ComputeLocalBoundingBox()
-    {
-        BoundingBox localbounds;
-        localbounds.setMax(maximum( parent->vertices[ids[0]], parent->vertices[ids[1]]));
-        localbounds.setMin(minimum( parent->vertices[ids[0]], parent->vertices[ids[1]]));
-        
-        localbounds.setMax(maximum( parent->vertices[ids[2]], localbounds.getMax()));
-        localbounds.setMin(minimum( parent->vertices[ids[2]], localbounds.getMin()));
-        return localbounds;
-    }
-
-    const BoundingBox& getBoundingBox() const { return localbounds; }
-
- };
-
 #endif // TRIMESH_H__
@@ -0,0 +1,47 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "TileScheduler.h"
+
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+TileScheduler::TileScheduler(int width, int height, int tileSize)
+	: m_width(width), m_height(height), m_tileSize(max(1, tileSize)), m_nextTile(0), m_cancelled(false)
+{
+	m_tilesX = (m_width + m_tileSize - 1) / m_tileSize;
+	m_tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+}
+
+bool TileScheduler::nextTile(int& x0, int& y0, int& x1, int& y1)
+{
+	if (m_cancelled)
+		return false;
+
+	int tile = m_nextTile.fetch_add(1);
+	if (tile >= tileCount())
+		return false;
+
+	// Tiles go out in scanline order so the image fills in from the top
+	x0 = (tile % m_tilesX) * m_tileSize;
+	y0 = (tile / m_tilesX) * m_tileSize;
+	x1 = min(x0 + m_tileSize, m_width);
+	y1 = min(y0 + m_tileSize, m_height);
+	return true;
+}
+
+int TileScheduler::tilesClaimed() const
+{
+	return min(m_nextTile.load(), tileCount());
+}
+
+int TileScheduler::defaultThreadCount()
+{
+	return max(1, (int)thread::hardware_concurrency());
+}
@@ -0,0 +1,54 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#ifndef __TILESCHEDULER_H__
+#define __TILESCHEDULER_H__
+
+// Splits an image into small square tiles and hands them out to rendering
+// threads on demand.  Threads grab the next untraced tile from a shared
+// atomic counter, so a thread that lands on an expensive part of the image
+// simply ends up tracing fewer tiles than the others.
+
+#include <atomic>
+
+class TileScheduler
+{
+public:
+	enum { DEFAULT_TILE_SIZE = 16 };
+
+	TileScheduler(int width, int height, int tileSize = DEFAULT_TILE_SIZE);
+
+	// Claim the next untraced tile.  Returns false once every tile has been
+	// handed out or the render was cancelled.
+	bool nextTile(int& x0, int& y0, int& x1, int& y1);
+
+	// Stop handing out tiles; tiles already being traced still finish
+	void cancel() { m_cancelled = true; }
+
+	// Hand out every tile again, for another pass over the image.  Only
+	// call this once the tiles of the last pass are all done.
+	void restart() { m_nextTile = 0; }
+	bool cancelled() const { return m_cancelled; }
+
+	int tileCount() const { return m_tilesX * m_tilesY; }
+	int tilesClaimed() const;
+
+	// One thread per hardware thread, or 1 if that can't be determined
+	static int defaultThreadCount();
+
+private:
+	int m_width;
+	int m_height;
+	int m_tileSize;
+	int m_tilesX;
+	int m_tilesY;
+
+	std::atomic<int> m_nextTile;
+	std::atomic<bool> m_cancelled;
+};
+
+#endif // __TILESCHEDULER_H__
@@ -10,12 +10,12 @@
 //
 
 #include "bitmap.h"
- 
-BMP_BITMAPFILEHEADER bmfh; 
-BMP_BITMAPINFOHEADER bmih; 
 
+// The headers are locals so textures can be read on several threads at once
 unsigned char *readBMP(const char *fname, int& width, int& height)
 { 
+	BMP_BITMAPFILEHEADER bmfh; 
+	BMP_BITMAPINFOHEADER bmih; 
 	FILE* file; 
 	BMP_DWORD pos; 
  
@@ -35,10 +35,13 @@ unsigned char *readBMP(const char *fname, int& width, int& height)
  
 	// error checking
 	if ( bmfh.bfType!= 0x4d42 ) {	// "BM" actually
+		fclose( file );
 		return NULL;
 	}
-	if ( bmih.biBitCount != 24 )  
+	if ( bmih.biBitCount != 24 ) {
+		fclose( file );
 		return NULL; 
+	}
 /*
  	if ( bmih.biCompression != BMP_BI_RGB ) {
 		return NULL;
@@ -64,6 +67,7 @@ unsigned char *readBMP(const char *fname, int& width, int& height)
 	
 	if (!foo) {
 		delete [] data;
+		fclose( file );
 		return NULL;
 	}
 
@@ -99,6 +103,8 @@ unsigned char *readBMP(const char *fname, int& width, int& height)
  
 void writeBMP(const char *iname, int width, int height, unsigned char *data) 
 { 
+	BMP_BITMAPFILEHEADER bmfh; 
+	BMP_BITMAPINFOHEADER bmih; 
 	int bytes, pad;
 	bytes = width * 3;
 	pad = (bytes%4) ? 4-(bytes%4) : 0;
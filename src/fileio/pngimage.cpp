@@ -5,13 +5,6 @@
 #  define png_jmpbuf(png_ptr)   ((png_ptr)->jmpbuf)
 #endif
 
-static png_structp png_ptr = NULL;
-static png_infop info_ptr = NULL;
-
-png_uint_32  width, height;
-int  bit_depth, color_type;
-uch  *image_data = NULL;
-
 void png_version_info(void) {
 
 	fprintf(stderr, "   Compiled with libpng %s; using libpng %s.\n",
@@ -22,27 +15,25 @@ void png_version_info(void) {
 
 /* return value = 0 for success, 1 for bad sig, 2 for bad IHDR, 4 for no mem, 8 for file open failure */
 
-int png_init(const char* filename, int &pWidth, int &pHeight) {
+int png_init(png_reader &reader, const char* filename, int &pWidth, int &pHeight) {
 	
 	uch sig[8];
-	FILE *infile;
 
-	if ((infile = fopen(filename, "rb")) == NULL) return (8);
+	if ((reader.infile = fopen(filename, "rb")) == NULL) return (8);
 
 	/* check that the file really is a PNG image; could
 	* have used slightly more general png_sig_cmp() function instead */
 
-	fread(sig, 1, 8, infile);
-	if (png_sig_cmp(sig, 0, 8) != 0) return 1;   /* bad signature */
+	if (fread(sig, 1, 8, reader.infile) != 8 || png_sig_cmp(sig, 0, 8) != 0) return 1;   /* bad signature */
 
 	/* could pass pointers to user-defined error handlers instead of NULLs: */
 
-	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if (!png_ptr) return 4;   /* out of memory */
+	reader.png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!reader.png_ptr) return 4;   /* out of memory */
 
-	info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr) {
-		png_destroy_read_struct(&png_ptr, NULL, NULL);
+	reader.info_ptr = png_create_info_struct(reader.png_ptr);
+	if (!reader.info_ptr) {
+		png_destroy_read_struct(&reader.png_ptr, NULL, NULL);
 		return 4;   /* out of memory */
 	}
 
@@ -53,23 +44,23 @@ int png_init(const char* filename, int &pWidth, int &pHeight) {
 	/* setjmp() must be called in every function that calls a PNG-reading
 	* libpng function */
 
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	if (setjmp(png_jmpbuf(reader.png_ptr))) {
+		png_destroy_read_struct(&reader.png_ptr, &reader.info_ptr, NULL);
 		return 2;
 	}
 
-	png_init_io(png_ptr, infile);
-	png_set_sig_bytes(png_ptr, 8);  /* we already read the 8 signature bytes */
+	png_init_io(reader.png_ptr, reader.infile);
+	png_set_sig_bytes(reader.png_ptr, 8);  /* we already read the 8 signature bytes */
 
-	png_read_info(png_ptr, info_ptr);  /* read all PNG info up to image data */
+	png_read_info(reader.png_ptr, reader.info_ptr);  /* read all PNG info up to image data */
 
 	/* alternatively, could make separate calls to png_get_image_width(),
 	* etc., but want bit_depth and color_type for later [don't care about
 	* compression_type and filter_type => NULLs] */
 
-	png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
-	pWidth = (int)width;
-	pHeight = (int)height;
+	png_get_IHDR(reader.png_ptr, reader.info_ptr, &reader.width, &reader.height, &reader.bit_depth, &reader.color_type, NULL, NULL, NULL);
+	pWidth = (int)reader.width;
+	pHeight = (int)reader.height;
 
 	/* OK, that's all we need for now; return happy */
 
@@ -79,38 +70,38 @@ int png_init(const char* filename, int &pWidth, int &pHeight) {
 /* returns 0 if succeeds, 1 if fails due to no bKGD chunk, 2 if libpng error;
 * scales values to 8-bit if necessary */
 
-int png_get_bgcolor(uch *red, uch *green, uch *blue) {
+int png_get_bgcolor(png_reader &reader, uch *red, uch *green, uch *blue) {
 
 	png_color_16p pBackground;
 
 	/* setjmp() must be called in every function that calls a PNG-reading
 	* libpng function */
 
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	if (setjmp(png_jmpbuf(reader.png_ptr))) {
+		png_destroy_read_struct(&reader.png_ptr, &reader.info_ptr, NULL);
 		return 2;
 	}
 
 
-	if (!png_get_valid(png_ptr, info_ptr, PNG_INFO_bKGD)) return 1;
+	if (!png_get_valid(reader.png_ptr, reader.info_ptr, PNG_INFO_bKGD)) return 1;
 
 	/* it is not obvious from the libpng documentation, but this function
 	* takes a pointer to a pointer, and it always returns valid red, green
 	* and blue values, regardless of color_type: */
 
-	png_get_bKGD(png_ptr, info_ptr, &pBackground);
+	png_get_bKGD(reader.png_ptr, reader.info_ptr, &pBackground);
 
 	/* however, it always returns the raw bKGD data, regardless of any
 	* bit-depth transformations, so check depth and adjust if necessary */
 
-	if (bit_depth == 16) {
+	if (reader.bit_depth == 16) {
 		*red   = pBackground->red   >> 8;
 		*green = pBackground->green >> 8;
 		*blue  = pBackground->blue  >> 8;
-	} else if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
-		if (bit_depth == 1)
+	} else if (reader.color_type == PNG_COLOR_TYPE_GRAY && reader.bit_depth < 8) {
+		if (reader.bit_depth == 1)
 			*red = *green = *blue = pBackground->gray? 255 : 0;
-		else if (bit_depth == 2)
+		else if (reader.bit_depth == 2)
 			*red = *green = *blue = (255/3) * pBackground->gray;
 		else /* bit_depth == 4 */
 			*red = *green = *blue = (255/15) * pBackground->gray;
@@ -125,7 +116,7 @@ int png_get_bgcolor(uch *red, uch *green, uch *blue) {
 
 /* display_exponent == LUT_exponent * CRT_exponent */
 
-uch *png_get_image(double display_exponent, int &pChannels, int &pRowbytes) {
+uch *png_get_image(png_reader &reader, double display_exponent, int &pChannels, int &pRowbytes) {
 
 	double  gamma;
 	png_uint_32  i, rowbytes;
@@ -134,8 +125,8 @@ uch *png_get_image(double display_exponent, int &pChannels, int &pRowbytes) {
 	/* setjmp() must be called in every function that calls a PNG-reading
 	* libpng function */
 
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	if (setjmp(png_jmpbuf(reader.png_ptr))) {
+		png_destroy_read_struct(&reader.png_ptr, &reader.info_ptr, NULL);
 		return NULL;
 	}
 
@@ -143,53 +134,53 @@ uch *png_get_image(double display_exponent, int &pChannels, int &pRowbytes) {
 	* transparency chunks to full alpha channel; strip 16-bit-per-sample
 	* images to 8 bits per sample; and convert grayscale to RGB[A] */
 
-	if (color_type == PNG_COLOR_TYPE_PALETTE)
-		png_set_expand(png_ptr);
-	if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
-		png_set_expand(png_ptr);
-	if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
-		png_set_expand(png_ptr);
-	if (bit_depth == 16)
-		png_set_strip_16(png_ptr);
-	if (color_type == PNG_COLOR_TYPE_GRAY ||
-		color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-		png_set_gray_to_rgb(png_ptr);
+	if (reader.color_type == PNG_COLOR_TYPE_PALETTE)
+		png_set_expand(reader.png_ptr);
+	if (reader.color_type == PNG_COLOR_TYPE_GRAY && reader.bit_depth < 8)
+		png_set_expand(reader.png_ptr);
+	if (png_get_valid(reader.png_ptr, reader.info_ptr, PNG_INFO_tRNS))
+		png_set_expand(reader.png_ptr);
+	if (reader.bit_depth == 16)
+		png_set_strip_16(reader.png_ptr);
+	if (reader.color_type == PNG_COLOR_TYPE_GRAY ||
+		reader.color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb(reader.png_ptr);
 
 	/* unlike the example in the libpng documentation, we have *no* idea where
 	* this file may have come from--so if it doesn't have a file gamma, don't
 	* do any correction ("do no harm") */
 
-	if (png_get_gAMA(png_ptr, info_ptr, &gamma))
-		png_set_gamma(png_ptr, display_exponent, gamma);
+	if (png_get_gAMA(reader.png_ptr, reader.info_ptr, &gamma))
+		png_set_gamma(reader.png_ptr, display_exponent, gamma);
 
 	/* all transformations have been registered; now update info_ptr data,
 	* get rowbytes and channels, and allocate image memory */
 
-	png_read_update_info(png_ptr, info_ptr);
+	png_read_update_info(reader.png_ptr, reader.info_ptr);
 
-	pRowbytes = rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-	pChannels = (int)png_get_channels(png_ptr, info_ptr);
+	pRowbytes = rowbytes = png_get_rowbytes(reader.png_ptr, reader.info_ptr);
+	pChannels = (int)png_get_channels(reader.png_ptr, reader.info_ptr);
 
-	if ((image_data = (uch *)malloc(rowbytes*height)) == NULL) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	if ((reader.image_data = (uch *)malloc(rowbytes*reader.height)) == NULL) {
+		png_destroy_read_struct(&reader.png_ptr, &reader.info_ptr, NULL);
 		return NULL;
 	}
-	if ((row_pointers = (png_bytepp)malloc(height*sizeof(png_bytep))) == NULL) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		free(image_data);
-		image_data = NULL;
+	if ((row_pointers = (png_bytepp)malloc(reader.height*sizeof(png_bytep))) == NULL) {
+		png_destroy_read_struct(&reader.png_ptr, &reader.info_ptr, NULL);
+		free(reader.image_data);
+		reader.image_data = NULL;
 		return NULL;
 	}
 
-	Trace((stderr, "readpng_get_image:  channels = %d, rowbytes = %ld, height = %ld\n", *pChannels, rowbytes, height));
+	Trace((stderr, "readpng_get_image:  channels = %d, rowbytes = %ld, height = %ld\n", *pChannels, rowbytes, reader.height));
 
 	/* set the individual row_pointers to point at the correct offsets */
 
-	for (i = 0;  i < height;  ++i) row_pointers[i] = image_data + i*rowbytes;
+	for (i = 0;  i < reader.height;  ++i) row_pointers[i] = reader.image_data + i*rowbytes;
 
 	/* now we can go ahead and just read the whole image */
 
-	png_read_image(png_ptr, row_pointers);
+	png_read_image(reader.png_ptr, row_pointers);
 
 	/* and we're done!  (png_read_end() can be omitted if no processing of
 	* post-IDAT text/time/etc. is desired) */
@@ -197,21 +188,49 @@ uch *png_get_image(double display_exponent, int &pChannels, int &pRowbytes) {
 	free(row_pointers);
 	row_pointers = NULL;
 
-	png_read_end(png_ptr, NULL);
+	png_read_end(reader.png_ptr, NULL);
 
-	return image_data;
+	return reader.image_data;
 }
 
-void png_cleanup(int free_image_data) {
+void png_cleanup(png_reader &reader, int free_image_data) {
+
+	if (free_image_data && reader.image_data) {
+		free(reader.image_data);
+		reader.image_data = NULL;
+	}
 
-	if (free_image_data && image_data) {
-		free(image_data);
-		image_data = NULL;
+	if (reader.png_ptr) {
+		png_destroy_read_struct(&reader.png_ptr, reader.info_ptr ? &reader.info_ptr : NULL, NULL);
+		reader.png_ptr = NULL;
+		reader.info_ptr = NULL;
 	}
 
-	if (png_ptr && info_ptr) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		png_ptr = NULL;
-		info_ptr = NULL;
+	if (reader.infile) {
+		fclose(reader.infile);
+		reader.infile = NULL;
+	}
+}
+
+unsigned char *readPNG(const char *fname, int &width, int &height) {
+
+	png_reader reader;
+	unsigned char *data = NULL;
+	if (!png_init(reader, fname, width, height)) {
+		int channels, rowBytes;
+		uch *image = png_get_image(reader, 2.2, channels, rowBytes);
+		if (image && channels >= 3) {
+			/* keep the color channels, flipping the rows to go from the bottom up */
+			data = new unsigned char[width * height * 3];
+			for (int j = 0; j < height; j++) {
+				const uch *in = image + (height - j - 1) * rowBytes;
+				unsigned char *out = data + j * width * 3;
+				for (int i = 0; i < width; i++)
+					for (int k = 0; k < 3; k++)
+						out[i * 3 + k] = in[i * channels + k];
+			}
+		}
 	}
+	png_cleanup(reader, 1);
+	return data;
 }
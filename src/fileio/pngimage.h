@@ -15,15 +15,36 @@ typedef unsigned short  ush;
 typedef unsigned long   ulg;
 
 
+/* A PNG file being read.  Everything the reader keeps between calls is in
+ * here rather than in globals, so any number of images can be read at once
+ * on different threads, each with its own png_reader. */
+
+struct png_reader {
+	png_reader() : png_ptr(NULL), info_ptr(NULL), infile(NULL), width(0), height(0),
+		bit_depth(0), color_type(0), image_data(NULL) {}
+
+	png_structp png_ptr;
+	png_infop info_ptr;
+	FILE *infile;
+	png_uint_32 width, height;
+	int bit_depth, color_type;
+	uch *image_data;
+};
+
 /* prototypes for public functions in readpng.c */
 
 void png_version_info(void);
 
-int png_init(const char* filename, int &pWidth, int &pHeight);
+int png_init(png_reader &reader, const char* filename, int &pWidth, int &pHeight);
 
-int png_get_bgcolor(uch *bg_red, uch *bg_green, uch *bg_blue);
+int png_get_bgcolor(png_reader &reader, uch *bg_red, uch *bg_green, uch *bg_blue);
 
-uch *png_get_image(double display_exponent, int &pChannels,
+uch *png_get_image(png_reader &reader, double display_exponent, int &pChannels,
                        int &pRowbytes);
 
-void png_cleanup(int free_image_data);
+void png_cleanup(png_reader &reader, int free_image_data);
+
+/* The whole of a PNG file as 8-bit RGB, rows from the bottom up like
+ * readBMP(), or NULL if it can't be read.  Free it with delete[]. */
+
+unsigned char *readPNG(const char *fname, int &width, int &height);
@@ -24,12 +24,12 @@ Scene* Parser::parseScene()
 {
   _tokenizer.Read(SBT_RAYTRACER);
 
-  auto_ptr<Token> versionNumber( _tokenizer.Read(SCALAR) );
+  Token versionNumber( _tokenizer.Read(SCALAR) );
 
-  if( versionNumber->value() > 1.1 )
+  if( versionNumber.value() > 1.1 )
   {
     ostringstream ost;
-    ost << "SBT-raytracer version number " << versionNumber->value() << 
+    ost << "SBT-raytracer version number " << versionNumber.value() << 
       " too high; only able to parse v1.1 and below.";
     throw ParserException( ost.str() );
   }
@@ -49,6 +49,7 @@ Scene* Parser::parseScene()
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case INSTANCE:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -161,6 +162,7 @@ void Parser::parseTransformableElement( Scene* scene, TransformNode* transform,
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case INSTANCE:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -191,6 +193,7 @@ void Parser::parseGroup(Scene* scene, TransformNode* transform, const Material&
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case INSTANCE:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -236,6 +239,9 @@ void Parser::parseGeometry(Scene* scene, TransformNode* transform, const Materia
     case TRIMESH:
       parseTrimesh(scene, transform, mat);
       return;
+    case INSTANCE:
+      parseInstance(scene, transform, mat);
+      return;
     case TRANSLATE:
       parseTranslate(scene, transform, mat);
       return;
@@ -552,6 +558,7 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
 
   bool generateNormals( false );
   list<Vec3d> faces;
+  string name;
 
   char* error;
   for( ;; )
@@ -571,7 +578,7 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
         break;
 
       case NAME:
-         parseIdentExpression();
+         name = parseIdentExpression();
          break;
 
       case MATERIALS:
@@ -679,6 +686,18 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
           throw ParserException( error );
 
         scene->add( tmesh );
+
+        // A named trimesh can be instanced from here on
+        if( ! name.empty() )
+        {
+           if( meshes.find( name ) != meshes.end() )
+           {
+              ostringstream oss;
+              oss << "Redefinition of trimesh '" << name << "'.";
+              throw SyntaxErrorException( oss.str(), _tokenizer );
+           }
+           meshes[ name ] = tmesh;
+        }
         return;
       }
 
@@ -688,6 +707,56 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
   }
 }
 
+// instance { name = <trimesh name>; [material = ...;] } places another copy
+// of a named trimesh that shares its vertices, faces and tree.  Without a
+// material of its own the instance uses the trimesh's.
+void Parser::parseInstance(Scene* scene, TransformNode* transform, const Material& mat)
+{
+  Trimesh* mesh = 0;
+  Material* newMat = 0;
+
+  _tokenizer.Read( INSTANCE );
+  _tokenizer.Read( LBRACE );
+
+  for( ;; )
+  {
+    const Token* t = _tokenizer.Peek();
+
+    switch( t->kind() )
+    {
+      case MATERIAL:
+        delete newMat;
+        newMat = parseMaterialExpression( scene, mat );
+        break;
+      case NAME:
+      {
+        string name = parseIdentExpression();
+        meshmap::const_iterator m = meshes.find( name );
+        if( m == meshes.end() )
+        {
+          ostringstream oss;
+          oss << "Unknown trimesh '" << name << "'.";
+          throw SyntaxErrorException( oss.str(), _tokenizer );
+        }
+        mesh = m->second;
+        break;
+      }
+      case RBRACE:
+      {
+        _tokenizer.Read( RBRACE );
+        if( !mesh )
+          throw SyntaxErrorException( "Expected: name of the trimesh to instance", _tokenizer );
+        MeshInstance* instance = new MeshInstance( scene, newMat ? newMat : new Material( mesh->getMaterial() ), mesh );
+        instance->setTransform( transform );
+        scene->add( instance );
+        return;
+      }
+      default:
+        throw SyntaxErrorException( "Expected: instance attributes", _tokenizer );
+    }
+  }
+}
+
 void Parser::parseFaces( list< Vec3d >& faces )
 {
   list< double > points = parseScalarList();
@@ -890,16 +959,16 @@ string Parser::parseIdentExpression()
 
 double Parser::parseScalar()
 {
-  auto_ptr<Token> scalar( _tokenizer.Read( SCALAR ) );
+  Token scalar( _tokenizer.Read( SCALAR ) );
 
-  return scalar->value();
+  return scalar.value();
 }
 
 string Parser::parseIdent()
 {
-  auto_ptr<Token> scalar( _tokenizer.Read( IDENT ) );
+  Token scalar( _tokenizer.Read( IDENT ) );
 
-  return scalar->ident();
+  return scalar.ident();
 }
 
 
@@ -945,34 +1014,34 @@ bool Parser::parseBoolean()
 Vec3d Parser::parseVec3d()
 {
   _tokenizer.Read( LPAREN );
-  auto_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( RPAREN );
 
-  return Vec3d( value1->value(), 
-    value2->value(), 
-    value3->value() );
+  return Vec3d( value1.value(), 
+    value2.value(), 
+    value3.value() );
 }
 
 Vec4d Parser::parseVec4d()
 {
   _tokenizer.Read( LPAREN );
-  auto_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value4( _tokenizer.Read( SCALAR ) );
+  Token value4( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( RPAREN );
 
-  return Vec4d( value1->value(), 
-    value2->value(), 
-    value3->value(),
-    value4->value() );
+  return Vec4d( value1.value(), 
+    value2.value(), 
+    value3.value(),
+    value4.value() );
 }
 
 Material* Parser::parseMaterial( Scene* scene, const Material& parent )
@@ -1035,7 +1104,7 @@ Material* Parser::parseMaterial( Scene* scene, const Material& parent )
 
       case NAME:
          _tokenizer.Read(NAME);
-         name = (_tokenizer.Read(IDENT))->ident();
+         name = _tokenizer.Read(IDENT).ident();
          _tokenizer.Read( SEMICOLON );
          break;
 
@@ -18,11 +18,13 @@
 #include "../SceneObjects/Sphere.h"
 #include "../SceneObjects/Square.h"
 #include "../SceneObjects/trimesh.h"
+#include "../SceneObjects/MeshInstance.h"
 
 #include "../vecmath/vec.h"
 #include "../vecmath/mat.h"
 
 typedef std::map<string,Material> mmap;
+typedef std::map<string,Trimesh*> meshmap;
 
 /*
   class Parser:
@@ -71,6 +73,7 @@ private:
     void      parseCylinder(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseCone(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseTrimesh(Scene* scene, TransformNode* transform, const Material& mat);
+    void      parseInstance(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseFaces( std::list< Vec3d >& faces );
 
     // Parse transforms
@@ -105,6 +108,7 @@ private:
   private:
     Tokenizer& _tokenizer;
     mmap materials;
+    meshmap meshes;		// named trimeshes, for instances
     std::string _basePath;
 };
 
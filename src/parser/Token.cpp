@@ -4,6 +4,8 @@
 #include "Token.h"
 
 #include <map>
+#include <algorithm>
+#include <string.h>
 #include <sstream>
 
 #include <iostream>
@@ -56,6 +58,7 @@ string getNameForToken( const SYMBOL kind )
     tokenNames[ CYLINDER ]          = "cylinder";
     tokenNames[ CONE ]              = "cone";
     tokenNames[ TRIMESH ]           = "trimesh";
+    tokenNames[ INSTANCE ]          = "instance";
     tokenNames[ POSITION ]          = "position";
     tokenNames[ VIEWDIR ]           = "viewdir";
     tokenNames[ UPDIR ]             = "updir";
@@ -98,88 +101,162 @@ string getNameForToken( const SYMBOL kind )
 
 }
 
-/* This function is used by the parser to lookup 
-   "reserved" words (i.e., things like "sphere", "cone",
-   etc.).  What you will be concerned with is adding
-   entries to the reservedWords map as appropriate;
-   if you add a new reserved word to the parser, 
-   simply add it to the list below.  I.e., if you had
-   the reserved word "regular17gon" as your new primitive,
+/* These are the "reserved" words the parser looks up
+   (i.e., things like "sphere", "cone", etc.).  What you
+   will be concerned with is adding entries to this list
+   as appropriate; if you add a new reserved word to the
+   parser, simply add it below.  I.e., if you had the
+   reserved word "regular17gon" as your new primitive,
    for example, and the SYMBOL representing it was
    "SEVENTEENGON", you'd add the line
-      reservedWords["regular17gon"] = SEVENTEENGON;
-   to the list below.
+      { "regular17gon", SEVENTEENGON },
+   to the list.
 */
-SYMBOL lookupReservedWord(const string& ident) {
-  static std::map<string, SYMBOL> reservedWords;
+namespace {
 
-  if( reservedWords.empty() )
+struct ReservedWord
+{
+  const char* name;
+  SYMBOL symbol;
+};
+
+const ReservedWord reservedWords[] = {
+  { "ambient_light", AMBIENT_LIGHT },
+  { "ambient", AMBIENT },
+  { "aspectratio", ASPECTRATIO },
+  { "bottom_radius", BOTTOM_RADIUS },
+  { "box", BOX },
+  { "camera", CAMERA },
+  { "capped", CAPPED },
+  { "color", COLOR },
+  { "colour", COLOR },
+  { "cone", CONE },
+  { "constant_attenuation_coeff", CONSTANT_ATTENUATION_COEFF },
+  { "cylinder", CYLINDER },
+  { "diffuse", DIFFUSE },
+  { "direction", DIRECTION },
+  { "directional_light", DIRECTIONAL_LIGHT },
+  { "emissive", EMISSIVE },
+  { "faces", FACES },
+  { "false", SYMFALSE },
+  { "fov", FOV },
+  { "gennormals", GENNORMALS },
+  { "height", HEIGHT },
+  { "index", INDEX },
+  { "instance", INSTANCE },
+  { "linear_attenuation_coeff", LINEAR_ATTENUATION_COEFF },
+  { "material", MATERIAL },
+  { "materials", MATERIALS },
+  { "map", MAP },
+  { "name", NAME },
+  { "normals", NORMALS },
+  { "point_light", POINT_LIGHT },
+  { "points", POLYPOINTS },
+  { "polymesh", TRIMESH },
+  { "position", POSITION },
+  { "quadratic_attenuation_coeff", QUADRATIC_ATTENUATION_COEFF },
+  { "quaternian", QUATERNIAN },
+  { "reflective", REFLECTIVE },
+  { "rotate", ROTATE },
+  { "SBT-raytracer", SBT_RAYTRACER },
+  { "scale", SCALE },
+  { "shininess", SHININESS },
+  { "specular", SPECULAR },
+  { "sphere", SPHERE },
+  { "square", SQUARE },
+  { "top_radius", TOP_RADIUS },
+  { "transform", TRANSFORM },
+  { "translate", TRANSLATE },
+  { "transmissive", TRANSMISSIVE },
+  { "trimesh", TRIMESH },
+  { "true", SYMTRUE },
+  { "updir", UPDIR },
+  { "viewdir", VIEWDIR },
+};
+
+/* Every identifier in a scene goes through here, so rather than
+   searching, the table has one slot for each reserved word, picked by
+   a hash seeded so that no two of them land in the same one.  The seed
+   is found the first time the table is used, which keeps it perfect
+   when words are added to the list above.
+*/
+class ReservedWordTable
+{
+  public:
+    ReservedWordTable();
+
+    SYMBOL find( const char* name, size_t length ) const;
+
+  private:
+    enum { SLOTS = 512 };
+
+    static unsigned int hash( unsigned int seed, const char* name, size_t length );
+
+    unsigned int _seed;
+    const ReservedWord* _slots[ SLOTS ];
+};
+
+unsigned int ReservedWordTable::hash( unsigned int seed, const char* name, size_t length )
+{
+  unsigned int h = 2166136261u ^ seed;
+  for( size_t i = 0; i < length; ++i )
+    h = ( h ^ (unsigned char)name[ i ] ) * 16777619u;
+  return ( h ^ ( h >> 15 ) ) & ( SLOTS - 1 );
+}
+
+ReservedWordTable::ReservedWordTable()
+{
+  const size_t count = sizeof( reservedWords ) / sizeof( reservedWords[0] );
+  for( _seed = 0; ; ++_seed )
   {
-    reservedWords["ambient_light"] = AMBIENT_LIGHT;
-    reservedWords["ambient"] = AMBIENT;
-    reservedWords["aspectratio"] = ASPECTRATIO;
-    reservedWords["bottom_radius"] = BOTTOM_RADIUS;
-    reservedWords["box"] = BOX;
-    reservedWords["camera"] = CAMERA;
-    reservedWords["capped"] = CAPPED;
-    reservedWords["color"] = COLOR;
-    reservedWords["colour"] = COLOR;
-    reservedWords["cone"] = CONE;
-    reservedWords["constant_attenuation_coeff"] = CONSTANT_ATTENUATION_COEFF;
-    reservedWords["cylinder"] = CYLINDER;
-    reservedWords["diffuse"] = DIFFUSE;
-    reservedWords["direction"] = DIRECTION;
-    reservedWords["directional_light"] = DIRECTIONAL_LIGHT;
-    reservedWords["emissive"] = EMISSIVE;
-    reservedWords["faces"] = FACES;
-    reservedWords["false"] = SYMFALSE;
-    reservedWords["fov"] = FOV;
-    reservedWords["gennormals"] = GENNORMALS;
-    reservedWords["height"] = HEIGHT;
-    reservedWords["index"] = INDEX;
-    reservedWords["linear_attenuation_coeff"] = LINEAR_ATTENUATION_COEFF;
-    reservedWords["material"] = MATERIAL;
-    reservedWords["materials"] = MATERIALS;
-    reservedWords["map"] = MAP;
-    reservedWords["name"] = NAME;
-    reservedWords["normals"] = NORMALS;
-    reservedWords["point_light"] = POINT_LIGHT;
-    reservedWords["points"] = POLYPOINTS;
-    reservedWords["polymesh"] = TRIMESH;
-    reservedWords["position"] = POSITION;
-    reservedWords["quadratic_attenuation_coeff"] = QUADRATIC_ATTENUATION_COEFF;
-    reservedWords["quaternian"] = QUATERNIAN;
-    reservedWords["reflective"] = REFLECTIVE;
-    reservedWords["rotate"] = ROTATE;
-    reservedWords["SBT-raytracer"] = SBT_RAYTRACER;
-    reservedWords["scale"] = SCALE;
-    reservedWords["shininess"] = SHININESS;
-    reservedWords["specular"] = SPECULAR;
-    reservedWords["sphere"] = SPHERE;
-    reservedWords["square"] = SQUARE;
-    reservedWords["top_radius"] = TOP_RADIUS;
-    reservedWords["transform"] = TRANSFORM;
-    reservedWords["translate"] = TRANSLATE;
-    reservedWords["transmissive"] = TRANSMISSIVE;
-    reservedWords["trimesh"] = TRIMESH;
-    reservedWords["true"] = SYMTRUE;
-    reservedWords["updir"] = UPDIR;
-    reservedWords["viewdir"] = VIEWDIR;
+    if( _seed > 1000000 )
+      throw ParserFatalException( "no collision-free hash for the reserved words" );
 
+    std::fill( _slots, _slots + SLOTS, (const ReservedWord*)0 );
+    size_t placed = 0;
+    for( ; placed < count; ++placed )
+    {
+      const ReservedWord& word = reservedWords[ placed ];
+      const ReservedWord*& slot = _slots[ hash( _seed, word.name, strlen( word.name ) ) ];
+      if( slot )
+        break;
+      slot = &word;
+    }
+    if( placed == count )
+      return;
   }
+}
 
-  // search ReservedWords table
-  std::map<string, SYMBOL>::const_iterator itr = 
-    reservedWords.find( ident );
-  if( itr == reservedWords.end() )
-    return UNKNOWN;
-  else
-    return (*itr).second;
+SYMBOL ReservedWordTable::find( const char* name, size_t length ) const
+{
+  const ReservedWord* word = _slots[ hash( _seed, name, length ) ];
+  if( word && strncmp( word->name, name, length ) == 0 && '\0' == word->name[ length ] )
+    return word->symbol;
+  return UNKNOWN;
+}
+
+}
+
+SYMBOL lookupReservedWord( const char* name, size_t length )
+{
+  static const ReservedWordTable table;
+  return table.find( name, length );
+}
+
+SYMBOL lookupReservedWord( const string& ident )
+{
+  return lookupReservedWord( ident.data(), ident.size() );
 }
 
 string Token::toString() const
 {
-  return getNameForToken( kind() );
+  ostringstream oss;
+  oss << getNameForToken( kind() );
+  if( IDENT == kind() )
+    oss << ": \"" << ident() << "\"";
+  else if( SCALAR == kind() )
+    oss << ": " << value();
+  return oss.str();
 }
 
 void Token::Print( ostream& out ) const {
@@ -189,16 +266,3 @@ void Token::Print( ostream& out ) const {
 void Token::Print( ) const {
   Print( std::cout );
 }
-
-string IdentToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": \"" << _ident << "\"";
-  return oss.str();
-}
-
-string ScalarToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": " << _value;
-  return oss.str();
-}
- 
@@ -9,6 +9,7 @@
 #include <string>
 #include <iostream>
 #include <map>
+#include <stddef.h>
 
 #include "ParserException.h"
 
@@ -56,6 +57,7 @@ enum SYMBOL {
   CYLINDER,
   CONE,
   TRIMESH,  
+  INSTANCE,					// another copy of a named trimesh
 
   POSITION, VIEWDIR,		// keywords affecting primitives
   UPDIR, ASPECTRATIO,
@@ -87,54 +89,45 @@ enum SYMBOL {
 // Helper functions
 string getNameForToken( const SYMBOL kind );
 SYMBOL lookupReservedWord( const string& name );
+SYMBOL lookupReservedWord( const char* name, size_t length );
 
+/* Tokens are small values, copied around rather than allocated.  An
+   identifier's text points into the Tokenizer's copy of the file, so it
+   is only good for as long as the Tokenizer is around; ident() copies it
+   out into a string.
+*/
 class Token {
   public:
-    Token(SYMBOL kind) : _kind( kind ) { }
+    Token() : _kind( UNKNOWN ), _value( 0.0 ), _text( 0 ), _length( 0 ) { }
+    Token(SYMBOL kind) : _kind( kind ), _value( 0.0 ), _text( 0 ), _length( 0 ) { }
+
+    static Token identifier( const char* text, size_t length )
+      { Token t( IDENT ); t._text = text; t._length = length; return t; }
+    static Token scalar( double value )
+      { Token t( SCALAR ); t._value = value; return t; }
 
     SYMBOL kind() const { return _kind; }
 
     // Note that these errors should not ever be encountered at runtime,
     // and signify parser bugs of some kind.
-    virtual std::string ident() const   
-      { throw ParserFatalException("not an IdentToken"); return std::string(); }
-    virtual double value() const   
-      { throw ParserFatalException("not a ScalarToken"); return 0.0; }
+    std::string ident() const   
+      { if( IDENT != _kind ) throw ParserFatalException("not an IdentToken");
+        return std::string( _text, _length ); }
+    double value() const   
+      { if( SCALAR != _kind ) throw ParserFatalException("not a ScalarToken");
+        return _value; }
 
 
     // Utility functions
-    virtual void Print(std::ostream& out) const;
-    virtual void Print() const;
-    virtual string toString() const;
-
-	virtual ~Token() {}
-  protected:
-    const SYMBOL _kind;
-};
-
-class IdentToken : public Token {
-  public:
-    IdentToken(std::string ident) : Token(IDENT), _ident( ident ) { 
-    }
-
-    std::string ident() const { return _ident; }
-
-    string toString() const;
-
-  protected:
-    const std::string _ident;
-};
-
-class ScalarToken : public Token {
-  public:
-    ScalarToken(double value) : Token(SCALAR), _value( value ) { }
-    
-    double value() const { return _value; }
-
+    void Print(std::ostream& out) const;
+    void Print() const;
     string toString() const;
 
   protected:
-    const double _value;
+    SYMBOL _kind;
+    double _value;
+    const char* _text;
+    size_t _length;
 };
 
 
@@ -1,11 +1,19 @@
 // Tokenizer.cpp
 // Breaks the input stream up into tokens
 #include <string> 
-#include <map>
 #include <sstream>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
-#include "../fileio/buffer.h"
 #include "Tokenizer.h"
 #include "Token.h"
 
@@ -26,23 +34,67 @@
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Tokenizer::Tokenizer(istream&) constructor
+// Tokenizer::Tokenizer(const string&) constructor
 //
-//   This constructor sets up the initial state that we need in order
-// to start scanning.  Note that we will be passed an OPEN file.  This
-// simplifies the scanner part, since we don't have to open it and
-// error check to see if it exists.  We assume that the caller (which
-// will be the main() function) sets up everything and passes us a VALID
-// file pointer.
+//   This constructor maps the whole file into memory, so that scanning
+// is a walk over its bytes and tokens can point right at them.  Where
+// the file can't be mapped (a pipe, say, or on Windows) it is read in
+// instead.  The caller checks good() to see whether either worked.
 //
 
-Tokenizer::Tokenizer(istream& fp, bool printTokens) 
-  : buffer( fp, false, false )
+Tokenizer::Tokenizer(const string& filename, bool printTokens)
+  : Begin( 0 ), End( 0 ), MappedSize( 0 ), _good( false ),
+    LineNumber( 1 ), LastPrintedLine( 0 ), HaveLookahead( false )
 { 
     TokenColumn = 0;
-    CurrentCh = ' ';
-    UnGetToken = NULL;
     _printTokens = printTokens;
+
+#ifndef _WIN32
+    int fd = open( filename.c_str(), O_RDONLY );
+    if( fd >= 0 ) {
+      struct stat st;
+      if( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) ) {
+        if( st.st_size == 0 ) {
+          _good = true;
+        } else {
+          void* data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+          if( data != MAP_FAILED ) {
+            madvise( data, st.st_size, MADV_SEQUENTIAL );
+            Begin = (const char*)data;
+            End = Begin + st.st_size;
+            MappedSize = st.st_size;
+            _good = true;
+          }
+        }
+      }
+      close( fd );
+    }
+    if( !_good )
+#endif
+    {
+      FILE* f = fopen( filename.c_str(), "rb" );
+      if( f ) {
+        char chunk[ 65536 ];
+        size_t n;
+        while( ( n = fread( chunk, 1, sizeof( chunk ), f ) ) > 0 )
+          Contents.insert( Contents.end(), chunk, chunk + n );
+        _good = !ferror( f );
+        fclose( f );
+        if( !Contents.empty() ) {
+          Begin = &Contents[0];
+          End = Begin + Contents.size();
+        }
+      }
+    }
+
+    Position = LineStart = Begin;
+}
+
+Tokenizer::~Tokenizer() {
+#ifndef _WIN32
+  if( MappedSize )
+    munmap( (void*)Begin, MappedSize );
+#endif
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -51,56 +103,58 @@ Tokenizer::Tokenizer(istream& fp, bool printTokens)
 // last phase to be executed
 // 
 void Tokenizer::ScanProgram() {
-    while (Get()->kind() != EOFSYM) ;
+    while (Get().kind() != EOFSYM) ;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// Token Tokenizer::Get() method
+//
+// Returns the peeked token, if there is one, or else the next one
+// from the file.
+//
 
-auto_ptr<Token> Tokenizer::Get() {
-  return auto_ptr<Token>(GetNext());
+Token Tokenizer::Get() {
+  if (HaveLookahead) {
+    HaveLookahead = false;
+    return Lookahead;
+  }
+  return GetNext();
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Get() method
+// Token Tokenizer::GetNext() method
 //
-// Advance through the source to find the next token. Returns peeked token,
-// if there is one.
+// Advance through the source to find the next token.
 //
 
-Token* Tokenizer::GetNext() {
-  Token* T = NULL;
-
-  // First check to see if there is an UnGetToken. If there is, use it.
-  if (UnGetToken != NULL) {
-    T = UnGetToken;
-    UnGetToken = NULL;
-    return T;
-  }
-
-  // Otherwise, crank up the scanner and get a new token.
+Token Tokenizer::GetNext() {
+  Token T;
 
   // Get rid of any whitespace
   SkipWhiteSpace();
 
   // test for end of file
-  if (buffer.isEOF()) {
-    T = new Token(EOFSYM);
+  if (isEOF()) {
+    T = Token(EOFSYM);
 
   } else {
     
     // Save the starting position of the symbol in a variable,
     // so that nicer error messages can be produced.
-    TokenColumn = buffer.CurColumn();
+    TokenColumn = (int)(Position - LineStart);
     
     // Check kind of current character
+    unsigned char c = CurrentCh();
     
     // Note that _'s are now allowed in identifiers.
-    if (isalpha(CurrentCh) || '_' == CurrentCh) {
+    if (isalpha(c) || '_' == c) {
       // grab identifier or reserved word
       T = GetIdent();
-    } else if ( '"' == CurrentCh)  {
+    } else if ( '"' == c)  {
       T = GetQuotedIdent(); 
-    } else if (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh) {
+    } else if (isdigit(c) || '-' == c || '.' == c) {
       T = GetScalar();
     } else { 
       //
@@ -110,154 +164,245 @@ Token* Tokenizer::GetNext() {
       T = GetPunct();
     }
   }
-  
-  if (T == NULL) {
-    throw ParserFatalException("didn't get a token");
-  }
 
   if (_printTokens) {
     std::cout << "Token read: ";
-    T->Print();
+    T.Print();
     std::cout << std::endl;
   }
 
   return T;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// void Tokenizer::GetCh() private method
+//
+//   Steps past the current character, keeping count of lines.
+//
+
+void Tokenizer::GetCh() {
+  if (isEOF())
+    return;
+  if ('\n' == *Position) {
+    LineNumber++;
+    LineStart = Position + 1;
+  }
+  Position++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// void Tokenizer::PrintLine(ostream&) method
+//
+//   Displays the current line, the first time it's asked for.
+//
+
+void Tokenizer::PrintLine( ostream& out ) const {
+  if (LineNumber > LastPrintedLine) {
+    const char* eol = LineStart;
+    while (eol != End && '\n' != *eol)
+      eol++;
+    out << "# ";
+    out.write( LineStart, eol - LineStart );
+    out << "\n" << std::endl;
+    LastPrintedLine = LineNumber;
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // Skips spaces, tabs, newlines, and comments
 //
 void Tokenizer::SkipWhiteSpace() {
-  while (isspace(CurrentCh)) {
-    GetCh();
-  }
+  for (;;) {
+    while (isspace((unsigned char)CurrentCh())) {
+      GetCh();
+    }
+
+    if( '/' != CurrentCh() )  // Look for comments
+      return;
 
-  if( '/' == CurrentCh )  // Look for comments
-  {
     GetCh();
-    if( '/' == CurrentCh )
+    if( '/' == CurrentCh() )
     {
       // Throw out everything until the end of the line
-      while( '\n' != CurrentCh )
+      while( '\n' != CurrentCh() && !isEOF() )
       {
         GetCh();
       }
     }
-    else if ( '*' == CurrentCh )
+    else if ( '*' == CurrentCh() )
     {
       int startLine = CurLine();
+      GetCh();
       while( true )
       {
-        GetCh();
-        if( '*' == CurrentCh )
-        {
-          GetCh();
-          if( CondReadCh( '/' ) )
-            break;
-          else if ( buffer.isEOF() )
-          {
-            std::ostringstream ost;
-            ost << "Unterminated comment in line ";
-            ost << startLine;
-            throw SyntaxErrorException( ost.str(), *this );
-          }
-        }
-        else if ( buffer.isEOF() )
+        if ( isEOF() )
         {
           std::ostringstream ost;
           ost << "Unterminated comment in line ";
           ost << startLine;
           throw SyntaxErrorException( ost.str(), *this );
         }
+        if( CondReadCh( '*' ) )
+        {
+          if( CondReadCh( '/' ) )
+            break;
+        }
+        else
+        {
+          GetCh();
+        }
       }
     }
     else
     {
       std::ostringstream ost;
-      ost << "unexpected character: '" << CurrentCh << "'";
+      ost << "unexpected character: '" << CurrentCh() << "'";
 	  throw SyntaxErrorException( ost.str(), *this );
     }
 
-    SkipWhiteSpace();  // We may need to throw out
-                       //  more white space/comments
-                       // This is admittedly tail recursion...
+    // We may need to throw out more white space/comments
   }
 }
 
-Token* Tokenizer::GetQuotedIdent() {
+Token Tokenizer::GetQuotedIdent() {
   GetCh();   // Throw out beginning '"'
 
-  std::ostringstream ident;
-  while ( '"' != CurrentCh ) {
-    if( '\n' == CurrentCh )
+  const char* start = Position;
+  while ( '"' != CurrentCh() ) {
+    if( '\n' == CurrentCh() || isEOF() )
       throw SyntaxErrorException( "Unterminated string constant", *this );
 
-    ident << CurrentCh;
     GetCh();
   }
+  Token T( Token::identifier( start, Position - start ) );
   GetCh();
-  return new IdentToken( ident.str() );
+  return T;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetIdent method
+// Token Tokenizer::GetIdent method
 //
 //   GetIdent scans an identifier-like token.  It returns an
 //   identifier or a reserved word token.
 //
 
-Token* Tokenizer::GetIdent() {
+Token Tokenizer::GetIdent() {
   // an IDENTIFIER or a RESERVED WORD token
-  std::ostringstream ident;
-  while (isalnum(CurrentCh) || '_' == CurrentCh || '-' == CurrentCh) { 
+  const char* start = Position;
+  while (!isEOF() && (isalnum((unsigned char)*Position) || '_' == *Position || '-' == *Position)) { 
     // While we still have something that can
-    ident << CurrentCh;
-    GetCh();
+    Position++;
   }
-  return SearchReserved(ident.str());
+
+  SYMBOL tokSymbol = lookupReservedWord( start, Position - start );
+  if( UNKNOWN == tokSymbol )
+    return Token::identifier( start, Position - start );
+  else
+    return Token( tokSymbol );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetInt method
+// double parseScalar(const char*, const char*)
 //
-//   GetInt scans an integer.  It returns an integer token.
+//   The value of the number in [begin, end), the same as atof would
+// make of it.  Numbers with few enough digits and a small enough
+// exponent are worked out straight from the bytes: the digits and the
+// power of ten are then both exact doubles, so one multiply or divide
+// rounds correctly.  Anything else goes to strtod.
 //
 
-Token* Tokenizer::GetScalar() {
-  // an INTEGER token
-  string ret( "" );
-  while (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh || 'e' == CurrentCh ) {
-    ret += CurrentCh;
-    GetCh();
+static double parseScalar( const char* begin, const char* end ) {
+  static const double powersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  const char* p = begin;
+  bool negative = ( p != end && '-' == *p );
+  if( negative ) p++;
+
+  unsigned long long mantissa = 0;
+  int significant = 0, digits = 0, exponent = 0;
+  for( ; p != end && isdigit((unsigned char)*p); p++, digits++ ) {
+    mantissa = mantissa * 10 + ( *p - '0' );
+    if( mantissa ) significant++;
+  }
+  if( p != end && '.' == *p ) {
+    for( p++; p != end && isdigit((unsigned char)*p); p++, digits++, exponent-- ) {
+      mantissa = mantissa * 10 + ( *p - '0' );
+      if( mantissa ) significant++;
+    }
+  }
+  if( p != end && 'e' == *p && digits > 0 ) {
+    p++;
+    bool negativeExponent = ( p != end && '-' == *p );
+    if( negativeExponent ) p++;
+    int power = 0, powerDigits = 0;
+    for( ; p != end && isdigit((unsigned char)*p) && powerDigits < 4; p++, powerDigits++ )
+      power = power * 10 + ( *p - '0' );
+    if( powerDigits == 0 ) digits = 0;
+    exponent += negativeExponent ? -power : power;
+  }
+
+  if( p == end && digits > 0 && significant <= 15 && exponent >= -22 && exponent <= 22 ) {
+    double value = (double)mantissa;
+    value = exponent < 0 ? value / powersOfTen[ -exponent ] : value * powersOfTen[ exponent ];
+    return negative ? -value : value;
   }
-  return new ScalarToken( atof( ret.c_str() ) );
+
+  // strtod wants the number on its own
+  char text[ 64 ];
+  size_t length = end - begin;
+  if( length < sizeof( text ) ) {
+    memcpy( text, begin, length );
+    text[ length ] = '\0';
+    return strtod( text, NULL );
+  }
+  return strtod( string( begin, end ).c_str(), NULL );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetPunct() method
+// Token Tokenizer::GetScalar method
+//
+//   GetScalar scans a number.  It returns a scalar token.
+//
+
+Token Tokenizer::GetScalar() {
+  const char* start = Position;
+  while (!isEOF() && (isdigit((unsigned char)*Position) || '-' == *Position || '.' == *Position || 'e' == *Position)) {
+    Position++;
+  }
+  return Token::scalar( parseScalar( start, Position ) );
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Token Tokenizer::GetPunct() method
 //
 //   Gets a punctuation token from input stream and returns it.
 //
 
-Token* Tokenizer::GetPunct() {
-  Token* T;
+Token Tokenizer::GetPunct() {
+  Token T;
 
-  switch (CurrentCh) {
-  case '(':  GetCh(); T = new Token(LPAREN);     break;
-  case ')':  GetCh(); T = new Token(RPAREN);     break;
-  case '{':  GetCh(); T = new Token(LBRACE);     break;
-  case '}':  GetCh(); T = new Token(RBRACE);     break;
-  case ',':  GetCh(); T = new Token(COMMA);      break;
-  case '=':  GetCh(); T = new Token(EQUALS);     break;
-  case ';':  GetCh(); T = new Token(SEMICOLON);  break;
+  switch (CurrentCh()) {
+  case '(':  GetCh(); T = Token(LPAREN);     break;
+  case ')':  GetCh(); T = Token(RPAREN);     break;
+  case '{':  GetCh(); T = Token(LBRACE);     break;
+  case '}':  GetCh(); T = Token(RBRACE);     break;
+  case ',':  GetCh(); T = Token(COMMA);      break;
+  case '=':  GetCh(); T = Token(EQUALS);     break;
+  case ';':  GetCh(); T = Token(SEMICOLON);  break;
 
   default:
     std::ostringstream ost;
-    ost << "unexpected character: '" << CurrentCh << "'";
+    ost << "unexpected character: '" << CurrentCh() << "'";
     throw SyntaxErrorException(ost.str(), *this);
   }
 
@@ -266,43 +411,30 @@ Token* Tokenizer::GetPunct() {
 
 //////////////////////////////////////////////////////////////////////////
 //
-// void Tokenizer::UnGet(Token*) method
-//
-//   UnGet returns the last read token to the input, where it will be
-//   returned for the next Get call.  At most 1 token can be pushed back
-//   at a time this way and this token is pointed to by the pointer
-//   TokenToUnGet.  TokenToUnGet must be non null.
-
-void Tokenizer::UnGet(Token* TokenToUnGet) {
-  if (UnGetToken != NULL) {
-    throw ParserFatalException("trying to UnGet more than one token");
-  }
-  UnGetToken = TokenToUnGet;
-}
-
-//////////////////////////////////////////////////////////////////////////
+// const Token* Tokenizer::Peek() method
 //
-// Token* Tokenizer::Peek() method
-//
-//   Peek reads the next token and pushes it back on the token stream
+//   Peek reads the next token and holds on to it, to be returned by
+//   the next Get call.
 //
 
 const Token* Tokenizer::Peek() {
-  Token* T = GetNext();
-  UnGet(T);
-  return T;
+  if (!HaveLookahead) {
+    Lookahead = GetNext();
+    HaveLookahead = true;
+  }
+  return &Lookahead;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Read(SYMBOL) method
+// Token Tokenizer::Read(SYMBOL) method
 //
 //   Read gets the next token and checks that it's of the expected type.
 //
 
-auto_ptr<Token> Tokenizer::Read(SYMBOL kind) {
-  auto_ptr<Token> T( Get() );
-  if (T->kind() != kind) {
+Token Tokenizer::Read(SYMBOL kind) {
+  Token T( Get() );
+  if (T.kind() != kind) {
     string msg( getNameForToken( kind ) );
     msg.append( " expected" );
     throw SyntaxErrorException(msg, *this);
@@ -322,41 +454,13 @@ auto_ptr<Token> Tokenizer::Read(SYMBOL kind) {
 bool Tokenizer::CondRead(SYMBOL kind) {
   const Token* T = Peek();
   if (T->kind() == kind) {
-    Get( );
+    HaveLookahead = false;
     return true;
   } else {
     return false;
   }
 }
 
-//////////////////////////////////////////////////////////////////////////
-//
-// Token* Tokenizer::SearchReserved(const string&) private method
-//
-//   SearchReserved() maps a character string to an IdentToken or one of
-// several possible reserved word tokens, using a binary search on the
-// ReservedWords structure.
-//
-
-//
-// The list of all the Reserved words and their associated symbols,
-// in alphabetical order so this can be searched using binary search.
-//
-
-typedef std::map<string, SYMBOL> ReservedWordsMap;
-
-Token* Tokenizer::SearchReserved(const string& ident) const {
-  SYMBOL tokSymbol = lookupReservedWord( ident );
-  if( UNKNOWN == tokSymbol )
-  {
-    return new IdentToken( ident );
-  }
-  else
-  {
-    return new Token( tokSymbol );
-  }
-}
-
 //////////////////////////////////////////////////////////////////////////
 //
 // bool Tokenizer::CondReadCh(char) private method
@@ -367,7 +471,7 @@ Token* Tokenizer::SearchReserved(const string& ident) const {
 //
 
 bool Tokenizer::CondReadCh(char c) {
-  if (c == CurrentCh) {
+  if (!isEOF() && c == *Position) {
     GetCh();
     return true;
   } else {
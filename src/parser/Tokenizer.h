@@ -3,17 +3,15 @@
 #define __TOKENIZER_H__
 
 #include "Token.h"
-#include "../fileio/buffer.h"
 
 #include <string>
-#include <memory>
+#include <vector>
 
 // Needed to correct for annoying "feature" in MSVC's compiler
 #pragma warning (disable: 4786)
 
 using std::string;
-using std::istream;
-using std::auto_ptr;
+using std::ostream;
 
 
 /*
@@ -31,27 +29,33 @@ using std::auto_ptr;
 
 class Tokenizer {
   public:
-    Tokenizer(istream& fp, bool printTokens);
+    // Read the whole of the named file; see good()
+    Tokenizer(const string& filename, bool printTokens);
+    ~Tokenizer();
+
+    // Whether the file could be read
+    bool good() const { return _good; }
 
     // destructively read & return the next token, skipping over whitespace
-    auto_ptr<Token> Get();
+    Token Get();
 
-    // non-destructively get the next token, pushing it back to be read again
+    // non-destructively get the next token, pushing it back to be read again.
+    // The pointer is good until the next Get/Read/CondRead call.
     const Token* Peek();
 
     // Get() the next token, and check that it's of the expected SYMBOL type
-    auto_ptr<Token> Read(SYMBOL expected);
+    Token Read(SYMBOL expected);
 
     // read the next token only if it matches the expected token type.
     // Return whether it matches.
     bool CondRead(SYMBOL expected);
 
     // display the current source line onto the screen.
-    void PrintLine( ostream& out) const { buffer.PrintLine(out); }
+    void PrintLine( ostream& out) const;
 
     // return the column number/line number of the current token.
     int CurColumn() const { return TokenColumn; }
-    int CurLine() const { return buffer.CurLine(); }
+    int CurLine() const { return LineNumber; }
 
     // Repeatedly scan tokens and throw them away.  Useful if this is the
     // last phase to be executed
@@ -60,36 +64,45 @@ class Tokenizer {
 protected:
     // private methods:
 
-    // push the argument token back onto the scanner's token stream;
-    // it will be returned by the next Get/Peek/Read/CondRead call
-    Token* GetNext();
-    void UnGet(Token* t);
-
-    Token* SearchReserved(const string&) const; // Convert ident string into token
+    Token GetNext();              // scan the next token from the file
 
-    void GetCh() { CurrentCh = buffer.GetCh(); }
+    bool isEOF() const { return Position == End; }
+    char CurrentCh() const { return isEOF() ? '\0' : *Position; }
+    void GetCh();                 // step past the current character
     bool CondReadCh(char expected);        // consume a character, if it matches
 
     void SkipWhiteSpace();        // skip spaces, tabs, newlines
 
-    Token* GetPunct();            // scan punctuation token
-    Token* GetScalar();           // scan integer token
-    Token* GetIdent();            // scan identifier token
-    Token* GetQuotedIdent();
+    Token GetPunct();             // scan punctuation token
+    Token GetScalar();            // scan number token
+    Token GetIdent();             // scan identifier token
+    Token GetQuotedIdent();
 
 
     // private data:
 
-    Buffer buffer;                // The file buffer
-    char CurrentCh;               // The current character in the current line
+    const char* Begin;            // The file's bytes, mapped or read in
+    const char* End;
+    size_t MappedSize;            // Length of the mapping, if it is one
+    std::vector<char> Contents;   // The file, where it couldn't be mapped
+    bool _good;
+
+    const char* Position;         // The current character
+    const char* LineStart;        // The first character of the current line
+    int LineNumber;
+    mutable int LastPrintedLine;  // The line number of the last printed line
 
-    Token* UnGetToken;            // The token that has been "ungot"
+    Token Lookahead;              // The token that has been peeked at
+    bool HaveLookahead;
 
     int TokenColumn;              // The column where the last read token starts,
                                   // for generating error messages
 
     bool _printTokens;            // printing flag
+
+  private:
+    Tokenizer(const Tokenizer&);
+    Tokenizer& operator=(const Tokenizer&);
 };
 
 #endif
-
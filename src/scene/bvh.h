@@ -0,0 +1,747 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// bvh.h
+//
+// A bounding volume hierarchy built with the surface area heuristic (SAH).
+// It is a drop-in alternative to KdTree<S>: it is built over the same
+// primitive sources and answers the same intersect() queries.
+//
+
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <algorithm>
+
+#include "ray.h"
+#include "bbox.h"
+#include "packet.h"
+#include "../RayStats.h"
+#include "../BuildPool.h"
+#include "bvhcache.h"
+
+// Summary of an acceleration structure's shape, used to compare trees.
+struct AccelStats
+{
+  AccelStats() : nodes(0), leaves(0), maxDepth(0), maxLeafSize(0), primitiveRefs(0), emptyLeaves(0) {}
+
+  int nodes;
+  int leaves;
+  int maxDepth;
+  int maxLeafSize;
+  long primitiveRefs; // Objects referenced by leaves; larger than the object count when objects are duplicated
+  int emptyLeaves;
+
+  double averageLeafSize() const { return leaves ? (double)primitiveRefs / (double)leaves : 0.0; }
+
+  void merge(const AccelStats& other)
+  {
+    nodes += other.nodes;
+    leaves += other.leaves;
+    maxDepth = std::max(maxDepth, other.maxDepth);
+    maxLeafSize = std::max(maxLeafSize, other.maxLeafSize);
+    primitiveRefs += other.primitiveRefs;
+    emptyLeaves += other.emptyLeaves;
+  }
+};
+
+// Deepest a tree may go.  Traversal stacks are sized by it, so trees read
+// back from the cache are held to it too.
+enum { BVH_MAX_DEPTH = 64 };
+
+// A flattened BVH node.  Interior nodes store the index of their second child
+// in "offset" (the first child always immediately follows its parent) and
+// their split axis a as -1 - a in "count", while leaves store the index of
+// their first object and their object count, which is never zero.  Only
+// leaves need a count and only interior nodes an axis, so sharing the field
+// leaves the count the full range of an int.
+// While a tree is being built in parallel, a node with a negative offset
+// stands for a subtree built separately (see Bvh::splice()).  The box is
+// stored in Real, rounded outwards.
+struct BvhNode
+{
+  Real bmin[3];
+  Real bmax[3];
+  int offset;
+  int count;
+
+  bool isLeaf() const { return count > 0; }
+  int axis() const { return -1 - count; }
+
+  // Slab test against a ray given its origin and reciprocal direction.  Returns
+  // the entry distance through tNear when the box is hit before tFar.
+  bool intersect(const Vec3d& p, const double invDir[3], double tFar, double& tNear) const
+  {
+    double t0 = -1.0e308;
+    double t1 = tFar;
+    for (int a = 0; a < 3; ++a)
+    {
+      double tA = (bmin[a] - p[a]) * invDir[a];
+      double tB = (bmax[a] - p[a]) * invDir[a];
+      if (tA > tB) std::swap(tA, tB);
+      // Written so that NaNs (a zero direction component on a slab boundary) never tighten the interval
+      if (tA > t0) t0 = tA;
+      if (tB < t1) t1 = tB;
+    }
+    tNear = t0;
+    return t0 <= t1 && t1 >= RAY_EPSILON;
+  }
+
+  // The same test for the rays of a packet; returns the lanes that hit
+  int intersectPacket(const RayPacket& rp, int active, const Double4& tFar, Double4& tNear) const
+  {
+    return packetIntersectSlabs(rp, bmin, bmax, active, tFar, tNear);
+  }
+};
+
+template <class S>
+class Bvh
+{
+private:
+  // Tunables for the binned SAH build
+  enum { NUM_BINS = 16, MAX_LEAF_SIZE = 4, MAX_DEPTH = BVH_MAX_DEPTH };
+
+  // Subtrees with at least this many objects are built as pool tasks, and
+  // object bounds are computed in batches of this size
+  enum { PARALLEL_GRAIN = 4096 };
+
+  struct BuildRef
+  {
+    int primitive;
+    BoundingBox bounds;
+    Vec3d center;
+  };
+
+  // What every task of one build shares.  Each task builds its subtree into
+  // its own node list, which splice() puts in place once they're all done.
+  struct BuildContext
+  {
+    std::vector<BuildRef>* refs;
+    BuildPool* pool;
+    BuildPool::Group group;
+    std::deque<std::vector<BvhNode> > subtrees;
+    std::mutex subtreeMutex;
+  };
+
+  const S* _source;
+
+  // The tree is either built into these or mapped from a cache file
+  std::vector<BvhNode> _nodeStore;
+  std::vector<int> _primitiveStore;
+  BvhCacheFile* _cacheFile;
+
+  const BvhNode* _nodes;
+  int _nodeCount;
+  const int* _primitives;   // leaves own contiguous ranges of this
+
+  double _builtCost;        // sahCost() when the tree was built or loaded
+
+  Bvh(const Bvh&);
+  Bvh& operator=(const Bvh&);
+
+public:
+  // The source must outlive the tree.  Given a pool, large subtrees are
+  // built on its threads.  Given a cache directory, a tree saved there for
+  // the same objects is used instead of building one, and a tree that has
+  // to be built is saved there.
+  Bvh(const S& source, BuildPool* pool = NULL, const std::string& cacheDir = std::string())
+    : _source(&source), _cacheFile(NULL), _nodes(NULL), _nodeCount(0), _primitives(NULL), _builtCost(0.0)
+  {
+    int num_objects = source.primitiveCount();
+    if (num_objects == 0)
+      return;
+
+    std::vector<BuildRef> refs(num_objects);
+    std::function<void(int, int)> getBounds = [&](int begin, int end)
+    {
+      for (int i = begin; i < end; ++i)
+      {
+        refs[i].primitive = i;
+        refs[i].bounds = source.primitiveBounds(i);
+        refs[i].center = refs[i].bounds.getCenter();
+      }
+    };
+    if (pool)
+      pool->parallelFor(num_objects, PARALLEL_GRAIN, getBounds);
+    else
+      getBounds(0, num_objects);
+
+    uint64_t key = 0;
+    if (!cacheDir.empty())
+    {
+      key = cacheKey(refs, pool);
+      _cacheFile = BvhCacheFile::open(cacheDir, key, num_objects);
+      if (_cacheFile)
+      {
+        _nodes = _cacheFile->nodes();
+        _nodeCount = _cacheFile->nodeCount();
+        _primitives = _cacheFile->primitives();
+        _builtCost = sahCost();
+        return;
+      }
+    }
+
+    build(refs, pool);
+    _builtCost = sahCost();
+
+    if (!cacheDir.empty())
+      BvhCacheFile::write(cacheDir, key, _nodes, _nodeCount, _primitives, num_objects);
+  }
+
+  ~Bvh()
+  {
+    delete _cacheFile;
+  }
+
+  int getNodeCount() const { return _nodeCount; }
+  bool fromCache() const { return _cacheFile != NULL; }
+
+  // Recompute every node's bounds from the source's current primitive
+  // bounds, keeping the structure, and return the new sahCost().  Children
+  // always come after their parents, so one backwards pass does it.  The
+  // tree stays correct as objects move; it just gets slower the further
+  // they go from where they were when it was built.
+  double refit()
+  {
+    if (_nodeCount == 0)
+      return 0.0;
+
+    // A mapped tree is read-only; take a copy to change
+    if (_cacheFile)
+    {
+      _nodeStore.assign(_nodes, _nodes + _nodeCount);
+      _primitiveStore.assign(_primitives, _primitives + _source->primitiveCount());
+      delete _cacheFile;
+      _cacheFile = NULL;
+      _nodes = &_nodeStore[0];
+      _primitives = &_primitiveStore[0];
+    }
+
+    for (int n = _nodeCount - 1; n >= 0; --n)
+    {
+      BvhNode& node = _nodeStore[n];
+      BoundingBox bounds;
+      if (node.isLeaf())
+      {
+        for (int j = node.offset; j < node.offset + node.count; ++j)
+          bounds.merge(_source->primitiveBounds(_primitives[j]));
+      }
+      else
+      {
+        bounds = nodeBounds(_nodeStore[n + 1]);
+        bounds.merge(nodeBounds(_nodeStore[node.offset]));
+      }
+      setNodeBounds(node, bounds);
+    }
+    return sahCost();
+  }
+
+  // Surface area heuristic cost of the tree, relative to the root's box:
+  // the expected node and object tests for a ray through the root, costed
+  // the same way the build does
+  double sahCost() const
+  {
+    if (_nodeCount == 0)
+      return 0.0;
+    double root_area = halfArea(nodeBounds(_nodes[0]));
+    if (root_area <= 0.0)
+      return 0.0;
+
+    double cost = 0.0;
+    for (int n = 0; n < _nodeCount; ++n)
+    {
+      double area = halfArea(nodeBounds(_nodes[n])) / root_area;
+      cost += _nodes[n].isLeaf() ? area * _nodes[n].count : area;
+    }
+    return cost;
+  }
+
+  double builtCost() const { return _builtCost; }
+
+  void getStats(AccelStats& stats) const
+  {
+    if (_nodeCount > 0)
+      getStats(stats, 0, 0);
+  }
+
+  // Find the closest intersection along r.  Nodes are visited front to back
+  // and any node that starts beyond the closest hit found so far is skipped.
+  void intersect(ray& r, isect& i, bool& have_one) const
+  {
+    if (_nodeCount == 0)
+      return;
+
+    double invDir[3];
+    for (int a = 0; a < 3; ++a)
+      invDir[a] = 1.0 / r.d[a];
+
+    int stack[MAX_DEPTH + 1];
+    int stack_size = 0;
+    int node = 0;
+    double tNear;
+
+    RayCounts* counts = RayStats::testCounts();
+    if (counts) ++counts->nodeTests;
+    if (!_nodes[0].intersect(r.p, invDir, 1.0e308, tNear))
+      return;
+    typename S::RaySetup setup = _source->raySetup(r);
+
+    for (;;)
+    {
+      const BvhNode& n = _nodes[node];
+      if (n.isLeaf())
+      {
+        _source->intersectLeaf(&_primitives[n.offset], n.count, r, setup, i, have_one);
+      }
+      else
+      {
+        // Visit the child on the near side of the split axis first
+        int first = node + 1;
+        int second = n.offset;
+        if (r.d[n.axis()] < 0.0)
+          std::swap(first, second);
+
+        double tFar = have_one ? i.t : 1.0e308;
+        double tFirst, tSecond;
+        if (counts) counts->nodeTests += 2;
+        bool hitFirst = _nodes[first].intersect(r.p, invDir, tFar, tFirst);
+        bool hitSecond = _nodes[second].intersect(r.p, invDir, tFar, tSecond);
+
+        if (hitFirst && hitSecond)
+        {
+          if (tSecond < tFirst)
+            std::swap(first, second);
+          stack[stack_size++] = second;
+          node = first;
+          continue;
+        }
+        else if (hitFirst)
+        {
+          node = first;
+          continue;
+        }
+        else if (hitSecond)
+        {
+          node = second;
+          continue;
+        }
+      }
+
+      // Pop the next subtree, dropping any that begin past the closest hit
+      bool found = false;
+      while (stack_size > 0)
+      {
+        node = stack[--stack_size];
+        if (counts) counts->nodeTests += have_one;
+        if (!have_one || _nodes[node].intersect(r.p, invDir, i.t, tNear))
+        {
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+        return;
+    }
+  }
+
+  // Packet version of intersect() for the rays of rp in active.  Every node
+  // is tested against all of those rays at once and entered if any of them
+  // reaches it before its closest hit so far; the source does the
+  // per-primitive work.
+  void intersectPacket(const RayPacket& rp, int active, PacketHit& hit) const
+  {
+    if (_nodeCount == 0)
+      return;
+
+    int stack[MAX_DEPTH + 1];
+    int stack_mask[MAX_DEPTH + 1];
+    int stack_size = 0;
+    int node = 0;
+    Double4 tNear;
+
+    RayCounts* counts = RayStats::testCounts();
+    if (counts) counts->nodeTests += packetLaneCount(active);
+    int mask = _nodes[0].intersectPacket(rp, active, hit.t, tNear);
+    typename S::PacketSetup setup = _source->packetSetup(rp);
+    for (;;)
+    {
+      if (mask)
+      {
+        const BvhNode& n = _nodes[node];
+        if (n.isLeaf())
+        {
+          for (int j = n.offset; j < n.offset + n.count; ++j)
+            _source->intersectPrimitivePacket(_primitives[j], rp, setup, mask, hit);
+        }
+        else
+        {
+          // Near child first, as seen by the first ray still in the packet
+          int first = node + 1;
+          int second = n.offset;
+          if (rp.dirNeg[n.axis()] & (1 << packetFirstLane(mask)))
+            std::swap(first, second);
+
+          Double4 tFirst, tSecond;
+          if (counts) counts->nodeTests += 2 * packetLaneCount(mask);
+          int maskFirst = _nodes[first].intersectPacket(rp, mask, hit.t, tFirst);
+          int maskSecond = _nodes[second].intersectPacket(rp, mask, hit.t, tSecond);
+
+          if (maskSecond)
+          {
+            stack[stack_size] = second;
+            stack_mask[stack_size] = maskSecond;
+            ++stack_size;
+          }
+          node = first;
+          mask = maskFirst;
+          continue;
+        }
+      }
+
+      // Pop the next subtree, dropping the rays that have since found a closer hit
+      mask = 0;
+      while (!mask && stack_size > 0)
+      {
+        --stack_size;
+        node = stack[stack_size];
+        if (counts) counts->nodeTests += packetLaneCount(stack_mask[stack_size]);
+        mask = _nodes[node].intersectPacket(rp, stack_mask[stack_size], hit.t, tNear);
+      }
+      if (!mask)
+        return;
+    }
+  }
+
+  // Is there any blocking hit along r before tmax?  Order doesn't matter
+  // here, so the first object that reports a hit ends the search.
+  bool occluded(ray& r, double tmax) const
+  {
+    if (_nodeCount == 0)
+      return false;
+
+    double invDir[3];
+    for (int a = 0; a < 3; ++a)
+      invDir[a] = 1.0 / r.d[a];
+    typename S::RaySetup setup = _source->raySetup(r);
+
+    int stack[MAX_DEPTH + 1];
+    int stack_size = 0;
+    int node = 0;
+    double tNear;
+
+    RayCounts* counts = RayStats::testCounts();
+    for (;;)
+    {
+      const BvhNode& n = _nodes[node];
+      if (counts) ++counts->nodeTests;
+      if (n.intersect(r.p, invDir, tmax, tNear))
+      {
+        if (!n.isLeaf())
+        {
+          stack[stack_size++] = n.offset;
+          node = node + 1;
+          continue;
+        }
+
+        for (int j = n.offset; j < n.offset + n.count; ++j)
+        {
+          if (_source->occludesPrimitive(_primitives[j], r, setup, tmax))
+            return true;
+        }
+      }
+
+      if (stack_size == 0)
+        return false;
+      node = stack[--stack_size];
+    }
+  }
+
+private:
+  // Build the tree over refs into _nodeStore and _primitiveStore
+  void build(std::vector<BuildRef>& refs, BuildPool* pool)
+  {
+    int num_objects = refs.size();
+    BuildContext context;
+    context.refs = &refs;
+    context.pool = (pool && pool->threadCount() > 1) ? pool : NULL;
+    context.subtrees.push_back(std::vector<BvhNode>());
+
+    // A binary tree with at most one object per leaf never has more than 2n - 1 nodes
+    context.subtrees[0].reserve(2 * num_objects);
+    build(context, context.subtrees[0], 0, num_objects, 0);
+    if (pool)
+      pool->wait(context.group);
+
+    if (context.subtrees.size() == 1)
+      _nodeStore.swap(context.subtrees[0]);
+    else
+    {
+      size_t num_nodes = 0;
+      for (size_t t = 0; t < context.subtrees.size(); ++t)
+        num_nodes += context.subtrees[t].size();
+      _nodeStore.reserve(num_nodes);
+      splice(context, context.subtrees[0], 0);
+    }
+
+    _primitiveStore.resize(num_objects);
+    for (int i = 0; i < num_objects; ++i)
+      _primitiveStore[i] = refs[i].primitive;
+
+    _nodes = &_nodeStore[0];
+    _nodeCount = _nodeStore.size();
+    _primitives = &_primitiveStore[0];
+  }
+
+  // Hash everything the build depends on: the build settings and the bounds
+  // of every object, in order.  Runs of objects are hashed separately (in
+  // parallel when there's a pool) and then the run hashes together, so the
+  // key doesn't depend on the thread count.
+  static uint64_t cacheKey(const std::vector<BuildRef>& refs, BuildPool* pool)
+  {
+    int num_objects = refs.size();
+    int num_runs = (num_objects + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN;
+    std::vector<uint64_t> run_keys(num_runs);
+    std::function<void(int, int)> hashRuns = [&](int begin, int end)
+    {
+      for (int run = begin; run < end; ++run)
+      {
+        uint64_t hash = FNV1A_OFFSET_BASIS;
+        int last = std::min(num_objects, (run + 1) * PARALLEL_GRAIN);
+        for (int i = run * PARALLEL_GRAIN; i < last; ++i)
+        {
+          Vec3d bmin = refs[i].bounds.getMin();
+          Vec3d bmax = refs[i].bounds.getMax();
+          double b[6] = { bmin[0], bmin[1], bmin[2], bmax[0], bmax[1], bmax[2] };
+          hash = fnv1a(b, sizeof(b), hash);
+        }
+        run_keys[run] = hash;
+      }
+    };
+    if (pool)
+      pool->parallelFor(num_runs, 1, hashRuns);
+    else
+      hashRuns(0, num_runs);
+
+    int settings[] = { NUM_BINS, MAX_LEAF_SIZE, MAX_DEPTH, (int)sizeof(BvhNode), num_objects };
+    uint64_t key = fnv1a(settings, sizeof(settings));
+    return fnv1a(&run_keys[0], run_keys.size() * sizeof(uint64_t), key);
+  }
+
+  static double halfArea(const BoundingBox& b)
+  {
+    Vec3d d = b.getMax() - b.getMin();
+    return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+  }
+
+  static int makeLeaf(std::vector<BvhNode>& nodes, const BoundingBox& bounds, int start, int end)
+  {
+    BvhNode leaf;
+    setNodeBounds(leaf, bounds);
+    leaf.offset = start;
+    leaf.count = end - start;
+    nodes.push_back(leaf);
+    return nodes.size() - 1;
+  }
+
+  static BoundingBox nodeBounds(const BvhNode& n)
+  {
+    return BoundingBox(Vec3d(n.bmin[0], n.bmin[1], n.bmin[2]), Vec3d(n.bmax[0], n.bmax[1], n.bmax[2]));
+  }
+
+  static void setNodeBounds(BvhNode& n, const BoundingBox& bounds)
+  {
+    for (int a = 0; a < 3; ++a)
+    {
+      n.bmin[a] = roundDown(bounds.getMin()[a]);
+      n.bmax[a] = roundUp(bounds.getMax()[a]);
+    }
+  }
+
+  // Build the subtree for refs[start, end) into nodes and return the index
+  // of its root.  Objects are partitioned in place, so every leaf ends up
+  // owning a contiguous range of the final object list.
+  int build(BuildContext& context, std::vector<BvhNode>& nodes, int start, int end, int depth)
+  {
+    std::vector<BuildRef>& refs = *context.refs;
+    int count = end - start;
+
+    BoundingBox bounds = refs[start].bounds;
+    BoundingBox centers(refs[start].center, refs[start].center);
+    for (int i = start + 1; i < end; ++i)
+    {
+      bounds.merge(refs[i].bounds);
+      centers.merge(BoundingBox(refs[i].center, refs[i].center));
+    }
+
+    if (count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH)
+      return makeLeaf(nodes, bounds, start, end);
+
+    int axis = centers.getLongestAxis();
+    double cmin = centers.getMin()[axis];
+    double extent = centers.getMax()[axis] - cmin;
+    int mid;
+
+    if (extent <= 0.0)
+    {
+      // Every center coincides; split by count so the leaves stay small
+      mid = start + count / 2;
+    }
+    else
+    {
+      // Bin the object centers along the chosen axis
+      BoundingBox binBounds[NUM_BINS];
+      int binCounts[NUM_BINS] = { 0 };
+      double scale = NUM_BINS / extent;
+
+      for (int i = start; i < end; ++i)
+      {
+        int b = std::min(NUM_BINS - 1, (int)((refs[i].center[axis] - cmin) * scale));
+        binCounts[b]++;
+        binBounds[b].merge(refs[i].bounds);
+      }
+
+      // Sweep from the right to get the area and count on the far side of each plane
+      double rightArea[NUM_BINS];
+      int rightCount[NUM_BINS];
+      BoundingBox acc;
+      int accCount = 0;
+      for (int b = NUM_BINS - 1; b > 0; --b)
+      {
+        acc.merge(binBounds[b]);
+        accCount += binCounts[b];
+        rightArea[b] = accCount ? halfArea(acc) : 0.0;
+        rightCount[b] = accCount;
+      }
+
+      // Sweep from the left and evaluate the SAH cost of splitting before bin b
+      double bestCost = 1.0e308;
+      int bestSplit = -1;
+      acc = BoundingBox();
+      accCount = 0;
+      for (int b = 1; b < NUM_BINS; ++b)
+      {
+        acc.merge(binBounds[b - 1]);
+        accCount += binCounts[b - 1];
+        if (accCount == 0 || rightCount[b] == 0)
+          continue;
+
+        double cost = halfArea(acc) * accCount + rightArea[b] * rightCount[b];
+        if (cost < bestCost)
+        {
+          bestCost = cost;
+          bestSplit = b;
+        }
+      }
+
+      // Traversal is costed the same as one object test; stop when splitting no longer pays
+      double leafCost = count;
+      double parentArea = halfArea(bounds);
+      double splitCost = 1.0 + (parentArea > 0.0 ? bestCost / parentArea : count);
+
+      if (bestSplit < 0 || (splitCost >= leafCost && count <= 2 * MAX_LEAF_SIZE))
+        return makeLeaf(nodes, bounds, start, end);
+
+      BuildRef* first = &refs[0] + start;
+      BuildRef* last = &refs[0] + end;
+      BuildRef* pivot = std::partition(first, last, BinPredicate(axis, cmin, scale, bestSplit));
+      mid = start + (int)(pivot - first);
+
+      if (mid == start || mid == end)
+        mid = start + count / 2;
+    }
+
+    int index = nodes.size();
+    nodes.push_back(BvhNode());
+    setNodeBounds(nodes[index], bounds);
+    nodes[index].count = -1 - axis;
+
+    if (context.pool && end - mid >= PARALLEL_GRAIN)
+    {
+      // Build the second child as a task while this thread does the first,
+      // and leave a placeholder for it
+      std::vector<BvhNode>* subtree;
+      int subtree_index;
+      {
+        std::lock_guard<std::mutex> lock(context.subtreeMutex);
+        subtree_index = context.subtrees.size();
+        context.subtrees.push_back(std::vector<BvhNode>());
+        subtree = &context.subtrees.back();
+      }
+      subtree->reserve(2 * (end - mid));
+      context.pool->run(context.group, [this, &context, subtree, mid, end, depth]
+        { build(context, *subtree, mid, end, depth + 1); });
+
+      build(context, nodes, start, mid, depth + 1);
+      nodes[index].offset = nodes.size();
+      BvhNode placeholder = BvhNode();
+      placeholder.offset = -1 - subtree_index;
+      nodes.push_back(placeholder);
+    }
+    else
+    {
+      build(context, nodes, start, mid, depth + 1);
+      nodes[index].offset = build(context, nodes, mid, end, depth + 1);
+    }
+    return index;
+  }
+
+  // Copy the subtree rooted at nodes[node] to the end of _nodeStore, following
+  // placeholders into the subtrees built by other tasks, and return where
+  // its root ended up
+  int splice(BuildContext& context, const std::vector<BvhNode>& nodes, int node)
+  {
+    const BvhNode& n = nodes[node];
+    if (n.offset < 0)
+      return splice(context, context.subtrees[-1 - n.offset], 0);
+
+    int index = _nodeStore.size();
+    _nodeStore.push_back(n);
+    if (!n.isLeaf())
+    {
+      splice(context, nodes, node + 1);
+      _nodeStore[index].offset = splice(context, nodes, n.offset);
+    }
+    return index;
+  }
+
+  struct BinPredicate
+  {
+    BinPredicate(int axis, double cmin, double scale, int split) : _axis(axis), _cmin(cmin), _scale(scale), _split(split) {}
+
+    bool operator()(const BuildRef& ref) const
+    {
+      return std::min((int)NUM_BINS - 1, (int)((ref.center[_axis] - _cmin) * _scale)) < _split;
+    }
+
+    int _axis;
+    double _cmin;
+    double _scale;
+    int _split;
+  };
+
+  void getStats(AccelStats& stats, int node, int depth) const
+  {
+    const BvhNode& n = _nodes[node];
+    stats.nodes++;
+    stats.maxDepth = std::max(stats.maxDepth, depth);
+    if (n.isLeaf())
+    {
+      stats.leaves++;
+      stats.primitiveRefs += n.count;
+      stats.maxLeafSize = std::max(stats.maxLeafSize, (int)n.count);
+      return;
+    }
+    getStats(stats, node + 1, depth + 1);
+    getStats(stats, n.offset, depth + 1);
+  }
+};
+
+#endif // __BVH_H__
@@ -0,0 +1,179 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "bvhcache.h"
+#include "bvh.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Bump whenever the layout of a cache file or the way trees are built changes
+static const uint32_t CACHE_VERSION = 2;
+static const char CACHE_MAGIC[8] = { 'R', 'A', 'Y', 'B', 'V', 'H', '\0', '\0' };
+
+// Followed by the nodes, then the primitive indices
+struct CacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nodeSize;
+  uint64_t key;
+  int32_t nodeCount;
+  int32_t primitiveCount;
+};
+
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string BvhCacheFile::path(const std::string& dir, uint64_t key)
+{
+  std::ostringstream name;
+  name << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+  return name.str();
+}
+
+#ifndef _WIN32
+
+BvhCacheFile* BvhCacheFile::open(const std::string& dir, uint64_t key, int num_primitives)
+{
+  int fd = ::open(path(dir, key).c_str(), O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader))
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  BvhCacheFile* file = new BvhCacheFile();
+  file->_data = data;
+  file->_size = st.st_size;
+  if (!file->valid(key, num_primitives))
+  {
+    delete file;
+    return NULL;
+  }
+  return file;
+}
+
+bool BvhCacheFile::write(const std::string& dir, uint64_t key, const BvhNode* nodes, int num_nodes,
+                         const int* primitives, int num_primitives)
+{
+  mkdir(dir.c_str(), 0777);
+
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.nodeSize = sizeof(BvhNode);
+  header.key = key;
+  header.nodeCount = num_nodes;
+  header.primitiveCount = num_primitives;
+
+  // Unique per process and thread, since two meshes may share a key
+  std::ostringstream temp;
+  temp << path(dir, key) << ".tmp." << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+
+  FILE* f = fopen(temp.str().c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+    && fwrite(nodes, sizeof(BvhNode), num_nodes, f) == (size_t)num_nodes
+    && fwrite(primitives, sizeof(int), num_primitives, f) == (size_t)num_primitives;
+  ok = (fclose(f) == 0) && ok;
+
+  if (ok && rename(temp.str().c_str(), path(dir, key).c_str()) == 0)
+    return true;
+  remove(temp.str().c_str());
+  return false;
+}
+
+BvhCacheFile::~BvhCacheFile()
+{
+  if (_data)
+    munmap(_data, _size);
+}
+
+#else
+
+// No memory mapping here; every tree is built from scratch
+BvhCacheFile* BvhCacheFile::open(const std::string& dir, uint64_t key, int num_primitives) { return NULL; }
+bool BvhCacheFile::write(const std::string& dir, uint64_t key, const BvhNode* nodes, int num_nodes,
+                         const int* primitives, int num_primitives) { return false; }
+BvhCacheFile::~BvhCacheFile() {}
+
+#endif
+
+// Check the header, that every node and index stays inside the file and that
+// the tree is no deeper than traversal allows, so a stale or damaged file is
+// rebuilt rather than trusted
+bool BvhCacheFile::valid(uint64_t key, int num_primitives)
+{
+  const CacheHeader* header = (const CacheHeader*)_data;
+  if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != CACHE_VERSION ||
+      header->nodeSize != sizeof(BvhNode) || header->key != key || header->primitiveCount != num_primitives ||
+      header->nodeCount <= 0)
+    return false;
+
+  size_t expected = sizeof(CacheHeader) + (size_t)header->nodeCount * sizeof(BvhNode) + (size_t)num_primitives * sizeof(int);
+  if (_size != expected)
+    return false;
+
+  _nodeCount = header->nodeCount;
+  _nodes = (const BvhNode*)((const char*)_data + sizeof(CacheHeader));
+  _primitives = (const int*)(_nodes + _nodeCount);
+
+  // Children always come after their parent, so traversal can't loop, and
+  // each node's depth is known by the time the loop reaches it
+  std::vector<int> depth(_nodeCount, 0);
+  for (int n = 0; n < _nodeCount; ++n)
+  {
+    const BvhNode& node = _nodes[n];
+    if (depth[n] > BVH_MAX_DEPTH)
+      return false;
+    if (node.isLeaf())
+    {
+      if (node.offset < 0 || node.offset > num_primitives || node.count > num_primitives - node.offset)
+        return false;
+      continue;
+    }
+    if (node.offset <= n + 1 || node.offset >= _nodeCount || node.axis() < 0 || node.axis() > 2)
+      return false;
+    depth[n + 1] = std::max(depth[n + 1], depth[n] + 1);
+    depth[node.offset] = std::max(depth[node.offset], depth[n] + 1);
+  }
+  for (int i = 0; i < num_primitives; ++i)
+  {
+    if (_primitives[i] < 0 || _primitives[i] >= num_primitives)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,65 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// bvhcache.h
+//
+// Built BVHs saved to disk so the next load of the same geometry can skip
+// the build.  A cache file is named after a 64-bit FNV-1a hash of everything
+// the build depends on, and is memory-mapped and used in place when it's
+// loaded again.
+//
+
+#ifndef __BVHCACHE_H__
+#define __BVHCACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+struct BvhNode;
+
+// 64-bit FNV-1a over size bytes; pass the result back in as hash to continue
+// hashing more data
+const uint64_t FNV1A_OFFSET_BASIS = 14695981039346656037ULL;
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FNV1A_OFFSET_BASIS);
+
+class BvhCacheFile
+{
+public:
+  // Map the cache file for key from dir.  Returns NULL if there is none, or
+  // if it isn't a valid tree over num_primitives objects.
+  static BvhCacheFile* open(const std::string& dir, uint64_t key, int num_primitives);
+
+  // Save a tree as the cache file for key in dir, creating dir if needed.
+  // The file is written under a temporary name and renamed into place, so
+  // other processes never map a partly written file.
+  static bool write(const std::string& dir, uint64_t key, const BvhNode* nodes, int num_nodes,
+                    const int* primitives, int num_primitives);
+
+  ~BvhCacheFile();
+
+  const BvhNode* nodes() const { return _nodes; }
+  int nodeCount() const { return _nodeCount; }
+  const int* primitives() const { return _primitives; }
+
+private:
+  BvhCacheFile() : _data(NULL), _size(0), _nodes(NULL), _nodeCount(0), _primitives(NULL) {}
+  BvhCacheFile(const BvhCacheFile&);
+  BvhCacheFile& operator=(const BvhCacheFile&);
+
+  static std::string path(const std::string& dir, uint64_t key);
+  bool valid(uint64_t key, int num_primitives);
+
+  void* _data;
+  size_t _size;
+  const BvhNode* _nodes;
+  int _nodeCount;
+  const int* _primitives;
+};
+
+#endif // __BVHCACHE_H__
@@ -10,6 +10,7 @@ Camera::Camera()
 {
     aspectRatio = 1;
     normalizedHeight = 1;
+    imageHeight = 0;
     
     eye = Vec3d(0,0,0);
     u = Vec3d( 1,0,0 );
@@ -25,9 +26,14 @@ Camera::rayThrough(double x, double y, ray &r)
     x -= 0.5;
     y -= 0.5;
     Vec3d dir = look + x * u + y * v;
+	double len = dir.length();
 	dir.normalize();
 	r.p = eye;
 	r.d = dir;
+
+	// One sample's height of the image plane, seen from len away
+	if (imageHeight > 0)
+		r.setCone(0.0, normalizedHeight / imageHeight / len);
 }
 
 void
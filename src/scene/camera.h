@@ -14,6 +14,10 @@ public:
     void setFOV( double );
     void setAspectRatio( double );
 
+    // The size in samples of the image rays are traced for, which sets how
+    // wide a cone rayThrough gives its rays.  0 (the default) gives none.
+    void setImageSize( int width, int height ) { imageHeight = height; }
+
     double getAspectRatio() { return aspectRatio; }
 
 	const Vec3d& getEye() const			{ return eye; }
@@ -24,6 +28,7 @@ private:
     Mat3d m;                     // rotation matrix
     double normalizedHeight;    // dimensions of image place at unit dist from eye
     double aspectRatio;
+    int imageHeight;
     
     void update();              // using the above three values calculate look,u,v
     
@@ -8,88 +8,26 @@
 #include "cubeMap.h"
 #include "ray.h"
 #include "../ui/TraceUI.h"
+#include "../BuildPool.h"
 extern TraceUI* traceUI;
 
-Vec3d CubeMap::getColor(ray r) const {
+#include <algorithm>
 
-	int axis, front, left, right, top, bottom;
-	double u,v;
-	Vec3d dir = r.getDirection();
-	
-	if (fabs(dir[0]) > fabs(dir[1]))
-		if (fabs(dir[0]) > fabs(dir[2])) {
-			axis = 0;
-			bottom = 3;
-			top = 2;
-			if (dir[0] > 0.0) {
-				front = 0;
-				left = 4;
-				right = 5;
-			}
-			else {
-				front = 1;
-				left = 5;
-				right = 4;
-			}
-		}
-		else {
-			axis = 2;
-			bottom = 3;
-			top = 2;
-			if (dir[2] > 0.0) {
-				front = 5;
-				left = 0;
-				right = 1;
-			}
-			else {
-				front = 4;
-				left = 1;
-				right = 0;
-			}
-		}
-	else
-		if (fabs(dir[1]) > fabs(dir[2])) {
-			axis = 1;
-			left = 1;
-			right = 0;
-			if (dir[1] > 0.0) {
-				front = 2;
-				bottom = 4;
-				top = 5;
-			}
-			else {
-				front = 3;
-				bottom = 5;
-				top = 4;
-			}
-		}
-		else {
-			axis = 2;
-			bottom = 3;
-			top = 2;
-			if (dir[2] > 0.0) {
-				front = 5;
-				left = 0;
-				right = 1;
-			}
-			else {
-				front = 4;
-				left = 1;
-				right = 0;
-			}
-		}
+using namespace std;
 
-	if (axis == 0) {
+// Where dir meets the plane of face, in [0, 1] x [0, 1] on the face
+static void faceCoordinates(int face, const Vec3d& dir, double& u, double& v) {
+	if (face < 2) {
 		u = dir[2]/dir[0];
 		if (dir[0] > 0.0) v = dir[1]/dir[0];
 		else v = -dir[1]/dir[0];
 	}
-	else if (axis == 1) {
+	else if (face < 4) {
 		if (dir[1] > 0.0) u = dir[0]/dir[1];
 		else u = -dir[0]/dir[1];
 		v = dir[2]/dir[1];
 	}
-	else if (axis == 2) {
+	else {
 		u = -dir[0]/dir[2];
 		if (dir[2] > 0.0) v = dir[1]/dir[2];
 		else v = -dir[1]/dir[2];
@@ -97,118 +35,158 @@ Vec3d CubeMap::getColor(ray r) const {
 
 	u = (u + 1.0)/2.0;
 	v = (v + 1.0)/2.0;
+}
 
-	int filterwidth = traceUI->getFilterWidth();
-	if (filterwidth == 1) return tMap[front]->getMappedValue(Vec2d(u, v)); // Why even bother with expensive computation when we can grab straight from the image?
-	int fw = (filterwidth + 1)/2 - 1;
-	int rm = filterwidth - fw;
-	int width = tMap[front]->getWidth();
-	int height = tMap[front]->getHeight();
-	double delu = 1.0/width;
-	double delv = 1.0/height;
-	int x = floor(0.5 + u * (width - 1));
-	int y = floor(0.5 + v * (height - 1));
-	double startu = delu * (x - fw);
-	double startv = delv * (y - fw);
-	double nextu = startu;
-	double nextv = startv;
-	double xslope = 1.0/(((double)filterwidth + 1) / 2.0 * delu);
-	double yslope = 1.0/(((double)filterwidth + 1) / 2.0 * delv);
-	double correct = 0.0;
-	Vec3d thePixel = Vec3d(0.0, 0.0, 0.0);
-	for (int jj = -fw; jj < rm; jj++) {
-		for (int ii = -fw; ii < rm; ii++) {
-			int xindex = x + ii;
-			int yindex = y + jj;
-			if (xindex < 0 && yindex < 0) continue;
-			if (xindex >= width && yindex >= height) continue;
-			if (xindex >= width && yindex < 0) continue;
-			if (xindex < 0 && yindex >= height) continue;
-			int theMap = front;
-			if (yindex < 0) {
-				theMap = bottom;
-				if (axis == 0)
-					if (dir[0] > 0) {
-						yindex = height - 1 - xindex;
-						xindex = width + jj;
-					}
-					else {
-						yindex = xindex;
-						xindex = -1 - jj;
-					}
-				else if (axis == 1)
-					if (dir[1] > 0) yindex = height + jj;
-					else {
-						yindex = -1 - jj;
-						xindex = width - 1 - xindex;
-					}
-				else if (axis == 2)
-					if (dir[2] > 0) {
-						yindex = -1 - jj;
-						xindex = width - 1 - xindex;
-					}
-					else yindex = height + jj;
-			}
-			else if (yindex >= height) {
-				theMap = top;
-				if (axis == 0)
-					if (dir[0] > 0) {
-						yindex = xindex;
-						xindex = width - jj;
-					}
-					else {
-						yindex = height - 1 - xindex;
-						xindex = jj - 1;
-					}
-				else if (axis == 1)
-					if (dir[1] > 0)  {
-						yindex = height - jj;
-						xindex = width - 1 - xindex;
-					}
-					else yindex = jj - 1;
-				else if (axis == 2)
-					if (dir[2] > 0) {
-						yindex =  height - jj;
-						xindex = width - 1 - xindex;
-					}
-					else yindex = jj - 1;
-			}
-			else if (xindex < 0) {
-				theMap = left;
-				if (axis == 0  || axis == 2) xindex = width + ii;
-				else if (axis == 1)
-					if (dir[1] > 0)  {
-						xindex = width - 1 - yindex;
-						yindex = height + ii;
-					}
-					else {
-						xindex = yindex;
-						yindex = -1 - ii;
-					}
-			}
-			else if (xindex >= width) {
-				theMap = right;
-				if (axis == 0  || axis == 2) xindex = ii - 1;
-				else if (axis == 1)
-					if (dir[1] > 0)  {
-						xindex = yindex;
-						yindex = height - ii;
-					}
-					else {
-						xindex = width - 1 - yindex;
-						yindex = ii - 1;
-					}
-			}
-			double du = u - nextu;
-			double dv = v - nextv;
-			double weight = (1.0 - fabs(du * xslope)) * (1.0 - fabs(dv * yslope));
-			nextu += delu;
-			correct += weight;
-			thePixel += tMap[theMap]->getPixelAt(xindex, yindex) * weight;
+// The direction through (s, t) in [-1, 1] x [-1, 1] on face, the inverse of
+// project(); s and t past the edges point on into the faces next to it
+static Vec3d faceDirection(int face, double s, double t) {
+	switch (face) {
+	case 0:  return Vec3d(1.0, t, s);
+	case 1:  return Vec3d(-1.0, t, -s);
+	case 2:  return Vec3d(s, 1.0, t);
+	case 3:  return Vec3d(s, -1.0, -t);
+	case 4:  return Vec3d(s, t, -1.0);
+	default: return Vec3d(-s, t, 1.0);
+	}
+}
+
+int CubeMap::project(const Vec3d& dir, double& u, double& v) {
+
+	int front;
+	
+	if (fabs(dir[0]) > fabs(dir[1]))
+		if (fabs(dir[0]) > fabs(dir[2])) front = dir[0] > 0.0 ? 0 : 1;
+		else front = dir[2] > 0.0 ? 5 : 4;
+	else
+		if (fabs(dir[1]) > fabs(dir[2])) front = dir[1] > 0.0 ? 2 : 3;
+		else front = dir[2] > 0.0 ? 5 : 4;
+
+	faceCoordinates(front, dir, u, v);
+	return front;
+}
+
+Vec3d CubeMap::texelAt(int face, double u, double v) const {
+	const TextureMap* map = tMap[face];
+	int width = map->getWidth();
+	int height = map->getHeight();
+	int x = max(0, min(width - 1, (int)(u * width)));
+	int y = max(0, min(height - 1, (int)(v * height)));
+	return map->getPixelAt(x, y);
+}
+
+Vec3d CubeMap::borderTexel(int face, double s, double t) const {
+	// Past a corner there's no one face to unfold; take what's in that
+	// direction
+	double u, v;
+	if (fabs(s) > 1.0 && fabs(t) > 1.0) {
+		int other = project(faceDirection(face, s, t), u, v);
+		return texelAt(other, u, v);
+	}
+
+	// Otherwise the neighbour across the edge, laid out flat beyond it:
+	// find the edge on it, and go as far in from there as (s, t) is past
+	// the edge of face
+	double es = max(-1.0, min(1.0, s));
+	double et = max(-1.0, min(1.0, t));
+	double past = (max(fabs(s), fabs(t)) - 1.0) / 2.0;
+	int other = project(faceDirection(face, s, t), u, v);
+	faceCoordinates(other, faceDirection(face, es, et), u, v);
+	if (min(u, 1.0 - u) < min(v, 1.0 - v))
+		u += u < 0.5 ? past : -past;
+	else
+		v += v < 0.5 ? past : -past;
+	return texelAt(other, u, v);
+}
+
+void CubeMap::prefilter() {
+	std::lock_guard<std::mutex> guard(prefilterLock);
+	if (prefiltered)
+		return;
+	for (int f = 0; f < 6; f++)
+		if (!tMap[f]) return;
+
+	// Decode the faces side by side, then build their tables the same way;
+	// every table reads the faces around it, so all six are decoded first
+	BuildPool pool(traceUI->getThreads());
+	BuildPool::Group faces;
+	bool loaded[6];
+	for (int f = 0; f < 6; f++)
+		pool.run(faces, [this, f, &loaded] { loaded[f] = tMap[f]->load(); });
+	pool.wait(faces);
+
+	// A face that can't be read samples as white
+	for (int f = 0; f < 6; f++)
+		if (!loaded[f])
+			traceUI->alert("Unable to load cube map face '" + tMap[f]->getFilename() + "'.");
+	for (int f = 0; f < 6; f++)
+		pool.run(faces, [this, f] { buildSums(f); });
+	pool.wait(faces);
+	prefiltered = true;
+}
+
+void CubeMap::buildSums(int f) {
+	FaceSums& face = faceSums[f];
+	face.width = tMap[f]->getWidth();
+	face.height = tMap[f]->getHeight();
+	int stride = face.width + 2 * BORDER + 1;
+	int rows = face.height + 2 * BORDER + 1;
+	face.sums.assign(3 * stride * rows, 0.0);
+
+	// Each entry is the one below it plus the sum along its row so far
+	for (int y = 1; y < rows; y++) {
+		Vec3d row(0.0, 0.0, 0.0);
+		for (int x = 1; x < stride; x++) {
+			int tx = x - 1 - BORDER;
+			int ty = y - 1 - BORDER;
+			if (tx >= 0 && tx < face.width && ty >= 0 && ty < face.height)
+				row += tMap[f]->getPixelAt(tx, ty);
+			else
+				row += borderTexel(f, 2.0 * (tx + 0.5) / face.width - 1.0, 2.0 * (ty + 0.5) / face.height - 1.0);
+			double* entry = &face.sums[3 * (x + y * stride)];
+			const double* below = entry - 3 * stride;
+			for (int c = 0; c < 3; c++)
+				entry[c] = below[c] + row[c];
 		}
-		nextu = startu;
-		nextv += delv;
 	}
-	thePixel /= correct;
-	return thePixel;
+}
+
+Vec3d CubeMap::sumTo(const FaceSums& face, double x, double y) const {
+	int stride = face.width + 2 * BORDER + 1;
+	x = max(0.0, min((double)(stride - 1), x + BORDER));
+	y = max(0.0, min((double)(face.height + 2 * BORDER), y + BORDER));
+
+	// The table is exact at whole texels and linear in between
+	int x0 = min((int)x, stride - 2);
+	int y0 = min((int)y, face.height + 2 * BORDER - 1);
+	double fx = x - x0;
+	double fy = y - y0;
+	const double* s00 = &face.sums[3 * (x0 + y0 * stride)];
+	const double* s01 = s00 + 3 * stride;
+	Vec3d sum;
+	for (int c = 0; c < 3; c++)
+		sum[c] = (1.0 - fy) * ((1.0 - fx) * s00[c] + fx * s00[c + 3]) + fy * ((1.0 - fx) * s01[c] + fx * s01[c + 3]);
+	return sum;
+}
+
+Vec3d CubeMap::getColor(ray r) {
+
+	double u, v;
+	int front = project(r.getDirection(), u, v);
+
+	int filterwidth = traceUI->getFilterWidth();
+	if (filterwidth == 1) return tMap[front]->getMappedValue(Vec2d(u, v)); // Why even bother with expensive computation when we can grab straight from the image?
+
+	if (!prefiltered)
+		prefilter();
+
+	// A box as spread out as the tent filter filterwidth + 1 texels across
+	// that this used to take, which is sqrt(2) times its half width, read
+	// from the summed-area table in constant time
+	const FaceSums& face = faceSums[front];
+	double half = min((double)BORDER, (filterwidth + 1) / 2.0 * sqrt(2.0) / 2.0);
+	double x = u * face.width;
+	double y = v * face.height;
+	Vec3d sum = sumTo(face, x + half, y + half) - sumTo(face, x - half, y + half)
+		- sumTo(face, x + half, y - half) + sumTo(face, x - half, y - half);
+	return sum / (4.0 * half * half);
 }
@@ -1,46 +1,69 @@
 #pragma once
 
+#include <vector>
+#include <mutex>
+#include <atomic>
+
 #include "../scene/material.h"
 
 class CubeMap {
 
 	TextureMap* tMap[6];
-	int* kernel;
+
+	// A summed-area table over each face and a BORDER texel wide strip
+	// around it, filled in from the faces next to it, so a box filter near
+	// an edge reads across it like the cube had no seams.  Entry (x, y) is
+	// the sum of the texels left of and below texel (x - BORDER, y - BORDER).
+	enum { BORDER = 16 };
+	struct FaceSums {
+		int width;
+		int height;
+		std::vector<double> sums;	// RGB, (width + 2 BORDER + 1) per row
+	};
+	FaceSums faceSums[6];
+	std::atomic<bool> prefiltered;
+	std::mutex prefilterLock;
+
+	void setFace(int face, TextureMap* m) {
+		if (tMap[face] && tMap[face] != m) delete(tMap[face]);
+		if (tMap[face] != m) tMap[face] = m;
+		prefiltered = false;
+	}
+
+	// The texel of face nearest (u, v) in [0, 1] x [0, 1]
+	Vec3d texelAt(int face, double u, double v) const;
+
+	// What's at (s, t), outside [-1, 1] x [-1, 1], on the plane of face
+	Vec3d borderTexel(int face, double s, double t) const;
+
+	// Fill in the table of face f
+	void buildSums(int f);
+
+	// Sum of face's texels over [0, x) x [0, y), in texels from its corner
+	Vec3d sumTo(const FaceSums& face, double x, double y) const;
 
 public:
-	CubeMap() : kernel(0) { 
+	CubeMap() : prefiltered(false) {
 		for (int i = 0; i < 6; i++) tMap[i] = 0;
 	}
 
-	void setXposMap(TextureMap* m) {
-		if(tMap[0] && tMap[0] != m) delete(tMap[0]);
-		if (tMap[0] != m) tMap[0] = m;
-	}
-	void setXnegMap(TextureMap* m) {
-		if(tMap[1] && tMap[1] != m) delete(tMap[1]);
-		if (tMap[1] != m) tMap[1] = m;
-	}
-	void setYposMap(TextureMap* m) {
-		if(tMap[2] && tMap[2] != m) delete(tMap[2]);
-		if (tMap[2] != m) tMap[2] = m;
-	}
-	void setYnegMap(TextureMap* m) {
-		if(tMap[3] && tMap[3] != m) delete(tMap[3]);
-		if (tMap[3] != m) tMap[3] = m;
-	}
-	void setZposMap(TextureMap* m) {
-		if(tMap[4] && tMap[4] != m) delete(tMap[4]);
-		if (tMap[4] != m) tMap[4] = m;
-	}
-	void setZnegMap(TextureMap* m) {
-		if(tMap[5] && tMap[5] != m) delete(tMap[5]);
-		if (tMap[5] != m) tMap[5] = m;
-	}
+	void setXposMap(TextureMap* m) { setFace(0, m); }
+	void setXnegMap(TextureMap* m) { setFace(1, m); }
+	void setYposMap(TextureMap* m) { setFace(2, m); }
+	void setYnegMap(TextureMap* m) { setFace(3, m); }
+	void setZposMap(TextureMap* m) { setFace(4, m); }
+	void setZnegMap(TextureMap* m) { setFace(5, m); }
+
+	// Decode the faces and build their summed-area tables, once all six are
+	// set.  Filtered lookups do it themselves if it hasn't been done.
+	void prefilter();
+
+	// The face dir points at, with the point it hits there in [0, 1] x [0, 1]
+	static int project(const Vec3d& dir, double& u, double& v);
 
-	Vec3d getColor(ray r) const;
+	Vec3d getColor(ray r);
 
 	~CubeMap() {
 		for (int i = 0; i < 6; i++) if (tMap[i]) { delete tMap[i]; tMap[i] = 0; }
-		if (kernel) delete[] kernel;
 	}
-};
\ No newline at end of file
+};
@@ -26,29 +26,10 @@ Vec3d DirectionalLight::shadowAttenuation(const ray& r, const Vec3d& p) const
 
   // Lighting model equation: http://www.cs.utexas.edu/~fussell/courses/cs354/assignments/raytracing/equations.pdf
   ray point_to_light(p, -orientation, ray::SHADOW);
-  isect intersect_info;
 
-  // See if the ray from the point to the light intersects with any object, if it doesn't then just return the light color
-  if (scene->intersect(point_to_light, intersect_info))
-  {
-    // Grab the point of intersection
-    Vec3d q = point_to_light.at(intersect_info.t);
-
-    // Grab transmissive material property
-    Vec3d kt = intersect_info.material->kt(intersect_info);
-
-    // Find length between p and q to use for dropoff of shadow color (only useful whenever we have a transparent object and treat q as a new point light source)
-    // double distance_pq = (p - q).length();
-    // double attenuation = min(1.0, 1.0 / (1.0 + (0.1 * distance_pq) + (0.01 * distance_pq * distance_pq)));
-
-    // We might intersect with another object using the ray from q to the light source
-    Vec3d intensity_at_q = shadowAttenuation(r, q);
-
-    // Return the componenet-wise multiplication of transmissive material property and color at q
-    return prod(intensity_at_q, kt);
-  }
-  else
-    return color;
+  // The light is infinitely far away, so anything along the ray can block it.  Transmissive
+  // blockers filter the light by their transmissive color instead of blocking it outright
+  return prod(color, scene->transmittance(point_to_light, 1.0e308));
 }
 
 Vec3d DirectionalLight::getColor() const
@@ -91,6 +72,27 @@ Vec3d PointLight::getDirection(const Vec3d& P) const
 }
 
 
+// The distance d where the brightest channel of the light falls to cutoff,
+// i.e. the root of a + b d + c d^2 = max(color) / cutoff.  There's none
+// without a cutoff, or unless b and c are both non-negative and one of them
+// positive, since otherwise the light doesn't fade out for good.
+bool PointLight::influenceBounds(double cutoff, Vec3d& center, double& radius) const
+{
+  double brightest = max(color[0], max(color[1], color[2]));
+  if (cutoff <= 0.0 || linearTerm < 0.0 || quadraticTerm < 0.0 || (linearTerm == 0.0 && quadraticTerm == 0.0))
+    return false;
+
+  center = position;
+  double k = brightest / cutoff - constantTerm;
+  if (k <= 0.0 || brightest < cutoff)
+    radius = 0.0;
+  else if (quadraticTerm > 0.0)
+    radius = (-linearTerm + sqrt(linearTerm * linearTerm + 4.0 * quadraticTerm * k)) / (2.0 * quadraticTerm);
+  else
+    radius = k / linearTerm;
+  return true;
+}
+
 Vec3d PointLight::shadowAttenuation(const ray& r, const Vec3d& p) const
 {
   // YOUR CODE HERE:
@@ -98,31 +100,9 @@ Vec3d PointLight::shadowAttenuation(const ray& r, const Vec3d& p) const
 
   // Lighting model equation: http://www.cs.utexas.edu/~fussell/courses/cs354/assignments/raytracing/equations.pdf
   ray point_to_light(p, getDirection(p), ray::SHADOW);
-  isect intersect_info;
-
-  // Find intersection point
-  bool intersection = scene->intersect(point_to_light, intersect_info);
-  Vec3d q = point_to_light.at(intersect_info.t);
-
-  // Find length between p and q to use for dropoff of shadow color 
-  double distance_pq = (p - q).length();
-  bool before_light = (distance_pq < (position - p).length());
 
-  // See if the ray from the point to the light intersects with any object, if it doesn't then just return the light color
-  if (intersection && before_light)
-  {
-    // Grab transmissive material property
-    Vec3d kt = intersect_info.material->kt(intersect_info);
+  // Only objects between p and the light can cast a shadow on p
+  double distance_to_light = (position - p).length();
 
-    // Compute dropoff coefficient (only useful whenever we have a transparent object and treat q as a new light source)
-    // double attenuation = min(1.0, 1.0 / (constantTerm + (linearTerm * distance_pq) + (quadraticTerm * distance_pq * distance_pq)));
-
-    // We might intersect with another object using the ray from q to the light source
-    Vec3d intensity_at_q = shadowAttenuation(r, q);
-
-    // Return the componenet-wise multiplication of transmissive material property and color at q
-    return prod(intensity_at_q, kt);
-  }
-  else
-    return color;
+  return prod(color, scene->transmittance(point_to_light, distance_to_light));
 }
@@ -19,6 +19,11 @@ public:
 	virtual Vec3d getColor() const = 0;
 	virtual Vec3d getDirection (const Vec3d& P) const = 0;
 
+	// If the light adds less than cutoff to every channel everywhere outside
+	// some sphere, set center and radius to it and return true; false if it
+	// can light things anywhere
+	virtual bool influenceBounds(double cutoff, Vec3d& center, double& radius) const { return false; }
+
 protected:
 	Light(Scene *scene, const Vec3d& col) : SceneElement(scene), color(col) {}
 
@@ -65,6 +70,7 @@ public:
 	virtual double distanceAttenuation(const Vec3d& P) const;
 	virtual Vec3d getColor() const;
 	virtual Vec3d getDirection(const Vec3d& P) const;
+	virtual bool influenceBounds(double cutoff, Vec3d& center, double& radius) const;
 
 	void setAttenuationConstants(float a, float b, float c)
 	{
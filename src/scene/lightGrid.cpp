@@ -0,0 +1,151 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "lightGrid.h"
+#include "light.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// About this many cells per bounded light, with at most MAX_DIM along an axis
+static const int CELLS_PER_LIGHT = 8;
+static const int MAX_DIM = 64;
+
+namespace
+{
+  struct Influence
+  {
+    Light* light;
+    Vec3d center;
+    double radius;
+  };
+}
+
+void LightGrid::build(const vector<Light*>& lights, double cutoff)
+{
+  this->cutoff = cutoff;
+  built = true;
+  unboundedLights.clear();
+  cellStart.clear();
+  cellLights.clear();
+  dims[0] = dims[1] = dims[2] = 0;
+
+  vector<Influence> bounded;
+  Vec3d lo(HUGE_VAL, HUGE_VAL, HUGE_VAL), hi(-HUGE_VAL, -HUGE_VAL, -HUGE_VAL);
+  for (size_t l = 0; l < lights.size(); ++l)
+  {
+    Influence inf;
+    inf.light = lights[l];
+    if (!lights[l]->influenceBounds(cutoff, inf.center, inf.radius))
+    {
+      unboundedLights.push_back(lights[l]);
+      continue;
+    }
+
+    // A light that's too dim to matter anywhere is left out altogether
+    if (inf.radius <= 0.0)
+      continue;
+    bounded.push_back(inf);
+    for (int k = 0; k < 3; ++k)
+    {
+      lo[k] = min(lo[k], inf.center[k] - inf.radius);
+      hi[k] = max(hi[k], inf.center[k] + inf.radius);
+    }
+  }
+  if (bounded.empty())
+    return;
+
+  // Roughly cubic cells, as many as CELLS_PER_LIGHT per light
+  Vec3d extent = hi - lo;
+  double volume = extent[0] * extent[1] * extent[2];
+  double cellSize = cbrt(volume / (double)(bounded.size() * CELLS_PER_LIGHT));
+  gridMin = lo;
+  for (int k = 0; k < 3; ++k)
+  {
+    dims[k] = max(1, min(MAX_DIM, (int)ceil(extent[k] / cellSize)));
+    invCellSize[k] = dims[k] / extent[k];
+  }
+  int cells = dims[0] * dims[1] * dims[2];
+
+  // Two passes over the cells each sphere's box covers: count the lights
+  // per cell, then fill them in after the unbounded lights
+  cellStart.assign(cells + 1, 0);
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    vector<int> fill;
+    if (pass)
+    {
+      for (int c = 0; c < cells; ++c)
+        cellStart[c + 1] += cellStart[c] + (int)unboundedLights.size();
+      cellLights.resize(cellStart[cells]);
+      fill.assign(cellStart.begin(), cellStart.end() - 1);
+      for (int c = 0; c < cells; ++c)
+        for (size_t u = 0; u < unboundedLights.size(); ++u)
+          cellLights[fill[c]++] = unboundedLights[u];
+    }
+
+    for (size_t b = 0; b < bounded.size(); ++b)
+    {
+      const Influence& inf = bounded[b];
+      int c0[3], c1[3];
+      for (int k = 0; k < 3; ++k)
+      {
+        c0[k] = max(0, min(dims[k] - 1, (int)floor((inf.center[k] - inf.radius - gridMin[k]) * invCellSize[k])));
+        c1[k] = max(0, min(dims[k] - 1, (int)floor((inf.center[k] + inf.radius - gridMin[k]) * invCellSize[k])));
+      }
+
+      for (int z = c0[2]; z <= c1[2]; ++z)
+        for (int y = c0[1]; y <= c1[1]; ++y)
+          for (int x = c0[0]; x <= c1[0]; ++x)
+          {
+            // Skip the corner cells of the box that the sphere misses
+            int cell[3] = { x, y, z };
+            double d2 = 0.0;
+            for (int k = 0; k < 3; ++k)
+            {
+              double cmin = gridMin[k] + cell[k] / invCellSize[k];
+              double cmax = gridMin[k] + (cell[k] + 1) / invCellSize[k];
+              double d = max(0.0, max(cmin - inf.center[k], inf.center[k] - cmax));
+              d2 += d * d;
+            }
+            if (d2 > inf.radius * inf.radius)
+              continue;
+
+            int c = (z * dims[1] + y) * dims[0] + x;
+            if (pass)
+              cellLights[fill[c]++] = inf.light;
+            else
+              ++cellStart[c + 1];
+          }
+    }
+  }
+}
+
+void LightGrid::lightsAt(const Vec3d& p, Light* const*& begin, Light* const*& end) const
+{
+  begin = unboundedLights.empty() ? NULL : &unboundedLights[0];
+  end = begin + unboundedLights.size();
+  if (!dims[0])
+    return;
+
+  int cell[3];
+  for (int k = 0; k < 3; ++k)
+  {
+    double f = floor((p[k] - gridMin[k]) * invCellSize[k]);
+    if (!(f >= 0.0 && f < dims[k]))
+      return;
+    cell[k] = (int)f;
+  }
+
+  int c = (cell[2] * dims[1] + cell[1]) * dims[0] + cell[0];
+  if (cellStart[c] == cellStart[c + 1])
+    return;
+  begin = &cellLights[cellStart[c]];
+  end = &cellLights[0] + cellStart[c + 1];
+}
@@ -0,0 +1,58 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// lightGrid.h
+//
+// A uniform grid over the spheres that lights have any visible effect in
+// (see Light::influenceBounds()).  Each cell lists the lights that reach
+// into it, so shading a point only looks at the lights that can matter
+// there instead of at every light in the scene.
+//
+
+#ifndef __LIGHTGRID_H__
+#define __LIGHTGRID_H__
+
+#include <vector>
+
+#include "../vecmath/vec.h"
+
+class Light;
+
+class LightGrid
+{
+public:
+  LightGrid() : built(false), cutoff(0.0) { dims[0] = dims[1] = dims[2] = 0; }
+
+  // Sort lights into cells, leaving out of each cell the lights that add
+  // less than cutoff to every channel everywhere in it
+  void build(const std::vector<Light*>& lights, double cutoff);
+
+  bool isBuilt() const { return built; }
+  double getCutoff() const { return cutoff; }
+
+  // Lights that may add at least the cutoff at p, as [begin, end)
+  void lightsAt(const Vec3d& p, Light* const*& begin, Light* const*& end) const;
+
+private:
+  bool built;
+  double cutoff;
+
+  Vec3d gridMin;
+  Vec3d invCellSize;
+  int dims[3];		// cells along each axis; 0 when no light is bounded
+
+  // Cell c's lights are cellLights[cellStart[c]] to cellLights[cellStart[c + 1]].
+  // Lights without bounds are at the front of every cell's list.
+  std::vector<int> cellStart;
+  std::vector<Light*> cellLights;
+
+  // The lights without bounds, which are all there is outside the grid
+  std::vector<Light*> unboundedLights;
+};
+
+#endif // __LIGHTGRID_H__
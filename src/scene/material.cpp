@@ -8,9 +8,12 @@
 #include "material.h"
 #include "ray.h"
 #include "light.h"
+#include "sampling.h"
 #include "../ui/TraceUI.h"
 extern TraceUI* traceUI;
 
+#include <algorithm>
+
 #include "../fileio/bitmap.h"
 #include "../fileio/pngimage.h"
 
@@ -55,73 +58,261 @@ Vec3d Material::shade(Scene *scene, const ray& r, const isect& i) const
   // Start building color with terms that aren't dependent on lights
   Vec3d color = ke(i) + prod(ka(i), scene->ambient());
 
-  // Loop through lights
-  for (vector<Light*>::const_iterator iter = scene->beginLights(); iter != scene->endLights(); ++iter)
-  {
-    // Grab current light color
-    Vec3d light_color = (*iter)->shadowAttenuation(r, p);
-
-    // Compute dot product between normal and light vector
-    Vec3d L = (*iter)->getDirection(p);
-    double N_dot_L = max(i.N * L, 0.0);
-
-    // Compute reflection of light about normal vector
-    Vec3d nL = -1.0 * L;
-    Vec3d R = (nL - ((2.0 * i.N) * (nL * i.N)));
-    R.normalize();
+  // Only the lights that can reach p by the minimum contribution or more
+  Light* const* begin;
+  Light* const* end;
+  scene->lightsAt(p, begin, end);
 
-    // Compute dot product of reflection and view vector
-    Vec3d V = (scene->getCamera().getEye() - p);
-    V.normalize();
-    double V_dot_R =  max(V * R, 0.0);
+  int samples = traceUI->getLightSamples();
+  if (samples <= 0 || end - begin <= samples)
+  {
+    // Loop through lights
+    for (Light* const* iter = begin; iter != end; ++iter)
+      color += lightContribution(scene, r, i, p, *iter);
+    return color;
+  }
 
-    // Compute diffuse and specular contributions
-    Vec3d diffuse = kd(i) * N_dot_L;
-    Vec3d specular = ks(i) * pow(V_dot_R, shininess(i));
+  // Too many lights to shade with all of them: pick samples of them at
+  // random, each in proportion to how bright it can be at p, and weight
+  // each one picked by one over the chance of picking it
+  static thread_local vector<double> cumulative;
+  cumulative.resize(end - begin);
+  double total = 0.0;
+  for (Light* const* iter = begin; iter != end; ++iter)
+  {
+    Vec3d light_color = (*iter)->getColor();
+    total += max(light_color[0], max(light_color[1], light_color[2])) * (*iter)->distanceAttenuation(p);
+    cumulative[iter - begin] = total;
+  }
+  if (total <= 0.0)
+    return color;
 
-    // Compute final color
-    color += prod(light_color, (diffuse + specular)) * (*iter)->distanceAttenuation(p);
+  for (int s = 0; s < samples; ++s)
+  {
+    int k = upper_bound(cumulative.begin(), cumulative.end(), uniformRandom() * total) - cumulative.begin();
+    k = min(k, (int)cumulative.size() - 1);
+    double chance = (cumulative[k] - (k ? cumulative[k - 1] : 0.0)) / total;
+    color += lightContribution(scene, r, i, p, begin[k]) / (samples * chance);
   }
 
   return color;
 }
 
-TextureMap::TextureMap( string filename ) {
+// What light adds to the color at p, the hit i of r, shadows and distance
+// attenuation included.  A light that neither the diffuse nor the specular
+// term sees, or that's too dim at p to add the minimum contribution, adds
+// nothing and costs no shadow ray.
+Vec3d Material::lightContribution(Scene *scene, const ray& r, const isect& i, const Vec3d& p, const Light* light) const
+{
+  double attenuation = light->distanceAttenuation(p);
+  Vec3d unshadowed = light->getColor();
+  if (max(unshadowed[0], max(unshadowed[1], unshadowed[2])) * attenuation < traceUI->getMinContribution())
+    return Vec3d(0.0, 0.0, 0.0);
+
+  // Compute dot product between normal and light vector
+  Vec3d L = light->getDirection(p);
+  double N_dot_L = max(i.N * L, 0.0);
+
+  // Compute reflection of light about normal vector
+  Vec3d nL = -1.0 * L;
+  Vec3d R = (nL - ((2.0 * i.N) * (nL * i.N)));
+  R.normalize();
+
+  // Compute dot product of reflection and view vector
+  Vec3d V = (scene->getCamera().getEye() - p);
+  V.normalize();
+  double V_dot_R =  max(V * R, 0.0);
+
+  // The specular term is left on for lights behind the surface, where it
+  // gives the inside of glass its highlights
+  if (N_dot_L <= 0.0 && V_dot_R <= 0.0 && shininess(i) > 0.0)
+    return Vec3d(0.0, 0.0, 0.0);
+
+  // Grab current light color
+  Vec3d light_color = light->shadowAttenuation(r, p);
+  if (light_color.iszero())
+    return light_color;
+
+  // Compute diffuse and specular contributions
+  Vec3d diffuse = kd(i) * N_dot_L;
+  Vec3d specular = ks(i) * pow(V_dot_R, shininess(i));
+
+  // Compute final color
+  return prod(light_color, (diffuse + specular)) * attenuation;
+}
+
+TextureMap::TextureMap( string filename )
+	: filename( filename ), width( 0 ), height( 0 ), tileOffset( -1 )
+{
+	// Make sure the cache outlives every map, which forget() themselves in it
+	TextureCache::global();
 
 	int start = (int) filename.find_last_of('.');
 	int end = (int) filename.size() - 1;
-	if (start >= 0 && start < end) {
-		string ext = filename.substr(start, end);
-		if (!ext.compare(".png")) {
-			png_cleanup(1);
-			if (!png_init(filename.c_str(), width, height)) {
-				double gamma = 2.2;
-				int channels, rowBytes;
-				unsigned char* indata = png_get_image(gamma, channels, rowBytes);
-				int bufsize = rowBytes * height;
-				data = new unsigned char[bufsize];
-				for (int j = 0; j < height; j++)
-					for (int i = 0; i < rowBytes; i += channels)
-						for (int k = 0; k < channels; k++)
-							*(data + k + i + j * rowBytes) = *(indata + k + i + (height - j - 1) * rowBytes);
-				png_cleanup(1);
-			}
-		}
-		else
-			if (!ext.compare(".bmp")) data = readBMP(filename.c_str(), width, height);
-			else data = NULL;
-	} else data = NULL;
-	if (data == NULL) {
-		width = 0;
-		height = 0;
+	string ext = (start >= 0 && start < end) ? filename.substr(start, end) : string();
+	FILE* f = (!ext.compare(".png") || !ext.compare(".bmp")) ? fopen(filename.c_str(), "rb") : NULL;
+	if (f == NULL) {
 		string error("Unable to load texture map '");
 		error.append(filename);
 		error.append("'.");
 		throw TextureMapException(error);
 	}
+	fclose(f);
+}
+
+TextureMap::~TextureMap()
+{
+	TextureCache::global().forget(this);
+	if (tileOffset >= 0)
+		TextureCache::global().tileFile().release();
+}
+
+// Decode the image, box filter it down to a 1 x 1 texel level and write
+// every level to the cache's tile file.  Only the level being written and
+// the one below it are in memory at once.  Odd sizes are halved rounding
+// up, so the last row or column of the level below lands alone in the
+// last texel of the next one rather than being dropped.  If anything fails
+// the map is left with no levels, which samples as white.
+void TextureMap::decode() const
+{
+	int start = (int) filename.find_last_of('.');
+	int end = (int) filename.size() - 1;
+	string ext = filename.substr(start, end);
+	unsigned char* data = !ext.compare(".png") ? readPNG(filename.c_str(), width, height)
+		: readBMP(filename.c_str(), width, height);
+	if (data == NULL || width <= 0 || height <= 0) {
+		delete[] data;
+		width = 0;
+		height = 0;
+		return;
+	}
+
+	// Lay out the levels first so the map's whole range of the tile file
+	// can be reserved at once
+	int tiles = 0;
+	for (int w = width, h = height; ; w = (w + 1) / 2, h = (h + 1) / 2)
+	{
+		MipLevel level;
+		level.width = w;
+		level.height = h;
+		level.tilesX = (w + TILE - 1) / TILE;
+		level.firstTile = tiles;
+		levels.push_back(level);
+		tiles += level.tilesX * ((h + TILE - 1) / TILE);
+		if (w == 1 && h == 1)
+			break;
+	}
+	TileFile& file = TextureCache::global().tileFile();
+	tileOffset = file.reserve((size_t)tiles * TILE * TILE * 3 * sizeof(float));
+	if (tileOffset < 0) {
+		delete[] data;
+		levels.clear();
+		return;
+	}
+
+	std::vector<float> below;
+	bool written = true;
+	for (size_t l = 0; l < levels.size() && written; ++l)
+	{
+		const MipLevel& level = levels[l];
+		const MipLevel* prev = l == 0 ? NULL : &levels[l - 1];
+		int w = level.width;
+		int h = level.height;
+
+		std::vector<float> texels(3 * w * h);
+		for (int y = 0; y < h; ++y)
+		{
+			for (int x = 0; x < w; ++x)
+			{
+				float* texel = &texels[3 * (x + y * w)];
+				if (!prev)
+				{
+					const unsigned char* pixel = data + (x + y * w) * 3;
+					for (int c = 0; c < 3; ++c)
+						texel[c] = pixel[c] / 255.0f;
+					continue;
+				}
+
+				int x0 = 2 * x, x1 = min(2 * x + 1, prev->width - 1);
+				int y0 = 2 * y, y1 = min(2 * y + 1, prev->height - 1);
+				for (int c = 0; c < 3; ++c)
+					texel[c] = 0.25f * (below[3 * (x0 + y0 * prev->width) + c] + below[3 * (x1 + y0 * prev->width) + c]
+						+ below[3 * (x0 + y1 * prev->width) + c] + below[3 * (x1 + y1 * prev->width) + c]);
+			}
+		}
+		if (!prev)
+		{
+			delete[] data;
+			data = NULL;
+		}
+
+		written = writeLevel(level, texels);
+		below.swap(texels);
+	}
+
+	if (written)
+		setTileCount(tiles);
+	else
+		levels.clear();
+}
+
+// Write level's texels to the map's range of the tile file a tile at a
+// time, padding the tiles on its right and bottom edges
+bool TextureMap::writeLevel( const MipLevel& level, const std::vector<float>& texels ) const
+{
+	TileFile& file = TextureCache::global().tileFile();
+	std::vector<float> tile(TILE * TILE * 3);
+	size_t size = tile.size() * sizeof(float);
+	int tilesY = (level.height + TILE - 1) / TILE;
+	for (int ty = 0; ty < tilesY; ++ty)
+	{
+		for (int tx = 0; tx < level.tilesX; ++tx)
+		{
+			std::fill(tile.begin(), tile.end(), 0.0f);
+			for (int y = 0; y < TILE && ty * TILE + y < level.height; ++y)
+			{
+				int x0 = tx * TILE;
+				int count = min((int)TILE, level.width - x0);
+				const float* row = &texels[3 * (x0 + (ty * TILE + y) * level.width)];
+				std::copy(row, row + 3 * count, &tile[3 * y * TILE]);
+			}
+			long long index = level.firstTile + ty * level.tilesX + tx;
+			if (!file.write(tileOffset + index * size, &tile[0], size))
+				return false;
+		}
+	}
+	return true;
+}
+
+TextureCache::Tile TextureMap::loadTile( int tile ) const
+{
+	std::shared_ptr<std::vector<float> > texels(new std::vector<float>(TILE * TILE * 3));
+	size_t size = texels->size() * sizeof(float);
+	if (!TextureCache::global().tileFile().read(tileOffset + (long long)tile * size, &(*texels)[0], size))
+		return TextureCache::Tile();
+	return texels;
+}
+
+Vec3d TextureMap::texel( int l, int x, int y, TextureCache::Tile& tile, int& tileIndex ) const
+{
+	int index = levels[l].firstTile + (y / TILE) * levels[l].tilesX + x / TILE;
+	if (!tile || index != tileIndex) {
+		tile = TextureCache::global().get(this, index);
+		tileIndex = index;
+		if (!tile)
+			return Vec3d(1.0, 1.0, 1.0);
+	}
+
+	const float* t = &(*tile)[3 * ((y % TILE) * TILE + x % TILE)];
+	return Vec3d(t[0], t[1], t[2]);
 }
 
 Vec3d TextureMap::getMappedValue( const Vec2d& coord ) const
+{
+  return getMappedValue( coord, 0.0 );
+}
+
+Vec3d TextureMap::getMappedValue( const Vec2d& coord, double footprint ) const
 {
   // YOUR CODE HERE
 
@@ -133,23 +324,57 @@ Vec3d TextureMap::getMappedValue( const Vec2d& coord ) const
   // and use these to perform bilinear interpolation
   // of the values.
 
-  if (0 == data)
+  prepare();
+  if (levels.empty())
       return Vec3d(1.0, 1.0, 1.0);
 
-  int x = (int)(coord[0] * width);
-  int y = (int)(coord[1] * height);
-
-  if(x >= width)
-    x = width - 1;
-  if(y >= height)
-    y = height - 1;
-
-  int pos = (x + (y * width)) * 3;
+  // The mip level whose texels are footprint wide
+  double lod = log2(footprint * max(width, height));
+  if (!(lod > 0.0))
+  {
+    // Magnified (or no footprint at all): the nearest texel
+    int x = (int)(coord[0] * width);
+    int y = (int)(coord[1] * height);
+    x = max(0, min(width - 1, x));
+    y = max(0, min(height - 1, y));
+
+    TextureCache::Tile tile;
+    int tileIndex = -1;
+    return texel(0, x, y, tile, tileIndex);
+  }
 
-  Vec3d color((double)data[pos], (double)data[pos + 1], (double)data[pos + 2]);
-  color /= 255.0;
+  // Minified: blend the two levels on either side of lod
+  int top = (int)levels.size() - 1;
+  if (lod >= top)
+    return bilinear(top, coord);
+  int l = (int)lod;
+  double f = lod - l;
+  return (1.0 - f) * bilinear(l, coord) + f * bilinear(l + 1, coord);
+}
 
-  return color;
+// The four texels of level l around coord, weighted by how close they are
+Vec3d TextureMap::bilinear( int l, const Vec2d& coord ) const
+{
+  const MipLevel& level = levels[l];
+  double x = coord[0] * level.width - 0.5;
+  double y = coord[1] * level.height - 0.5;
+  double fx = floor(x);
+  double fy = floor(y);
+  double wx = x - fx;
+  double wy = y - fy;
+  int x0 = max(0, min(level.width - 1, (int)fx));
+  int x1 = max(0, min(level.width - 1, (int)fx + 1));
+  int y0 = max(0, min(level.height - 1, (int)fy));
+  int y1 = max(0, min(level.height - 1, (int)fy + 1));
+
+  // Mostly all four are in one tile
+  TextureCache::Tile tile;
+  int tileIndex = -1;
+  Vec3d t00 = texel(l, x0, y0, tile, tileIndex);
+  Vec3d t10 = texel(l, x1, y0, tile, tileIndex);
+  Vec3d t01 = texel(l, x0, y1, tile, tileIndex);
+  Vec3d t11 = texel(l, x1, y1, tile, tileIndex);
+  return (1.0 - wy) * ((1.0 - wx) * t00 + wx * t10) + wy * ((1.0 - wx) * t01 + wx * t11);
 }
 
 
@@ -157,7 +382,8 @@ Vec3d TextureMap::getPixelAt( int x, int y ) const
 {
     // This keeps it from crashing if it can't load
     // the texture, but the person tries to render anyway.
-    if (0 == data)
+    prepare();
+    if (levels.empty())
       return Vec3d(1.0, 1.0, 1.0);
 
     if(x >= width )
@@ -165,17 +391,15 @@ Vec3d TextureMap::getPixelAt( int x, int y ) const
     if( y >= height )
        y = height - 1;
 
-    // Find the position in the big data array...
-    int pos = (y * width + x) * 3;
-    return Vec3d(double(data[pos]) / 255.0, 
-       double(data[pos+1]) / 255.0,
-       double(data[pos+2]) / 255.0);
+    TextureCache::Tile tile;
+    int tileIndex = -1;
+    return texel(0, x, y, tile, tileIndex);
 }
 
 Vec3d MaterialParameter::value( const isect& is ) const
 {
     if( 0 != _textureMap )
-        return _textureMap->getMappedValue( is.uvCoordinates );
+        return _textureMap->getMappedValue( is.uvCoordinates, is.uvFootprint );
     else
         return _value;
 }
@@ -184,7 +408,7 @@ double MaterialParameter::intensityValue( const isect& is ) const
 {
     if( 0 != _textureMap )
     {
-        Vec3d value( _textureMap->getMappedValue( is.uvCoordinates ) );
+        Vec3d value( _textureMap->getMappedValue( is.uvCoordinates, is.uvFootprint ) );
         return (0.299 * value[0]) + (0.587 * value[1]) + (0.114 * value[2]);
     }
     else
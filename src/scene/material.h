@@ -10,10 +10,15 @@
 #include "../vecmath/vec.h"
 #include "../vecmath/mat.h"
 #include <string>
+#include <vector>
+#include <mutex>
+
+#include "textureCache.h"
 
 class Scene;
 class ray;
 class isect;
+class Light;
 
 using std::string;
 
@@ -23,9 +28,17 @@ using std::string;
    fill in the getMappedValue function to implement basic 
    texture mapping.
 */
-class TextureMap {
+class TextureMap : public TextureCache::Source {
     public:
+       // Only checks that the file can be read; the image is decoded by
+       // load(), or the first time anything samples it or asks for its size
        TextureMap( string filename );
+       ~TextureMap();
+
+       // Decode the image now if that hasn't been done.  Maps can be
+       // loaded on any number of threads at once.  False if the image
+       // couldn't be read, in which case the map samples as white.
+       bool load() const { prepare(); return !levels.empty(); }
 
        // Return the mapped value; here the coordinate
        // is assumed to be within the parametrization space:
@@ -33,22 +46,56 @@ class TextureMap {
        // (i.e., {(u, v): 0 <= u <= 1 and 0 <= v <= 1}
        Vec3d getMappedValue( const Vec2d& coord ) const;
 
+       // The same averaged over about footprint of the parametrization
+       // space (the width of a ray's cone where it hits), read from the one
+       // or two mip levels with texels closest to that size.  A footprint
+       // no wider than a texel gets the nearest texel, as above.
+       Vec3d getMappedValue( const Vec2d& coord, double footprint ) const;
+
        // Retrieve the value stored in a physical location
        // (with integer coordinates) in the bitmap.
        // Should be called from getMappedValue in order to
        // do bilinear interpolation.
        Vec3d getPixelAt( int x, int y ) const;
 
-     int getWidth() const { return width; }
-     int getHeight() const { return height; }
+     int getWidth() const { prepare(); return width; }
+     int getHeight() const { prepare(); return height; }
+     const string& getFilename() const { return filename; }
 
-    ~TextureMap() { if (data) delete[] data; }
+       // Read one tile back from the tile file, for the texture cache.
+       // Tiles are numbered through the levels from the full size one.
+       virtual TextureCache::Tile loadTile( int tile ) const;
 
 protected:
+       // One level of the mip pyramid.  Texels are converted to float when
+       // the image is decoded and written out to the texture cache's tile
+       // file in TILE x TILE blocks, which the cache loads as they're used.
+       enum { TILE = 32 };
+       struct MipLevel
+       {
+           int width;
+           int height;
+           int tilesX;
+           int firstTile;
+       };
+
+       void prepare() const { std::call_once( prepared, &TextureMap::decode, this ); }
+       void decode() const;
+       bool writeLevel( const MipLevel& level, const std::vector<float>& texels ) const;
+
+       // Texel (x, y) of level l.  tile holds the cache tile it was read
+       // from, numbered tileIndex, and is used again if it has the texel.
+       Vec3d texel( int l, int x, int y, TextureCache::Tile& tile, int& tileIndex ) const;
+       Vec3d bilinear( int l, const Vec2d& coord ) const;
+
        string filename;
-       int width;
-       int height;
-       unsigned char* data;
+
+       // Filled in by decode()
+       mutable std::once_flag prepared;
+       mutable int width;
+       mutable int height;
+       mutable std::vector<MipLevel> levels;	// levels[0] is the full size image
+       mutable long long tileOffset;	// of the map's tiles in the tile file, -1 for none
 };
 
 class TextureMapException {
@@ -177,6 +224,7 @@ public:
           _shininess( Vec3d(sh,sh,sh) ), _index( Vec3d(in,in,in) ) { setBools(); }
 
   virtual Vec3d shade( Scene *scene, const ray& r, const isect& i ) const;
+  Vec3d lightContribution( Scene *scene, const ray& r, const isect& i, const Vec3d& p, const Light* light ) const;
 
 
     
@@ -246,6 +294,10 @@ public:
   bool Spec() const { return _spec; }
   bool Both() const { return _both; }
 
+  // True when nothing can ever pass through this material; a texture mapped
+  // transmissive term may be non-zero somewhere, so it never counts
+  bool Opaque() const { return !_trans && !_kt.mapped(); }
+
 private:
     MaterialParameter _ke;                    // emissive
     MaterialParameter _ka;                    // ambient
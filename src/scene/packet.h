@@ -0,0 +1,274 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// packet.h
+//
+// Ray packets: four rays stored component by component so the box and
+// triangle tests can run on all of them at once.  AVX handles all four
+// lanes in one register, SSE2 in two; without either, plain loops over the
+// lanes are used instead.
+//
+
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PACKET_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PACKET_SSE2
+#endif
+
+#include <cmath>
+
+#include "ray.h"
+#include "bbox.h"
+
+enum { PACKET_SIZE = 4, PACKET_ALL = (1 << PACKET_SIZE) - 1 };
+
+// Four doubles, one per ray in a packet
+struct Double4
+{
+#if defined(PACKET_AVX)
+  __m256d v;
+#elif defined(PACKET_SSE2)
+  __m128d lo, hi;
+#else
+  double v[4];
+#endif
+};
+
+#if defined(PACKET_AVX)
+
+inline Double4 d4(__m256d v) { Double4 r; r.v = v; return r; }
+inline Double4 d4Set(double a) { return d4(_mm256_set1_pd(a)); }
+inline Double4 d4Load(const double* p) { return d4(_mm256_loadu_pd(p)); }
+inline void d4Store(double* p, const Double4& a) { _mm256_storeu_pd(p, a.v); }
+inline Double4 operator+(const Double4& a, const Double4& b) { return d4(_mm256_add_pd(a.v, b.v)); }
+inline Double4 operator-(const Double4& a, const Double4& b) { return d4(_mm256_sub_pd(a.v, b.v)); }
+inline Double4 operator*(const Double4& a, const Double4& b) { return d4(_mm256_mul_pd(a.v, b.v)); }
+inline Double4 operator/(const Double4& a, const Double4& b) { return d4(_mm256_div_pd(a.v, b.v)); }
+inline Double4 d4Abs(const Double4& a) { return d4(_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v)); }
+
+// a < b ? a : b and a > b ? a : b per lane, so b wins whenever either is NaN
+inline Double4 d4Min(const Double4& a, const Double4& b) { return d4(_mm256_min_pd(a.v, b.v)); }
+inline Double4 d4Max(const Double4& a, const Double4& b) { return d4(_mm256_max_pd(a.v, b.v)); }
+
+// Comparisons return a bit per lane (lane 0 in bit 0); NaNs compare false
+inline int d4Less(const Double4& a, const Double4& b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)); }
+inline int d4LessEqual(const Double4& a, const Double4& b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)); }
+inline int d4Equal(const Double4& a, const Double4& b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ)); }
+
+// Lanes whose bit is set in mask come from a, the rest from b
+inline Double4 d4Select(int mask, const Double4& a, const Double4& b)
+{
+  // One all-ones/all-zeros pattern per lane, indexed by the mask
+  static const long long bits[16][4] = {
+    { 0, 0, 0, 0}, {-1, 0, 0, 0}, { 0,-1, 0, 0}, {-1,-1, 0, 0},
+    { 0, 0,-1, 0}, {-1, 0,-1, 0}, { 0,-1,-1, 0}, {-1,-1,-1, 0},
+    { 0, 0, 0,-1}, {-1, 0, 0,-1}, { 0,-1, 0,-1}, {-1,-1, 0,-1},
+    { 0, 0,-1,-1}, {-1, 0,-1,-1}, { 0,-1,-1,-1}, {-1,-1,-1,-1} };
+  __m256d m = _mm256_loadu_pd(reinterpret_cast<const double*>(bits[mask & 15]));
+  return d4(_mm256_blendv_pd(b.v, a.v, m));
+}
+
+#elif defined(PACKET_SSE2)
+
+inline Double4 d4(__m128d lo, __m128d hi) { Double4 r; r.lo = lo; r.hi = hi; return r; }
+inline Double4 d4Set(double a) { return d4(_mm_set1_pd(a), _mm_set1_pd(a)); }
+inline Double4 d4Load(const double* p) { return d4(_mm_loadu_pd(p), _mm_loadu_pd(p + 2)); }
+inline void d4Store(double* p, const Double4& a) { _mm_storeu_pd(p, a.lo); _mm_storeu_pd(p + 2, a.hi); }
+inline Double4 operator+(const Double4& a, const Double4& b) { return d4(_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)); }
+inline Double4 operator-(const Double4& a, const Double4& b) { return d4(_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)); }
+inline Double4 operator*(const Double4& a, const Double4& b) { return d4(_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)); }
+inline Double4 operator/(const Double4& a, const Double4& b) { return d4(_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)); }
+inline Double4 d4Abs(const Double4& a)
+{
+  __m128d sign = _mm_set1_pd(-0.0);
+  return d4(_mm_andnot_pd(sign, a.lo), _mm_andnot_pd(sign, a.hi));
+}
+
+inline Double4 d4Min(const Double4& a, const Double4& b) { return d4(_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)); }
+inline Double4 d4Max(const Double4& a, const Double4& b) { return d4(_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)); }
+
+inline int d4Less(const Double4& a, const Double4& b)
+{ return _mm_movemask_pd(_mm_cmplt_pd(a.lo, b.lo)) | (_mm_movemask_pd(_mm_cmplt_pd(a.hi, b.hi)) << 2); }
+inline int d4LessEqual(const Double4& a, const Double4& b)
+{ return _mm_movemask_pd(_mm_cmple_pd(a.lo, b.lo)) | (_mm_movemask_pd(_mm_cmple_pd(a.hi, b.hi)) << 2); }
+inline int d4Equal(const Double4& a, const Double4& b)
+{ return _mm_movemask_pd(_mm_cmpeq_pd(a.lo, b.lo)) | (_mm_movemask_pd(_mm_cmpeq_pd(a.hi, b.hi)) << 2); }
+
+inline Double4 d4Select(int mask, const Double4& a, const Double4& b)
+{
+  // One all-ones/all-zeros pattern per pair of lanes, indexed by two mask bits
+  static const long long bits[4][2] = { { 0, 0}, {-1, 0}, { 0,-1}, {-1,-1} };
+  __m128d mlo = _mm_loadu_pd(reinterpret_cast<const double*>(bits[mask & 3]));
+  __m128d mhi = _mm_loadu_pd(reinterpret_cast<const double*>(bits[(mask >> 2) & 3]));
+  return d4(_mm_or_pd(_mm_and_pd(mlo, a.lo), _mm_andnot_pd(mlo, b.lo)),
+            _mm_or_pd(_mm_and_pd(mhi, a.hi), _mm_andnot_pd(mhi, b.hi)));
+}
+
+#else
+
+inline Double4 d4Set(double a) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = a; return r; }
+inline Double4 d4Load(const double* p) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = p[k]; return r; }
+inline void d4Store(double* p, const Double4& a) { for (int k = 0; k < 4; ++k) p[k] = a.v[k]; }
+inline Double4 operator+(const Double4& a, const Double4& b) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = a.v[k] + b.v[k]; return r; }
+inline Double4 operator-(const Double4& a, const Double4& b) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = a.v[k] - b.v[k]; return r; }
+inline Double4 operator*(const Double4& a, const Double4& b) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = a.v[k] * b.v[k]; return r; }
+inline Double4 operator/(const Double4& a, const Double4& b) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = a.v[k] / b.v[k]; return r; }
+inline Double4 d4Abs(const Double4& a) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = std::fabs(a.v[k]); return r; }
+inline Double4 d4Min(const Double4& a, const Double4& b) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = a.v[k] < b.v[k] ? a.v[k] : b.v[k]; return r; }
+inline Double4 d4Max(const Double4& a, const Double4& b) { Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = a.v[k] > b.v[k] ? a.v[k] : b.v[k]; return r; }
+
+inline int d4Less(const Double4& a, const Double4& b) { int m = 0; for (int k = 0; k < 4; ++k) if (a.v[k] < b.v[k]) m |= 1 << k; return m; }
+inline int d4LessEqual(const Double4& a, const Double4& b) { int m = 0; for (int k = 0; k < 4; ++k) if (a.v[k] <= b.v[k]) m |= 1 << k; return m; }
+inline int d4Equal(const Double4& a, const Double4& b) { int m = 0; for (int k = 0; k < 4; ++k) if (a.v[k] == b.v[k]) m |= 1 << k; return m; }
+
+inline Double4 d4Select(int mask, const Double4& a, const Double4& b)
+{ Double4 r; for (int k = 0; k < 4; ++k) r.v[k] = (mask & (1 << k)) ? a.v[k] : b.v[k]; return r; }
+
+#endif
+
+// Four rays, stored one component at a time.  Lanes that aren't in use
+// are simply left out of the active masks passed around with the packet.
+struct RayPacket
+{
+  Double4 p[3];
+  Double4 d[3];
+  Double4 invD[3];
+  int dirNeg[3];              // lanes whose direction is negative along each axis
+  ray::RayType type;
+
+  RayPacket() : type(ray::VISIBILITY) {}
+
+  // Load rays[0..count); the remaining lanes repeat the last ray so the math stays finite
+  void set(const ray* rays, int count)
+  {
+    double comp[6][4];
+    for (int k = 0; k < PACKET_SIZE; ++k)
+    {
+      const ray& r = rays[k < count ? k : count - 1];
+      for (int a = 0; a < 3; ++a)
+      {
+        comp[a][k] = r.p[a];
+        comp[3 + a][k] = r.d[a];
+      }
+    }
+    for (int a = 0; a < 3; ++a)
+    {
+      p[a] = d4Load(comp[a]);
+      d[a] = d4Load(comp[3 + a]);
+      invD[a] = d4Set(1.0) / d[a];
+      dirNeg[a] = d4Less(d[a], d4Set(0.0));
+    }
+    type = rays[0].type();
+  }
+
+  ray get(int lane) const
+  {
+    double comp[6][4];
+    for (int a = 0; a < 3; ++a)
+    {
+      d4Store(comp[a], p[a]);
+      d4Store(comp[3 + a], d[a]);
+    }
+    return ray(Vec3d(comp[0][lane], comp[1][lane], comp[2][lane]),
+               Vec3d(comp[3][lane], comp[4][lane], comp[5][lane]), type);
+  }
+};
+
+// How many lanes are set in a mask
+inline int packetLaneCount(int mask)
+{
+  static const int counts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+  return counts[mask & PACKET_ALL];
+}
+
+// The lowest set lane of a non-empty mask; traversal order follows this ray
+inline int packetFirstLane(int mask)
+{
+  int lane = 0;
+  while (!(mask & (1 << lane)))
+    ++lane;
+  return lane;
+}
+
+// Closest hits found so far for each lane of a packet.  Only lanes whose
+// bit is set in mask hold a hit.
+struct PacketHit
+{
+  PacketHit() : mask(0) { t = d4Set(1.0e308); }
+
+  // Record a hit for one lane if it's closer than the one already there
+  bool update(int lane, const isect& cur)
+  {
+    double ts[4];
+    d4Store(ts, t);
+    if ((mask & (1 << lane)) && !(cur.t < ts[lane]))
+      return false;
+    i[lane] = cur;
+    ts[lane] = cur.t;
+    t = d4Load(ts);
+    mask |= 1 << lane;
+    return true;
+  }
+
+  int mask;
+  Double4 t;                  // 1.0e308 in lanes without a hit
+  isect i[PACKET_SIZE];
+};
+
+// Slab test of every lane against a box given by its corners, done the same
+// way as BvhNode::intersect (reciprocal directions, NaN-safe).  Returns the
+// lanes in active that enter the box before tFar, with entry distances in tNear.
+template <class T>
+inline int packetIntersectSlabs(const RayPacket& rp, const T bmin[3], const T bmax[3], int active, const Double4& tFar, Double4& tNear)
+{
+  Double4 t0 = d4Set(-1.0e308);
+  Double4 t1 = tFar;
+  for (int a = 0; a < 3; ++a)
+  {
+    Double4 tA = (d4Set(bmin[a]) - rp.p[a]) * rp.invD[a];
+    Double4 tB = (d4Set(bmax[a]) - rp.p[a]) * rp.invD[a];
+    // Same comparisons as the scalar test: a NaN never tightens the interval
+    Double4 lo = d4Min(tB, tA);
+    Double4 hi = d4Max(tA, tB);
+    t0 = d4Max(lo, t0);
+    t1 = d4Min(hi, t1);
+  }
+  tNear = t0;
+  return active & d4LessEqual(t0, t1) & d4LessEqual(d4Set(RAY_EPSILON), t1);
+}
+
+// Packet version of BoundingBox::intersect; gives the same answer for each
+// lane as the scalar test does for that lane's ray.
+inline int packetIntersectBounds(const RayPacket& rp, const BoundingBox& box, int active, Double4& tNear)
+{
+  const Vec3d& bmin = box.getMin();
+  const Vec3d& bmax = box.getMax();
+  Double4 tMin = d4Set(-1.0e308);
+  Double4 tMax = d4Set(1.0e308);
+  Double4 zero = d4Set(0.0);
+  for (int a = 0; a < 3; ++a)
+  {
+    // Lanes parallel to this pair of planes ignore it
+    int moving = PACKET_ALL & ~d4Equal(rp.d[a], zero);
+    Double4 t1 = (d4Set(bmin[a]) - rp.p[a]) / rp.d[a];
+    Double4 t2 = (d4Set(bmax[a]) - rp.p[a]) / rp.d[a];
+    Double4 lo = d4Min(t2, t1);
+    Double4 hi = d4Max(t1, t2);
+    tMin = d4Select(moving & d4Less(tMin, lo), lo, tMin);
+    tMax = d4Select(moving & d4Less(hi, tMax), hi, tMax);
+  }
+  tNear = tMin;
+  return active & ~d4Less(tMax, tMin) & ~d4Less(tMax, d4Set(RAY_EPSILON));
+}
+
+#endif // __PACKET_H__
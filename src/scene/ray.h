@@ -10,8 +10,11 @@
 // who the hell cares if my identifiers are longer than 255 characters:
 #pragma warning(disable : 4786)
 
+#include <cfloat>
+
 #include "../vecmath/vec.h"
 #include "../vecmath/mat.h"
+#include "../vecmath/real.h"
 #include "material.h"
 #include "../ui/TraceUI.h"
 
@@ -31,12 +34,14 @@ public:
 	};
 
         ray(const Vec3d &pp, const Vec3d &dd, RayType tt = VISIBILITY)
-	  : p(pp), d(dd), t(tt) {}
-        ray(const ray& other) : p(other.p), d(other.d), t(other.t) {}
+	  : p(pp), d(dd), t(tt), coneWidth(0.0), coneSpread(0.0) {}
+        ray(const ray& other) : p(other.p), d(other.d), t(other.t),
+	  coneWidth(other.coneWidth), coneSpread(other.coneSpread) {}
 	~ray() {}
 
 	ray& operator =( const ray& other ) 
-	{ p = other.p; d = other.d; t = other.t; return *this; }
+	{ p = other.p; d = other.d; t = other.t;
+	  coneWidth = other.coneWidth; coneSpread = other.coneSpread; return *this; }
 
 	Vec3d at( double t ) const
 	{ return p + (t*d); }
@@ -45,10 +50,17 @@ public:
 	Vec3d getDirection() const { return d; }
 	RayType type() const { return t; }
 
+	// The ray's differential, simplified to a cone: how wide the bundle of
+	// rays one pixel stands for is at the origin, and how much wider it gets
+	// per unit travelled.  Both are zero for rays that don't track one.
+	void setCone(double width, double spread) { coneWidth = width; coneSpread = spread; }
+
 public:
 	Vec3d p;
 	Vec3d d;
 	RayType t;
+	double coneWidth;
+	double coneSpread;
 };
 
 // The description of an intersection point.
@@ -56,60 +68,50 @@ public:
 class isect
 {
 public:
-    isect() : obj( NULL ), t( 0.0 ), N(), material(0) {}
-	isect(const isect& other)
-	{
-		obj = other.obj;
-		t = other.t;
-		N = other.N;
-		bary = other.bary;
-		uvCoordinates = other.uvCoordinates;
-		if (other.material) material = new Material(*other.material);
-		else material = 0;
-	}
-
-	~isect() { delete material; }
-    
-    isect& operator = (const isect& other) {
-        if( this != &other ) {
-            obj = other.obj;
-            t = other.t;
-            N = other.N;
-			bary = other.bary;
-            uvCoordinates = other.uvCoordinates;
-			if( other.material ) {
-                if( material ) *material = *other.material;
-                else material = new Material(*other.material );
-            }
-            else {
-                delete material;
-                material = 0;
-            }
-        }
-        return *this;
-    }
+    isect() : obj( NULL ), face( -1 ), t( 0.0 ), N(), uvFootprint( 0.0 ), material(0) {}
 
     void setObject(const SceneObject *o) { obj = o; }
     void setT(double tt) { t = tt; }
     void setN(const Vec3d& n) { N = n; }
-    void setMaterial(const Material& m)  { if(material) *material = m; else material = new Material(m); }
+    void setMaterial(const Material& m)  { material = &m; }
     void setUVCoordinates( const Vec2d& coords ) { uvCoordinates = coords; }
     void setBary(const Vec3d& weights) { bary = weights; }
     void setBary(const double alpha, const double beta, const double gamma)
 		{ bary[0] = alpha; bary[1] = beta; bary[2] = gamma; }
     const Material &getMaterial() const;
 
+    // Objects with per-vertex materials only blend them once we know which
+    // hit is the closest one.  Call this on that hit; if the object blends a
+    // material it is written to storage, which must outlive this isect's use.
+    void resolveMaterial(Material& storage);
+
 public:
     const SceneObject *obj;
+    int face;                   // which face of a trimesh was hit; -1 for other objects
     double t;
     Vec3d N;
     Vec2d uvCoordinates;
+    double uvFootprint;         // width of the ray's cone in uv units at the
+                                // hit, for filtering textures; 0 for none
     Vec3d bary;
-    Material *material;         // if this intersection has its own material
-                                // (as opposed to one in its associated object)
-                                // as in the case where the material was interpolated
+    const Material *material;   // material at the hit; not owned, it lives in
+                                // the object or in the storage given to
+                                // resolveMaterial() for interpolated materials
 };
 
 const double RAY_EPSILON = 0.0000000000075; // Apparently this has to be adjusted
 
+// How close to a ray's origin a hit can be and still be taken for the
+// surface the ray just left, for a surface computed in T arithmetic or
+// stored in T, about scale from the ray's origin.  In double that's
+// RAY_EPSILON; single precision only places things to within a few ulps of
+// their size, so there the cutoff grows with it.
+template <class T>
+inline double surfaceEpsilon(double scale)
+{
+  if (sizeof(T) < sizeof(double))
+    return RAY_EPSILON + 4096.0 * FLT_EPSILON * scale;
+  return RAY_EPSILON;
+}
+
 #endif // __RAY_H__
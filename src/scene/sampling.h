@@ -0,0 +1,45 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// sampling.h
+//
+// Random numbers for the parts of the tracer that sample instead of
+// computing everything: Russian roulette and stochastic light selection.
+//
+
+#ifndef __SAMPLING_H__
+#define __SAMPLING_H__
+
+#include <atomic>
+
+// A different nonzero seed each time it's called, so no two threads'
+// generators run through the same sequence
+inline unsigned nextRandomSeed()
+{
+  static std::atomic<unsigned> seeds(0);
+  unsigned h = ++seeds * 0x9e3779b9u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h ? h : 0x9e3779b9u;
+}
+
+// Uniform in [0, 1), from an xorshift generator of each thread's own so the
+// render threads never contend for it
+inline double uniformRandom()
+{
+  static thread_local unsigned state = nextRandomSeed();
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state >> 8) * (1.0 / 16777216.0);
+}
+
+#endif // __SAMPLING_H__
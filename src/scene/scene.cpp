@@ -10,20 +10,35 @@
 #include "../ui/TraceUI.h"
 
 #include <vector>
+#include <algorithm>
 #include <stack>
 
 using namespace std;
 
 extern TraceUI* traceUI;
 
+double Geometry::uvPerWorldUnit(const ray& r, const isect& i) const {
+	if (transform->getKind() == TransformNode::IDENTITY) return uvPerUnit(i);
+	Vec3d pos, dir;
+	double length;
+	transform->globalToLocalRay(r.p, r.d, pos, dir, length);
+	return length * uvPerUnit(i);
+}
+
 bool Geometry::intersect(ray& r, isect& i) const {
 	double tmin, tmax;
 	if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tmax))) return false;
+	// Objects placed without a transform see the world-space ray as it is
+	if (transform->getKind() == TransformNode::IDENTITY)
+	{
+		if (!intersectLocal(r, i)) return false;
+		i.N.normalize();
+		return true;
+	}
 	// Transform the ray into the object's local coordinate space
-	Vec3d pos = transform->globalToLocalCoords(r.p);
-	Vec3d dir = transform->globalToLocalCoords(r.p + r.d) - pos;
-	double length = dir.length();
-	dir /= length;
+	Vec3d pos, dir;
+	double length;
+	transform->globalToLocalRay(r.p, r.d, pos, dir, length);
 	Vec3d Wpos = r.p;
 	Vec3d Wdir = r.d;
 	r.p = pos;
@@ -41,6 +56,81 @@ bool Geometry::intersect(ray& r, isect& i) const {
 	return rtrn;
 }
 
+void Geometry::intersectPacket(const RayPacket& rp, int active, PacketHit& hit) const {
+	if (hasBoundingBoxCapability()) {
+		Double4 tmin;
+		active = packetIntersectBounds(rp, bounds, active, tmin);
+		if (!active) return;
+	}
+
+	PacketHit localHit;
+	double length[PACKET_SIZE] = { 1.0, 1.0, 1.0, 1.0 };
+	if (transform->getKind() == TransformNode::IDENTITY)
+		intersectLocalPacket(rp, active, localHit);
+	else if (transform->getKind() != TransformNode::AFFINE) {
+		// Every lane is moved and scaled alike
+		RayPacket localPacket = rp;
+		double scale = transform->globalToLocalPacket(localPacket);
+		for (int k = 0; k < PACKET_SIZE; ++k)
+			length[k] = scale;
+		intersectLocalPacket(localPacket, active, localHit);
+	}
+	else {
+		// Each ray is stretched by a different amount going into local space, so
+		// transform them one at a time
+		ray local[PACKET_SIZE] = { rp.get(0), rp.get(1), rp.get(2), rp.get(3) };
+		for (int k = 0; k < PACKET_SIZE; ++k) {
+			Vec3d pos, dir;
+			transform->globalToLocalRay(local[k].p, local[k].d, pos, dir, length[k]);
+			local[k].p = pos;
+			local[k].d = dir;
+		}
+		RayPacket localPacket;
+		localPacket.set(local, PACKET_SIZE);
+		intersectLocalPacket(localPacket, active, localHit);
+	}
+
+	for (int k = 0; k < PACKET_SIZE; ++k) {
+		if (!(localHit.mask & (1 << k))) continue;
+		// Transform the intersection point & normal returned back into global space.
+		isect& i = localHit.i[k];
+		i.N = transform->localToGlobalCoordsNormal(i.N);
+		i.t /= length[k];
+		hit.update(k, i);
+	}
+}
+
+void Geometry::intersectLocalPacket(const RayPacket& rp, int active, PacketHit& hit) const {
+	for (int k = 0; k < PACKET_SIZE; ++k) {
+		if (!(active & (1 << k))) continue;
+		ray r = rp.get(k);
+		isect cur;
+		if (intersectLocal(r, cur))
+			hit.update(k, cur);
+	}
+}
+
+bool Geometry::occludes(ray& r, double tmax) const {
+	if (!opaque()) return false;
+	double tmin, tboxmax;
+	if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tboxmax) && tmin < tmax)) return false;
+	if (transform->getKind() == TransformNode::IDENTITY)
+		return occludesLocal(r, tmax);
+	// Transform the ray into the object's local coordinate space
+	Vec3d pos, dir;
+	double length;
+	transform->globalToLocalRay(r.p, r.d, pos, dir, length);
+	Vec3d Wpos = r.p;
+	Vec3d Wdir = r.d;
+	r.p = pos;
+	r.d = dir;
+	// Local distances are stretched by the same factor intersect() divides out
+	bool rtrn = occludesLocal(r, tmax * length);
+	r.p = Wpos;
+	r.d = Wdir;
+	return rtrn;
+}
+
 bool Geometry::hasBoundingBoxCapability() const {
 	// by default, primitives do not have to specify a bounding box.
 	// If this method returns true for a primitive, then either the ComputeBoundingBox() or
@@ -60,6 +150,8 @@ Scene::~Scene() {
 
     if (kdtree)
     	delete kdtree;
+    if (bvh)
+    	delete bvh;
 
     for( g = objects.begin(); g != objects.end(); ++g ) delete (*g);
     for( l = lights.begin(); l != lights.end(); ++l ) delete (*l);
@@ -70,18 +162,101 @@ void Scene::buildKdTree()
 {
 	if (kdtree)
 		delete kdtree;
+	if (bvh)
+		delete bvh;
+	kdtree = NULL;
+	bvh = NULL;
+
+	// Transforms may have changed since the objects were added
+	updateBounds();
 
 	int num_objects = objects.size();
+	BuildPool pool(traceUI->getThreads());
+
+	// As suggested by Don Fussell, I'm breaking down any trimesh objects I encounter so that I have individual triangles.
+	// Every trimesh gets a tree of its own, and the meshes are built side by side.
+	BuildPool::Group meshes;
+	for (int i = 0; i < num_objects; ++i)
+	{
+		Geometry* obj = objects[i];
+		if (obj->isTrimesh())
+			pool.run(meshes, [obj, &pool] { obj->buildKdTree(&pool); });
+	}
+	pool.wait(meshes);
 
-	// As suggested by Don Fussell, I'm breaking down any trimesh objects I encounter so that I have individual triangles
+	buildSceneTree(&pool);
+
+	allOpaque = true;
 	for (int i = 0; i < num_objects; ++i)
+		allOpaque = allOpaque && objects[i]->opaque();
+}
+
+void Scene::updateBounds()
+{
+	sceneBounds = BoundingBox();
+	for (giter g = objects.begin(); g != objects.end(); ++g)
 	{
-		// If we encounter a trimesh, build a kdtree for it
-		if (objects[i]->isTrimesh())
-			objects[i]->buildKdTree();
+		(*g)->ComputeBoundingBox();
+		sceneBounds.merge((*g)->getBoundingBox());
 	}
+}
 
-	kdtree = new KdTree<Geometry>(objects, 0);
+void Scene::buildSceneTree(BuildPool* pool)
+{
+	if (kdtree)
+		delete kdtree;
+	if (bvh)
+		delete bvh;
+	kdtree = NULL;
+	bvh = NULL;
+
+	if (traceUI->getAccelType() == TraceUI::ACCEL_BVH)
+		bvh = new Bvh<GeometryList>(objectList, pool, traceUI->getCacheDir());
+	else
+		kdtree = new KdTree<GeometryList>(objectList, pool);
+}
+
+// How much worse than when it was built a refitted tree may get before
+// it's cheaper to build it again than to keep tracing through it
+static const double REFIT_REBUILD_RATIO = 1.5;
+
+bool Scene::refitKdTree(bool rebuild)
+{
+	updateBounds();
+
+	if (!kdtree && !bvh)
+	{
+		buildKdTree();
+		return true;
+	}
+
+	if (rebuild)
+	{
+		BuildPool pool(traceUI->getThreads());
+		buildSceneTree(&pool);
+		return true;
+	}
+
+	double cost = bvh ? bvh->refit() : kdtree->refit();
+	double built = bvh ? bvh->builtCost() : kdtree->builtCost();
+	if (cost <= built * REFIT_REBUILD_RATIO)
+		return false;
+
+	// The meshes' trees are unaffected; only the scene's needs building
+	BuildPool pool(traceUI->getThreads());
+	buildSceneTree(&pool);
+	return true;
+}
+
+void Scene::getAccelStats(AccelStats& sceneStats, AccelStats& meshStats) const
+{
+	if (kdtree)
+		kdtree->getStats(sceneStats);
+	if (bvh)
+		bvh->getStats(sceneStats);
+
+	for (cgiter g = objects.begin(); g != objects.end(); ++g)
+		(*g)->getAccelStats(meshStats);
 }
 
 // Get any intersection with an object.  Return information about the 
@@ -89,7 +264,9 @@ void Scene::buildKdTree()
 bool Scene::intersect(ray& r, isect& i) const {
 
 	bool have_one = false;
-	if (kdtree && traceUI->usingKdTree())
+	if (bvh && traceUI->usingKdTree())
+		bvh->intersect(r, i, have_one);
+	else if (kdtree && traceUI->usingKdTree())
 		kdtree->intersect(r, i, have_one); // Pass have_one in by reference
 	else
 	{
@@ -114,6 +291,80 @@ bool Scene::intersect(ray& r, isect& i) const {
 	return have_one;
 }
 
+void Scene::intersectPacket(const RayPacket& rp, int active, PacketHit& hit) const {
+	if (bvh && traceUI->usingKdTree())
+		bvh->intersectPacket(rp, active, hit);
+	else if (kdtree && traceUI->usingKdTree())
+		kdtree->intersectPacket(rp, active, hit);
+	else
+		for (cgiter j = objects.begin(); j != objects.end(); ++j)
+			(*j)->intersectPacket(rp, active, hit);
+}
+
+bool Scene::occluded(ray& r, double tmax) const {
+	if (bvh && traceUI->usingKdTree())
+		return bvh->occluded(r, tmax);
+	else if (kdtree && traceUI->usingKdTree())
+		return kdtree->occluded(r, tmax);
+
+	for (cgiter j = objects.begin(); j != objects.end(); ++j)
+		if ((*j)->occludes(r, tmax))
+			return true;
+	return false;
+}
+
+Vec3d Scene::transmittance(ray& r, double tmax) const {
+	++RayStats::local().rays[r.type()];
+
+	// Any opaque blocker puts the point fully in shadow
+	if (occluded(r, tmax))
+		return Vec3d(0.0, 0.0, 0.0);
+
+	Vec3d atten(1.0, 1.0, 1.0);
+	if (allOpaque)
+		return atten;
+
+	// Whatever is left before tmax lets some light through; step from hit to
+	// hit filtering the light by each surface's transmissive color.  Light
+	// that has to pass through more surfaces than the shadow depth limit
+	// allows, or that's filtered down below the minimum contribution, is
+	// taken to be blocked.
+	int limit = traceUI->getTypeDepth(ray::SHADOW);
+	double cutoff = traceUI->getMinContribution();
+	int surfaces = 0;
+	ray s(r);
+	isect i;
+	Material interpolated;
+	while (intersect(s, i) && i.t < tmax)
+	{
+		if (limit >= 0 && ++surfaces > limit)
+			return Vec3d(0.0, 0.0, 0.0);
+		i.resolveMaterial(interpolated);
+		atten = prod(atten, i.getMaterial().kt(i));
+		if (atten.iszero() || max(atten[0], max(atten[1], atten[2])) < cutoff)
+			return Vec3d(0.0, 0.0, 0.0);
+		s.p = s.at(i.t);
+		tmax -= i.t;
+	}
+	return atten;
+}
+
+void Scene::buildLightGrid(double cutoff) {
+	if (lightGrid.isBuilt() && lightGrid.getCutoff() == cutoff)
+		return;
+	lightGrid.build(lights, cutoff);
+}
+
+void Scene::lightsAt(const Vec3d& p, Light* const*& begin, Light* const*& end) const {
+	if (lightGrid.isBuilt())
+	{
+		lightGrid.lightsAt(p, begin, end);
+		return;
+	}
+	begin = lights.empty() ? NULL : &lights[0];
+	end = begin + lights.size();
+}
+
 TextureMap* Scene::getTexture(string name) {
 	tmap::const_iterator itr = textureCache.find(name);
 	if(itr == textureCache.end()) {
@@ -122,4 +373,25 @@ TextureMap* Scene::getTexture(string name) {
 	} else return (*itr).second;
 }
 
+void Scene::loadTextures() {
+	BuildPool pool(traceUI->getThreads());
+	BuildPool::Group textures;
+	std::vector<char> loaded(textureCache.size());
+	tmap::const_iterator t = textureCache.begin();
+	for (size_t i = 0; i < loaded.size(); ++i, ++t)
+	{
+		const TextureMap* map = t->second;
+		char* ok = &loaded[i];
+		pool.run(textures, [map, ok] { *ok = map->load(); });
+	}
+	pool.wait(textures);
+
+	t = textureCache.begin();
+	for (size_t i = 0; i < loaded.size(); ++i, ++t)
+	{
+		if (!loaded[i])
+			throw TextureMapException("Unable to load texture map '" + t->first + "'.");
+	}
+}
+
 
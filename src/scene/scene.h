@@ -27,6 +27,11 @@
 #include "material.h"
 #include "camera.h"
 #include "bbox.h"
+#include "bvh.h"
+#include "packet.h"
+#include "lightGrid.h"
+#include "../RayStats.h"
+#include "../BuildPool.h"
 
 #include "../vecmath/vec.h"
 #include "../vecmath/mat.h"
@@ -54,13 +59,30 @@ public:
 
 class TransformNode {
 
+ public:
+  // What xform does, worked out whenever it changes so that rays can be
+  // taken into local space with no more arithmetic than that needs.  Only
+  // the upper 3x4 of the matrices is ever used.
+  enum Kind
+  {
+    IDENTITY,
+    TRANSLATION,
+    UNIFORM_SCALE,  // the same scale on every axis, plus a translation
+    AFFINE
+  };
+
 protected:
 
   // information about this node's transformation
+  Mat4d    local;   // relative to the parent
   Mat4d    xform;
   Mat4d    inverse;
   Mat3d    normi;
 
+  Kind     kind;
+  double   invScale;    // for TRANSLATION and UNIFORM_SCALE, local = invScale * world + invOffset
+  Vec3d    invOffset;
+
   // information about parent & children
   TransformNode *parent;
   std::vector<TransformNode*> children;
@@ -73,6 +95,9 @@ protected:
       for(child_iter c = children.begin(); c != children.end(); ++c ) delete (*c);
     }
 
+  child_citer beginChildren() const { return children.begin(); }
+  child_citer endChildren() const { return children.end(); }
+
   TransformNode *createChild(const Mat4d& xform) {
     TransformNode *child = new TransformNode(this, xform);
     children.push_back(child);
@@ -87,12 +112,83 @@ protected:
   Vec4d localToGlobalCoords(const Vec4d &v) { return xform * v; }
 
   Vec3d localToGlobalCoordsNormal(const Vec3d &v) {
-    Vec3d ret = normi * v;
+    Vec3d ret;
+    switch (kind) {
+    case IDENTITY:
+    case TRANSLATION:   ret = v; break;
+    case UNIFORM_SCALE: ret = invScale < 0.0 ? -v : v; break;
+    default:            ret = normi * v; break;
+    }
     ret.normalize();
     return ret;
   }
 
+  // Take the world-space ray (p, d), d a unit vector, into local space: its
+  // origin, its unit direction and the factor distances along it are
+  // stretched by, so that local t = world t * length.
+  void globalToLocalRay(const Vec3d& p, const Vec3d& d, Vec3d& localP, Vec3d& localD, double& length) const {
+    switch (kind) {
+    case IDENTITY:
+      localP = p;
+      localD = d;
+      length = 1.0;
+      break;
+    case TRANSLATION:
+      localP = p + invOffset;
+      localD = d;
+      length = 1.0;
+      break;
+    case UNIFORM_SCALE:
+      localP = invScale * p + invOffset;
+      localD = invScale < 0.0 ? -d : d;
+      length = std::fabs(invScale);
+      break;
+    default: {
+      // The linear part alone takes directions across; no translation to
+      // add to p + d and take off again
+      const double* m = inverse[0];
+      localP = inverse * p;
+      localD = Vec3d(m[0] * d[0] + m[1] * d[1] + m[2] * d[2],
+                     m[4] * d[0] + m[5] * d[1] + m[6] * d[2],
+                     m[8] * d[0] + m[9] * d[1] + m[10] * d[2]);
+      length = localD.length();
+      localD /= length;
+      break;
+    }
+    }
+  }
+
+  // The same for every lane of a packet at once, for any kind but AFFINE
+  // (where each lane is stretched by a different amount); returns length.
+  double globalToLocalPacket(RayPacket& rp) const {
+    if (kind == IDENTITY)
+      return 1.0;
+    Double4 s = d4Set(invScale);
+    for (int a = 0; a < 3; ++a)
+      rp.p[a] = (kind == TRANSLATION ? rp.p[a] : s * rp.p[a]) + d4Set(invOffset[a]);
+    if (invScale < 0.0) {
+      Double4 minus = d4Set(-1.0);
+      for (int a = 0; a < 3; ++a) {
+        rp.d[a] = minus * rp.d[a];
+        rp.invD[a] = minus * rp.invD[a];
+        rp.dirNeg[a] = PACKET_ALL & ~rp.dirNeg[a];
+      }
+    }
+    return std::fabs(invScale);
+  }
+
+  Kind getKind() const { return kind; }
+
   const Mat4d& transform() const		{ return xform; }
+  const Mat4d& localTransform() const	{ return local; }
+
+  // Replace this node's transform relative to its parent, e.g. to animate
+  // it.  This node and everything below it move; the objects' bounds and
+  // the scene's tree catch up in Scene::refitKdTree().
+  void setTransform(const Mat4d& xform) {
+    local = xform;
+    update();
+  }
 
 protected:
   // protected so that users can't directly construct one of these...
@@ -100,10 +196,43 @@ protected:
   // directly create a TransformRoot object.
  TransformNode(TransformNode *parent, const Mat4d& xform ) : children() {
       this->parent = parent;
-      if (parent == NULL) this->xform = xform;
-      else this->xform = parent->xform * xform;  
-      inverse = this->xform.inverse();
-      normi = this->xform.upper33().inverse().transpose();
+      this->local = xform;
+      update();
+    }
+
+  // Recompute the world transform from the parent's, here and below
+  void update() {
+      if (parent == NULL) xform = local;
+      else xform = parent->xform * local;
+      inverse = xform.inverse();
+      normi = xform.upper33().inverse().transpose();
+      classify();
+      for (child_iter c = children.begin(); c != children.end(); ++c) (*c)->update();
+    }
+
+  void classify() {
+      const double* m = xform[0];
+      bool moved = m[3] != 0.0 || m[7] != 0.0 || m[11] != 0.0;
+      bool diagonal = m[1] == 0.0 && m[2] == 0.0 && m[4] == 0.0 && m[6] == 0.0 && m[8] == 0.0 && m[9] == 0.0;
+      bool uniform = diagonal && m[0] == m[5] && m[0] == m[10] && m[0] != 0.0;
+
+      invScale = 1.0;
+      invOffset = Vec3d(inverse[0][3], inverse[1][3], inverse[2][3]);
+      if (uniform && m[0] == 1.0)
+        kind = moved ? TRANSLATION : IDENTITY;
+      else if (uniform)
+      {
+        kind = UNIFORM_SCALE;
+        invScale = 1.0 / m[0];
+      }
+      else
+        kind = AFFINE;
+
+      // Exactly -translation, rather than whatever inverse() came up with
+      if (kind == TRANSLATION)
+        invOffset = Vec3d(-m[3], -m[7], -m[11]);
+      else if (kind == UNIFORM_SCALE)
+        invOffset = Vec3d(-m[3], -m[7], -m[11]) * invScale;
     }
 };
 
@@ -122,10 +251,43 @@ protected:
   // do not call directly - this should only be called by intersect()
   virtual bool intersectLocal(ray& r, isect& i ) const = 0;
 
+  // intersections for a packet of rays in the object's local coordinate space;
+  // the default tests the rays one at a time with intersectLocal()
+  // do not call directly - this should only be called by intersectPacket()
+  virtual void intersectLocalPacket(const RayPacket& rp, int active, PacketHit& hit) const;
+
+  // any-hit test performed in the object's local coordinate space
+  // do not call directly - this should only be called by occludes()
+  virtual bool occludesLocal(ray& r, double tmax) const {
+    isect i;
+    return intersectLocal(r, i) && i.t < tmax;
+  }
+
 public:
   // intersections performed in the global coordinate space.
   bool intersect(ray& r, isect& i) const;
 
+  // intersect() for the rays of rp in active at once; any hit closer than
+  // the one already in hit for that ray replaces it
+  void intersectPacket(const RayPacket& rp, int active, PacketHit& hit) const;
+
+  // Shadow ray query in the global coordinate space: does r hit an opaque
+  // part of this object before tmax?  No isect is filled in and the search
+  // stops at the first hit found.
+  bool occludes(ray& r, double tmax) const;
+
+  // Whether every hit on this object blocks all light.  Objects that may let
+  // light through are left to the closest-hit path.
+  virtual bool opaque() const { return false; }
+
+  // About how far the uv coordinates of hit i move per unit of this object's
+  // local space, for sizing texture filters.  The default takes them to
+  // move one for one.
+  virtual double uvPerUnit(const isect& i) const { return 1.0; }
+
+  // The same per unit of world space along the direction of ray r
+  double uvPerWorldUnit(const ray& r, const isect& i) const;
+
   virtual bool hasBoundingBoxCapability() const;
   const BoundingBox& getBoundingBox() const { return bounds; }
   Vec3d getNormal() { return Vec3d(1.0, 0.0, 0.0); }
@@ -175,9 +337,13 @@ public:
   virtual BoundingBox ComputeLocalBoundingBox() { return BoundingBox(); }
 
   virtual bool isTrimesh() const { return false; }
-  virtual void buildKdTree() {}
+  // Build any acceleration structure of the object's own; big ones may use
+  // the pool's threads
+  virtual void buildKdTree(BuildPool* pool) {}
+  virtual void getAccelStats(AccelStats& stats) const {}
 
   void setTransform(TransformNode *transform) { this->transform = transform; };
+  TransformNode* getTransform() const { return transform; }
     
  Geometry(Scene *scene) : SceneElement( scene ) {}
 
@@ -203,6 +369,10 @@ class SceneObject : public Geometry {
   virtual const Material& getMaterial() const = 0;
   virtual void setMaterial(Material *m) = 0;
 
+  // Objects whose material varies over the surface blend it for hit i into
+  // m and return true; see isect::resolveMaterial()
+  virtual bool interpolateMaterial(const isect& i, Material& m) const { return false; }
+
   void glDraw(int quality, bool actualMaterials, bool actualTextures) const;
 
  protected:
@@ -220,6 +390,8 @@ public:
   virtual const Material& getMaterial() const { return *material; }
   virtual void setMaterial(Material* m)	{ delete material; material = m; }
 
+  virtual bool opaque() const { return material->Opaque(); }
+
 protected:
  MaterialSceneObject(Scene *scene, Material *mat) 
    : SceneObject(scene), material(mat) {}
@@ -227,119 +399,434 @@ protected:
   Material* material;
 };
 
-template <class T>
+// KdTree and Bvh are built over a primitive source rather than a list of
+// objects: anything with primitiveCount(), primitiveBounds(i),
+// intersectLeaf(primitives, count, r, setup, isect, have_one),
+// occludesPrimitive(i, r, setup, tmax) and intersectPrimitivePacket(i, rp,
+// setup, active, hit).  The setup is whatever the source wants worked out
+// once per ray rather than once per primitive; the trees get it from
+// raySetup(r) or packetSetup(rp) before walking the tree.  The trees only
+// keep primitive indices.  Trimesh is the source for its own triangles, and
+// GeometryList adapts the scene's list of objects.
+class GeometryList
+{
+public:
+  GeometryList(const std::vector<Geometry*>& objects) : _objects(&objects) {}
+
+  // Each object does its own per-ray work in its intersect()
+  struct RaySetup {};
+  typedef RaySetup PacketSetup;
+  RaySetup raySetup(const ray&) const { return RaySetup(); }
+  PacketSetup packetSetup(const RayPacket&) const { return PacketSetup(); }
+
+  int primitiveCount() const { return _objects->size(); }
+  const BoundingBox& primitiveBounds(int i) const { return (*_objects)[i]->getBoundingBox(); }
+
+  void intersectLeaf(const int* primitives, int count, ray& r, const RaySetup&, isect& i, bool& have_one) const
+  {
+    isect cur;
+    for (int j = 0; j < count; ++j)
+    {
+      if ((*_objects)[primitives[j]]->intersect(r, cur))
+      {
+        if (!have_one || (cur.t < i.t))
+        {
+          i = cur;
+          have_one = true;
+        }
+      }
+    }
+  }
+
+  bool occludesPrimitive(int i, ray& r, const RaySetup&, double tmax) const { return (*_objects)[i]->occludes(r, tmax); }
+  void intersectPrimitivePacket(int i, const RayPacket& rp, const PacketSetup&, int active, PacketHit& hit) const
+  {
+    (*_objects)[i]->intersectPacket(rp, active, hit);
+  }
+
+private:
+  const std::vector<Geometry*>* _objects;
+};
+
+template <class S>
 class KdTree
 {
 private:
+  enum { MAX_LEAF_SIZE = 20, MAX_DEPTH = 12 };
+
+  // Subtrees with at least this many objects are built as pool tasks, and
+  // object bounds are computed in batches of this size
+  enum { PARALLEL_GRAIN = 4096 };
+
+  const S* _source;
   int _axis;
   double _pivot;
-  KdTree<T> * _left;
-  KdTree<T> * _right;
+  KdTree<S> * _left;
+  KdTree<S> * _right;
   BoundingBox _bounds;
-  std::vector<T*> * _objects;
+  const int * _primitives;       // a leaf's range of the root's object order
+  int _count;
+  std::vector<int> * _order;     // every object index, owned by the root
+  double _builtCost;             // the root's sahCost() when it was built
+
+  // What every node of one build shares
+  struct BuildContext
+  {
+    const S* source;
+    const std::vector<BoundingBox>* bounds;
+    int* order;
+    BuildPool* pool;
+    BuildPool::Group* group;
+  };
 
 public:
-  KdTree(std::vector<T*>& objects, int depth = 0) : _bounds(Vec3d(0, 0, 0), Vec3d(0, 0, 0))
+  // The source must outlive the tree.  Given a pool, large subtrees are
+  // built on its threads.
+  KdTree(const S& source, BuildPool* pool = NULL) : _bounds(Vec3d(0, 0, 0), Vec3d(0, 0, 0))
+  {
+    int num_objects = source.primitiveCount();
+    _order = new std::vector<int>(num_objects);
+    for (int i = 0; i < num_objects; ++i)
+      (*_order)[i] = i;
+
+    std::vector<BoundingBox> bounds(num_objects);
+    std::function<void(int, int)> getBounds = [&](int begin, int end)
+    {
+      for (int i = begin; i < end; ++i)
+        bounds[i] = source.primitiveBounds(i);
+    };
+    if (pool)
+      pool->parallelFor(num_objects, PARALLEL_GRAIN, getBounds);
+    else
+      getBounds(0, num_objects);
+
+    BuildPool::Group group;
+    BuildContext context = { &source, &bounds, num_objects ? &(*_order)[0] : NULL, pool, &group };
+    build(context, 0, num_objects, 0);
+    if (pool)
+      pool->wait(group);
+    _builtCost = sahCost();
+  }
+
+  ~KdTree()
+  {
+    if (_left)
+      delete _left;
+    if (_right)
+      delete _right;
+    if (_order)
+      delete _order;
+  }
+
+  bool isLeaf() const { return (!_left && !_right); }
+  const int * getPrimitives() { return _primitives; }
+  int getPrimitiveCount() { return _count; }
+  double getPivot() { return _pivot; }
+  int getAxis() { return _axis; }
+  KdTree<S> * getLeft() { return _left; }
+  KdTree<S> * getRight() { return _right; }
+
+  // Recompute every node's bounds from the source's current primitive
+  // bounds, keeping the structure, and return the new sahCost().  The split
+  // planes only order the traversal, so the tree stays correct as objects
+  // move; it just gets slower the further they go from where they were
+  // when it was built.
+  double refit()
+  {
+    refitBounds();
+    return sahCost();
+  }
+
+  // Surface area heuristic cost of the tree, relative to the root's box:
+  // the expected node and object tests for a ray through the root
+  double sahCost() const
+  {
+    double root_area = halfArea(_bounds);
+    return root_area > 0.0 ? sahCost(root_area) : 0.0;
+  }
+
+  double builtCost() const { return _builtCost; }
+
+private:
+  void refitBounds()
   {
-    _objects = NULL;
+    if (isLeaf())
+    {
+      if (_count == 0)
+        return;
+      _bounds = _source->primitiveBounds(_primitives[0]);
+      for (int i = 1; i < _count; ++i)
+        _bounds.merge(_source->primitiveBounds(_primitives[i]));
+      return;
+    }
+    _left->refitBounds();
+    _right->refitBounds();
+    _bounds = _left->_bounds;
+    _bounds.merge(_right->_bounds);
+  }
+
+  double sahCost(double root_area) const
+  {
+    double area = halfArea(_bounds) / root_area;
+    if (isLeaf())
+      return area * _count;
+    return area + _left->sahCost(root_area) + _right->sahCost(root_area);
+  }
+
+  static double halfArea(const BoundingBox& b)
+  {
+    Vec3d d = b.getMax() - b.getMin();
+    return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+  }
+
+  KdTree() : _bounds(Vec3d(0, 0, 0), Vec3d(0, 0, 0)), _order(NULL), _builtCost(0.0) {}
+
+  // Build this node over order[start, end).  Objects are partitioned in
+  // place, so each leaf just keeps its range of the order.
+  void build(const BuildContext& context, int start, int end, int depth)
+  {
+    const std::vector<BoundingBox>& bounds = *context.bounds;
+    _source = context.source;
+    _primitives = context.order + start;
+    _count = 0;
     _left = NULL;
     _right = NULL;
     _axis = 0;
     _pivot = 0;
 
-    int num_objects = objects.size();
+    int num_objects = end - start;
 
     // Build bounding box for node
     if (num_objects > 0)
     {
-      _bounds = objects[0]->getBoundingBox();
+      _bounds = bounds[_primitives[0]];
       for (int i = 1; i < num_objects; ++i)
-        _bounds.merge(objects[i]->getBoundingBox());
+        _bounds.merge(bounds[_primitives[i]]);
     }
 
     // Bottom out recursion after a certain amount of objects or a depth has been reached
-    if (num_objects <= 20 || depth >= 12)
+    if (num_objects <= MAX_LEAF_SIZE || depth >= MAX_DEPTH)
     {
-      _objects = new std::vector<T*>(objects);
+      _count = num_objects;
       return;
     }
 
     // Split kd-tree by midpoint of longest axis: https://blog.frogslayer.com/kd-trees-for-faster-ray-tracing-with-triangles/
-    std::vector<T*> left_objects;
-    std::vector<T*> right_objects;
     _axis = _bounds.getLongestAxis();
     _pivot = _bounds.getCenter()[_axis];
 
-    for (int i = 0; i < num_objects; ++i)
+    // Using center points of the partitioning axis to find which nodes objects should be placed in
+    int axis = _axis;
+    double pivot = _pivot;
+    int* first = context.order + start;
+    int* middle = std::partition(first, context.order + end,
+      [&bounds, axis, pivot](int p) { return bounds[p].getCenter()[axis] < pivot; });
+    int mid = start + (int)(middle - first);
+
+    // Every center on one side of the pivot; splitting again would only
+    // repeat this node, so it becomes a leaf
+    if (mid == start || mid == end)
     {
-      // Using center points of the partitioning axis to find which nodes objects should be placed in
-      double center_wrt_axis = objects[i]->getBoundingBox().getCenter()[_axis];
-
-      if (center_wrt_axis >= _pivot)
-        right_objects.push_back(objects[i]);
-      else
-        left_objects.push_back(objects[i]);
+      _count = num_objects;
+      return;
     }
 
-    if (left_objects.empty() && !right_objects.empty()) left_objects = right_objects;
-    if (right_objects.empty() && !left_objects.empty()) right_objects = left_objects;
-
     // Add another depth level
-    _left = new KdTree<T>(left_objects, depth + 1);
-    _right = new KdTree<T>(right_objects, depth + 1);
+    _left = new KdTree<S>();
+    _right = new KdTree<S>();
+    if (context.pool && num_objects >= PARALLEL_GRAIN)
+    {
+      KdTree<S> * right = _right;
+      context.pool->run(*context.group, [context, right, mid, end, depth] { right->build(context, mid, end, depth + 1); });
+    }
+    else
+      _right->build(context, mid, end, depth + 1);
+    _left->build(context, start, mid, depth + 1);
   }
 
-  ~KdTree()
+public:
+
+  void getStats(AccelStats& stats, int depth = 0) const
   {
-    if (_left)
-      delete _left;
-    if (_right)
-      delete _right;
-    if (_objects)
-      delete _objects;
+    stats.nodes++;
+    stats.maxDepth = std::max(stats.maxDepth, depth);
+    if (!_left && !_right)
+    {
+      int num_objects = _count;
+      stats.leaves++;
+      stats.primitiveRefs += num_objects;
+      stats.maxLeafSize = std::max(stats.maxLeafSize, num_objects);
+      if (num_objects == 0)
+        stats.emptyLeaves++;
+      return;
+    }
+    _left->getStats(stats, depth + 1);
+    _right->getStats(stats, depth + 1);
   }
 
-  bool isLeaf() { return (!_left && !_right); }
-  std::vector<T*> * getObjects() { return _objects; }
-  double getPivot() { return _pivot; }
-  int getAxis() { return _axis; }
-  KdTree<T> * getLeft() { return _left; }
-  KdTree<T> * getRight() { return _right; }
-
+  // Find the closest intersection along r.  The tree is walked front to back
+  // with an explicit stack, and subtrees whose boxes start beyond the closest
+  // hit found so far are never entered.
   void intersect(ray& r, isect& i, bool& have_one)
   {
     double tmin;
     double tmax;
 
-    // Do we even hit the nodes bounding box?
-    if (_bounds.intersect(r, tmin, tmax))
+    // Do we even hit the root's bounding box?
+    RayCounts* counts = RayStats::testCounts();
+    if (counts) ++counts->nodeTests;
+    if (!_bounds.intersect(r, tmin, tmax))
+      return;
+    typename S::RaySetup setup = _source->raySetup(r);
+
+    // At most one deferred subtree per level
+    KdTree<S> * stack[MAX_DEPTH + 1];
+    double stack_tmin[MAX_DEPTH + 1];
+    int stack_size = 0;
+    KdTree<S> * node = this;
+
+    for (;;)
     {
-      // Recurse down tree until we hit leaf nodes
-      if (!isLeaf())
+      if (!node->isLeaf())
       {
-        _left->intersect(r, i, have_one);
-        _right->intersect(r, i, have_one);
+        // Visit the child on the near side of the splitting plane first
+        KdTree<S> * near_child = node->_left;
+        KdTree<S> * far_child = node->_right;
+        if (r.d[node->_axis] < 0.0)
+          std::swap(near_child, far_child);
+
+        double near_tmin, far_tmin;
+        if (counts) counts->nodeTests += 2;
+        bool hit_near = near_child->_bounds.intersect(r, near_tmin, tmax) && !(have_one && near_tmin > i.t);
+        bool hit_far = far_child->_bounds.intersect(r, far_tmin, tmax) && !(have_one && far_tmin > i.t);
+
+        // Children's boxes overlap, so the entry distances decide the final order
+        if (hit_near && hit_far)
+        {
+          if (far_tmin < near_tmin)
+          {
+            std::swap(near_child, far_child);
+            std::swap(near_tmin, far_tmin);
+          }
+          stack[stack_size] = far_child;
+          stack_tmin[stack_size] = far_tmin;
+          ++stack_size;
+          node = near_child;
+          continue;
+        }
+        else if (hit_near)
+        {
+          node = near_child;
+          continue;
+        }
+        else if (hit_far)
+        {
+          node = far_child;
+          continue;
+        }
       }
       else
       {
-        // See if we intersect any contained in leaf nodes
-        int num_objects = _objects->size();
-        isect cur;
-        for(int j = 0; j < num_objects; ++j) 
+        // See if we intersect any contained in leaf nodes.  We have to make
+        // sure that we haven't already hit something in another node, which
+        // the source checks against i.
+        if (node->_count > 0)
+          _source->intersectLeaf(node->_primitives, node->_count, r, setup, i, have_one);
+      }
+
+      // Pop the next deferred subtree, dropping any that now lie past the closest hit
+      do
+      {
+        if (stack_size == 0)
+          return;
+        --stack_size;
+        node = stack[stack_size];
+      } while (have_one && stack_tmin[stack_size] > i.t);
+    }
+  }
+
+  // Packet version of intersect() for the rays of rp in active.  A node is
+  // entered when any of those rays hits its box before its closest hit so far.
+  void intersectPacket(const RayPacket& rp, int active, PacketHit& hit)
+  {
+    KdTree<S> * stack[MAX_DEPTH + 1];
+    int stack_mask[MAX_DEPTH + 1];
+    int stack_size = 0;
+    KdTree<S> * node = this;
+    int mask = active;
+    typename S::PacketSetup setup = _source->packetSetup(rp);
+
+    RayCounts* counts = RayStats::testCounts();
+    for (;;)
+    {
+      Double4 tmin;
+      if (counts) counts->nodeTests += packetLaneCount(mask);
+      mask = packetIntersectBounds(rp, node->_bounds, mask, tmin) & ~d4Less(hit.t, tmin);
+      if (mask)
+      {
+        if (!node->isLeaf())
         {
-          if((*_objects)[j]->intersect(r, cur)) 
-          {
-            // We have to make sure that we haven't already hit something in another node
-            if(!have_one || (cur.t < i.t)) 
-            {
-              i = cur;
-              have_one = true;
-            }
-          }
+          // Near child first, as seen by the first ray still in the packet
+          KdTree<S> * near_child = node->_left;
+          KdTree<S> * far_child = node->_right;
+          if (rp.dirNeg[node->_axis] & (1 << packetFirstLane(mask)))
+            std::swap(near_child, far_child);
+
+          stack[stack_size] = far_child;
+          stack_mask[stack_size] = mask;
+          ++stack_size;
+          node = near_child;
+          continue;
         }
+
+        for (int j = 0; j < node->_count; ++j)
+          _source->intersectPrimitivePacket(node->_primitives[j], rp, setup, mask, hit);
       }
+
+      if (stack_size == 0)
+        return;
+      --stack_size;
+      node = stack[stack_size];
+      mask = stack_mask[stack_size];
+    }
+  }
+
+  // Is there any blocking hit along r before tmax?  Order doesn't matter
+  // here, so the first object that reports a hit ends the search.
+  bool occluded(ray& r, double tmax)
+  {
+    double tmin;
+    double tbox;
+    typename S::RaySetup setup = _source->raySetup(r);
+
+    KdTree<S> * stack[MAX_DEPTH + 1];
+    int stack_size = 0;
+    KdTree<S> * node = this;
+
+    RayCounts* counts = RayStats::testCounts();
+    for (;;)
+    {
+      if (counts) ++counts->nodeTests;
+      if (node->_bounds.intersect(r, tmin, tbox) && tmin < tmax)
+      {
+        if (!node->isLeaf())
+        {
+          stack[stack_size++] = node->_right;
+          node = node->_left;
+          continue;
+        }
+
+        for (int j = 0; j < node->_count; ++j)
+        {
+          if (_source->occludesPrimitive(node->_primitives[j], r, setup, tmax))
+            return true;
+        }
+      }
+
+      if (stack_size == 0)
+        return false;
+      node = stack[--stack_size];
     }
-    return;
   }
 };
 
@@ -353,7 +840,7 @@ public:
 
   TransformRoot transformRoot;
 
-  Scene() : transformRoot(), objects(), lights(), kdtree(NULL) {}
+  Scene() : transformRoot(), objects(), lights(), objectList(objects), kdtree(NULL), bvh(NULL), allOpaque(false) {}
   virtual ~Scene();
 
   void add( Geometry* obj ) {
@@ -365,9 +852,28 @@ public:
 
   bool intersect(ray& r, isect& i) const;
 
+  // Closest hits for the rays of rp in active, traced together.  Unlike
+  // intersect() this doesn't record anything for the debugging view.
+  void intersectPacket(const RayPacket& rp, int active, PacketHit& hit) const;
+
+  // Shadow ray queries.  occluded() reports whether an opaque object lies
+  // along r before tmax; transmittance() returns the fraction of light that
+  // makes it through, filtered by any transmissive objects on the way.
+  bool occluded(ray& r, double tmax) const;
+  Vec3d transmittance(ray& r, double tmax) const;
+
   std::vector<Light*>::const_iterator beginLights() const { return lights.begin(); }
   std::vector<Light*>::const_iterator endLights() const { return lights.end(); }
 
+  // Sort the lights into a grid by where they can add at least cutoff to a
+  // channel of a surface's color.  Does nothing if that's already been done
+  // for this cutoff; call it while nothing is being shaded.
+  void buildLightGrid(double cutoff);
+
+  // The lights worth shading p with, as [begin, end): all of them until
+  // buildLightGrid() has been called
+  void lightsAt(const Vec3d& p, Light* const*& begin, Light* const*& end) const;
+
   std::vector<Geometry*>::const_iterator beginObjects() const { return objects.begin(); }
   std::vector<Geometry*>::const_iterator endObjects() const { return objects.end(); }
         
@@ -379,6 +885,10 @@ public:
   // is destroyed.
   TextureMap* getTexture( string name );
 
+  // Decode every texture getTexture() has handed out, side by side on the
+  // UI's thread count.  Throws a TextureMapException if any can't be read.
+  void loadTextures();
+
   // These two functions are for handling ambient light; in the Phong model,
   // the "ambient" light is considered a property of the _scene_ as a whole
   // and hence should be set here.
@@ -389,13 +899,27 @@ public:
 
   const BoundingBox& bounds() const { return sceneBounds; }
 
+  // Builds the acceleration structure selected in the UI (kd-tree or SAH BVH)
+  // for the scene and for every trimesh in it.
   void buildKdTree();
 
+  // Catch up with transforms changed since the last build or refit.  Every
+  // object's world bounds are recomputed and pushed up the scene's existing
+  // tree; only if that leaves the tree much worse than it was when built
+  // (by its SAH cost), or rebuild is set, is the scene's tree built again.
+  // The trimeshes' own trees are in their local space and never need this.
+  // Returns true if the tree was rebuilt.
+  bool refitKdTree(bool rebuild = false);
+
+  // Shape of the scene-level tree and of all the trimesh trees combined
+  void getAccelStats(AccelStats& sceneStats, AccelStats& meshStats) const;
+
  private:
   std::vector<Geometry*> objects;
   std::vector<Geometry*> nonboundedobjects;
   std::vector<Geometry*> boundedobjects;
   std::vector<Light*> lights;
+  LightGrid lightGrid;
   Camera camera;
 
   // This is the total amount of ambient light in the scene
@@ -410,7 +934,15 @@ public:
   // are exempt from this requirement.
   BoundingBox sceneBounds;
   
-  KdTree<Geometry> * kdtree;
+  GeometryList objectList;
+  KdTree<GeometryList> * kdtree;
+  Bvh<GeometryList> * bvh;
+
+  // Set when the tree is built; lets shadow rays skip the transmissive pass
+  bool allOpaque;
+
+  void updateBounds();
+  void buildSceneTree(BuildPool* pool);
 
  public:
   // This is used for debugging purposes only.
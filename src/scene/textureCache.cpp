@@ -0,0 +1,295 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+#include "textureCache.h"
+
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Every thread's count of unlocked hits, kept after the thread exits
+static std::list<long> s_unlockedHits;
+static std::mutex s_unlockedHitsLock;
+
+TileFile::TileFile()
+  : file(NULL), end(0), ranges(0)
+{
+}
+
+TileFile::~TileFile()
+{
+  if (file)
+    fclose(file);
+}
+
+long long TileFile::reserve(size_t size)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (!file)
+    file = tmpfile();
+  if (!file)
+    return -1;
+  if (ranges == 0)
+    end = 0;
+  ++ranges;
+  long long offset = end;
+  end += size;
+  return offset;
+}
+
+void TileFile::release()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  --ranges;
+}
+
+#ifndef _WIN32
+
+// pread() and pwrite() leave the file position alone, so any number of
+// threads can use the file at once
+bool TileFile::write(long long offset, const void* data, size_t size)
+{
+  return pwrite(fileno(file), data, size, (off_t)offset) == (ssize_t)size;
+}
+
+bool TileFile::read(long long offset, void* data, size_t size)
+{
+  return pread(fileno(file), data, size, (off_t)offset) == (ssize_t)size;
+}
+
+#else
+
+bool TileFile::write(long long offset, const void* data, size_t size)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return _fseeki64(file, offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size && fflush(file) == 0;
+}
+
+bool TileFile::read(long long offset, void* data, size_t size)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return _fseeki64(file, offset, SEEK_SET) == 0 && fread(data, 1, size, file) == size;
+}
+
+#endif
+
+TextureCache::Source::~Source()
+{
+  for (int t = 0; t < tileCount; ++t)
+    delete resident[t].load();
+  delete[] resident;
+}
+
+void TextureCache::Source::setTileCount(int count) const
+{
+  resident = new std::atomic<const WeakTile*>[count];
+  for (int t = 0; t < count; ++t)
+    resident[t].store(NULL);
+  tileCount = count;
+}
+
+TextureCache& TextureCache::global()
+{
+  static TextureCache cache;
+  return cache;
+}
+
+TextureCache::TextureCache()
+  : budget(0), bytesHeld(0), peakBytes(0), evicting(false)
+{
+}
+
+TextureCache::~TextureCache()
+{
+  for (size_t r = 0; r < retired.size(); ++r)
+    delete retired[r];
+}
+
+size_t TextureCache::KeyHash::operator()(const Key& k) const
+{
+  uint64_t h = (uint64_t)(uintptr_t)k.source;
+  h ^= (uint64_t)(uint32_t)k.tile;
+  h *= 0x9e3779b97f4a7c15ULL;
+  return (size_t)(h ^ (h >> 29));
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+  budget = bytes;
+  evicting = false;
+  for (int s = 0; s < SHARDS; ++s)
+  {
+    std::lock_guard<std::mutex> guard(shards[s].lock);
+    evict(shards[s]);
+  }
+
+  // Nothing is sampling, so no thread can still be reading these
+  std::lock_guard<std::mutex> guard(retiredLock);
+  for (size_t r = 0; r < retired.size(); ++r)
+    delete retired[r];
+  retired.clear();
+}
+
+long& TextureCache::unlockedHits()
+{
+  static thread_local long* hits = 0;
+  if (!hits)
+  {
+    std::lock_guard<std::mutex> guard(s_unlockedHitsLock);
+    s_unlockedHits.push_back(0);
+    hits = &s_unlockedHits.back();
+  }
+  return *hits;
+}
+
+TextureCache::Tile TextureCache::get(const Source* source, int tile)
+{
+  // Until something has to be evicted the order of the lists doesn't
+  // matter, so a tile that is still held is returned without a lock.  If
+  // another thread drops it meanwhile lock() just comes back empty.
+  if (!evicting.load(std::memory_order_relaxed))
+  {
+    const WeakTile* resident = source->resident[tile].load(std::memory_order_acquire);
+    if (resident)
+    {
+      Tile found = resident->lock();
+      if (found)
+      {
+        ++unlockedHits();
+        return found;
+      }
+    }
+  }
+
+  Key key = { source, tile };
+  Shard& shard = shards[KeyHash()(key) >> 7 & (SHARDS - 1)];
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash>::iterator found = shard.index.find(key);
+    if (found != shard.index.end())
+    {
+      ++shard.hits;
+      shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+      return found->second->tile;
+    }
+    ++shard.misses;
+  }
+
+  // Load without the lock so other lookups in the shard go on meanwhile.
+  // Two threads may load the same tile; the second keeps the first's.
+  Tile loaded = source->loadTile(tile);
+  if (!loaded)
+    return loaded;
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash>::iterator found = shard.index.find(key);
+  if (found != shard.index.end())
+    return found->second->tile;
+
+  Entry entry = { key, loaded };
+  shard.lru.push_front(entry);
+  shard.index[key] = shard.lru.begin();
+  publish(key, loaded);
+  size_t bytes = loaded->size() * sizeof(float);
+  shard.bytes += bytes;
+  size_t held = bytesHeld += bytes;
+  size_t peak = peakBytes;
+  while (held > peak && !peakBytes.compare_exchange_weak(peak, held))
+    ;
+  evict(shard);
+  return loaded;
+}
+
+void TextureCache::publish(const Key& key, const Tile& tile)
+{
+  const WeakTile* old = key.source->resident[key.tile].exchange(new WeakTile(tile), std::memory_order_acq_rel);
+  if (old)
+  {
+    std::lock_guard<std::mutex> guard(retiredLock);
+    retired.push_back(old);
+  }
+}
+
+// Drop least recently used tiles until the shard is within its share of
+// the budget, always keeping the tile just loaded
+void TextureCache::evict(Shard& shard)
+{
+  if (!budget)
+    return;
+  size_t share = budget / SHARDS;
+  while (shard.bytes > share && shard.lru.size() > 1)
+  {
+    Entry& last = shard.lru.back();
+    size_t bytes = last.tile->size() * sizeof(float);
+    shard.bytes -= bytes;
+    bytesHeld -= bytes;
+    ++shard.evictions;
+    evicting = true;
+    shard.index.erase(last.key);
+    shard.lru.pop_back();
+  }
+}
+
+void TextureCache::forget(const Source* source)
+{
+  for (int s = 0; s < SHARDS; ++s)
+  {
+    Shard& shard = shards[s];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    for (std::list<Entry>::iterator e = shard.lru.begin(); e != shard.lru.end(); )
+    {
+      if (e->key.source != source)
+      {
+        ++e;
+        continue;
+      }
+      size_t bytes = e->tile->size() * sizeof(float);
+      shard.bytes -= bytes;
+      bytesHeld -= bytes;
+      shard.index.erase(e->key);
+      e = shard.lru.erase(e);
+    }
+  }
+}
+
+TextureCacheStats TextureCache::stats() const
+{
+  TextureCacheStats total;
+  for (int s = 0; s < SHARDS; ++s)
+  {
+    Shard& shard = shards[s];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    total.hits += shard.hits;
+    total.misses += shard.misses;
+    total.evictions += shard.evictions;
+  }
+  {
+    std::lock_guard<std::mutex> guard(s_unlockedHitsLock);
+    for (std::list<long>::const_iterator h = s_unlockedHits.begin(); h != s_unlockedHits.end(); ++h)
+      total.hits += *h;
+  }
+  total.bytes = bytesHeld;
+  total.peakBytes = peakBytes;
+  return total;
+}
+
+void TextureCache::resetStats()
+{
+  for (int s = 0; s < SHARDS; ++s)
+  {
+    std::lock_guard<std::mutex> guard(shards[s].lock);
+    shards[s].hits = shards[s].misses = shards[s].evictions = 0;
+  }
+  {
+    std::lock_guard<std::mutex> guard(s_unlockedHitsLock);
+    for (std::list<long>::iterator h = s_unlockedHits.begin(); h != s_unlockedHits.end(); ++h)
+      *h = 0;
+  }
+  peakBytes = bytesHeld.load();
+}
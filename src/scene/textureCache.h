@@ -0,0 +1,188 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// textureCache.h
+//
+// The texel tiles of every texture map, held in memory up to a budget.
+// Tiles are loaded the first time something samples them and the least
+// recently used ones are dropped to make room for new ones, so a scene can
+// use more texture data than fits in memory at once.  Lookups are safe from
+// any number of render threads, and until the cache first has to drop a
+// tile they take no locks.
+//
+
+#ifndef __TEXTURECACHE_H__
+#define __TEXTURECACHE_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Counts since the last resetStats()
+struct TextureCacheStats
+{
+  TextureCacheStats() : hits(0), misses(0), evictions(0), bytes(0), peakBytes(0) {}
+
+  long hits;
+  long misses;        // lookups that had to load the tile
+  long evictions;     // tiles dropped to stay under the budget
+  size_t bytes;       // held now
+  size_t peakBytes;   // most held at once
+};
+
+// One temporary file holding the tiles of every texture map, each in a
+// range reserved for it, so any number of maps keeps a single file open.
+// Reads and writes of different ranges can go on at once.
+class TileFile
+{
+public:
+  TileFile();
+  ~TileFile();
+
+  // Start of a new range of size bytes, or -1 if the file can't be made.
+  // Release each range once its map is gone.
+  long long reserve(size_t size);
+  void release();
+
+  bool write(long long offset, const void* data, size_t size);
+  bool read(long long offset, void* data, size_t size);
+
+private:
+  TileFile(const TileFile&);
+  TileFile& operator=(const TileFile&);
+
+  std::mutex lock;    // for reserving; on Windows for every read and write
+  FILE* file;         // made by the first reserve()
+  long long end;      // of the ranges reserved so far
+  int ranges;         // in use; once there are none the file is reused from the start
+};
+
+class TextureCache
+{
+public:
+  // A tile's texels.  Holding on to one keeps it alive even if the cache
+  // drops it in the meantime.
+  typedef std::shared_ptr<const std::vector<float> > Tile;
+  typedef std::weak_ptr<const std::vector<float> > WeakTile;
+
+  // Where the tiles of one texture come from, numbered from 0
+  class Source
+  {
+  public:
+    Source() : resident(NULL), tileCount(0) {}
+    virtual ~Source();
+    virtual Tile loadTile(int tile) const = 0;
+
+  protected:
+    // Call once the number of tiles is known, before any is looked up
+    void setTileCount(int count) const;
+
+  private:
+    friend class TextureCache;
+
+    // A weak reference to each tile the cache has loaded, which lets a
+    // hit find its tile without a lock.  Each one is left alone once it is
+    // published; a tile loaded again gets a new one.
+    mutable std::atomic<const WeakTile*>* resident;
+    mutable int tileCount;
+  };
+
+  // The one cache all texture maps share
+  static TextureCache& global();
+
+  TextureCache();
+  ~TextureCache();
+
+  // Most bytes of tiles to hold, 0 for no limit.  Only change it while
+  // nothing is sampling textures.
+  void setBudget(size_t bytes);
+  size_t getBudget() const { return budget; }
+
+  // Tile of source, loading it on a miss
+  Tile get(const Source* source, int tile);
+
+  // Where sources keep their tiles
+  TileFile& tileFile() { return tiles; }
+
+  // Drop every tile of source, which is going away
+  void forget(const Source* source);
+
+  // Only call these while nothing is sampling textures
+  TextureCacheStats stats() const;
+  void resetStats();
+
+private:
+  TextureCache(const TextureCache&);
+  TextureCache& operator=(const TextureCache&);
+
+  struct Key
+  {
+    const Source* source;
+    int tile;
+
+    bool operator==(const Key& other) const
+    { return source == other.source && tile == other.tile; }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& k) const;
+  };
+
+  struct Entry
+  {
+    Key key;
+    Tile tile;
+  };
+
+  // Tiles are split between shards by key, each with its own lock, least
+  // recently used list and share of the budget, so threads sampling
+  // different tiles seldom wait on each other
+  enum { SHARDS = 16 };
+  struct Shard
+  {
+    Shard() : bytes(0), hits(0), misses(0), evictions(0) {}
+
+    std::mutex lock;
+    std::list<Entry> lru;   // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    size_t bytes;
+    long hits, misses, evictions;
+  };
+
+  void evict(Shard& shard);
+
+  // Point the source's weak reference for a tile just loaded at it
+  void publish(const Key& key, const Tile& tile);
+
+  // Hits found without a lock, counted by each thread in its own counter
+  static long& unlockedHits();
+
+  size_t budget;
+  mutable Shard shards[SHARDS];
+  std::atomic<size_t> bytesHeld;
+  std::atomic<size_t> peakBytes;
+
+  // Set once a tile has been dropped to stay under the budget.  From then
+  // on every hit goes through its shard so it moves up the shard's list.
+  std::atomic<bool> evicting;
+
+  // Weak references replaced by publish().  A thread may still be reading
+  // one, so they are only deleted once nothing samples textures.
+  std::mutex retiredLock;
+  std::vector<const WeakTile*> retired;
+
+  TileFile tiles;
+};
+
+#endif // __TEXTURECACHE_H__
@@ -15,9 +15,14 @@
 #include "../fileio/bitmap.h"
 
 #include "../RayTracer.h"
+#include "../RayStats.h"
+#include "../scene/scene.h"
+#include "../scene/textureCache.h"
 
-#include <thread>
 #include <cmath>
+#include <chrono>
+#include <iomanip>
+#include <vector>
 
 using namespace std;
 
@@ -29,11 +34,56 @@ CommandLineUI::CommandLineUI( int argc, char* const* argv )
 	int i;
 
 	progName=argv[0];
+	compareAccel = false;
+	benchRuns = 0;
+	animateFrames = 0;
+
+	// getopt only knows single letter options, so take out --bench <#> and
+	// --animate <#> first
+	vector<char*> args;
+	for( int a = 0; a < argc; ++a )
+	{
+		if( !strcmp( argv[a], "--bench" ) )
+		{
+			if( a + 1 >= argc || (benchRuns = atoi( argv[a+1] )) < 1 )
+			{
+				std::cerr << "--bench needs a number of runs." << std::endl;
+				usage();
+				exit(1);
+			}
+			++a;
+		}
+		else if( !strcmp( argv[a], "--animate" ) )
+		{
+			if( a + 1 >= argc || (animateFrames = atoi( argv[a+1] )) < 1 )
+			{
+				std::cerr << "--animate needs a number of frames." << std::endl;
+				usage();
+				exit(1);
+			}
+			++a;
+		}
+		else
+			args.push_back( argv[a] );
+	}
+	if( animateFrames && !benchRuns )
+	{
+		std::cerr << "--animate only works with --bench." << std::endl;
+		usage();
+		exit(1);
+	}
+	argc = (int)args.size();
+	args.push_back( NULL );
+	argv = &args[0];
 
-	while( (i = getopt( argc, argv, "tr:w:h:" )) != EOF )
+	while( (i = getopt( argc, argv, "t:r:w:h:a:k:d:n:e:p:l:m:i:b:fcos" )) != EOF )
 	{
 		switch( i )
 		{
+			case 't':
+				m_nThreads = max( 1, atoi( optarg ) );
+				break;
+
 			case 'r':
 				m_nDepth = atoi( optarg );
 				break;
@@ -41,6 +91,100 @@ CommandLineUI::CommandLineUI( int argc, char* const* argv )
 			case 'w':
 				m_nSize = atoi( optarg );
 				break;
+
+			case 'a':
+				if( !strcmp( optarg, "kdtree" ) )
+					m_accelType = ACCEL_KDTREE;
+				else if( !strcmp( optarg, "bvh" ) )
+					m_accelType = ACCEL_BVH;
+				else
+				{
+					std::cerr << "Unknown acceleration structure: '" << optarg << "'." << std::endl;
+					usage();
+					exit(1);
+				}
+				break;
+
+			case 'k':
+				if( !strcmp( optarg, "plane" ) )
+					m_triangleKernel = TRIANGLE_PLANE;
+				else if( !strcmp( optarg, "mt" ) )
+					m_triangleKernel = TRIANGLE_MOLLER;
+				else if( !strcmp( optarg, "watertight" ) )
+					m_triangleKernel = TRIANGLE_WATERTIGHT;
+				else
+				{
+					std::cerr << "Unknown triangle test: '" << optarg << "'." << std::endl;
+					usage();
+					exit(1);
+				}
+				break;
+
+			case 'f':
+				m_floatTriangles = true;
+				break;
+
+			case 'n':
+				m_nAASampleSqrt = max( 1, atoi( optarg ) );
+				break;
+
+			case 'e':
+				m_adaptiveAA = true;
+				m_aaThreshold = atof( optarg );
+				break;
+
+			case 'p':
+				m_nPasses = max( 0, atoi( optarg ) );
+				break;
+
+			case 'l':
+			{
+				// <type>=<#>
+				const char* eq = strchr( optarg, '=' );
+				string type( optarg, eq ? eq - optarg : strlen( optarg ) );
+				int depth = eq ? atoi( eq + 1 ) : -1;
+				if( eq && depth >= 0 && type == "reflection" )
+					m_typeDepth[ray::REFLECTION] = depth;
+				else if( eq && depth >= 0 && type == "refraction" )
+					m_typeDepth[ray::REFRACTION] = depth;
+				else if( eq && depth >= 0 && type == "shadow" )
+					m_typeDepth[ray::SHADOW] = depth;
+				else
+				{
+					std::cerr << "Bad depth limit: '" << optarg << "'." << std::endl;
+					usage();
+					exit(1);
+				}
+				break;
+			}
+
+			case 'm':
+				m_minContribution = max( 0.0, atof( optarg ) );
+				break;
+
+			case 'o':
+				m_russianRoulette = true;
+				break;
+
+			case 'i':
+				m_nLightSamples = max( 0, atoi( optarg ) );
+				break;
+
+			case 'b':
+				m_nTextureCacheMB = max( 0, atoi( optarg ) );
+				break;
+
+			case 'd':
+				m_cacheDir = optarg;
+				break;
+
+			case 'c':
+				compareAccel = true;
+				break;
+
+			case 's':
+				m_usingPackets = false;
+				break;
 			default:
 			// Oops; unknown argument
 			std::cerr << "Invalid argument: '" << i << "'." << std::endl;
@@ -49,87 +193,316 @@ CommandLineUI::CommandLineUI( int argc, char* const* argv )
 		}
 	}
 
-	if( optind >= argc-1 )
+	// Comparing acceleration structures doesn't write an image and benchmarking
+	// only writes one if asked, so the output name is optional for both
+	if( optind >= argc - (compareAccel || benchRuns ? 0 : 1) )
 	{
 		std::cerr << "no input and/or output name." << std::endl;
 		exit(1);
 	}
 
 	rayName = argv[optind];
-	imgName = argv[optind+1];
+	imgName = (optind + 1 < argc) ? argv[optind+1] : NULL;
+}
+
+// Build every acceleration structure for the loaded scene and report how fast
+// primary rays go through each one, along with the shape of the trees.
+void CommandLineUI::compareAccelerators(int width, int height)
+{
+	static const AccelType types[] = { ACCEL_KDTREE, ACCEL_BVH };
+	static const char* names[] = { "kdtree", "bvh" };
+	AccelType selected = m_accelType;
+
+	std::cout << "Primary rays: " << width << "x" << height << " (" << (long)width * height << " rays, 1 thread)" << std::endl;
+	std::cout << std::left << std::setw(8) << "accel" << std::right
+		<< std::setw(10) << "build(s)" << std::setw(14) << "rays/sec"
+		<< std::setw(8) << "tree" << std::setw(10) << "nodes" << std::setw(10) << "leaves"
+		<< std::setw(7) << "depth" << std::setw(10) << "avg leaf" << std::setw(10) << "max leaf"
+		<< std::setw(8) << "empty" << std::endl;
+
+	for (int t = 0; t < 2; ++t)
+	{
+		m_accelType = types[t];
+		double build_time = raytracer->buildAccelerator();
+
+		// Warm up caches with one pass before timing
+		raytracer->castPrimaryRays(width, height);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		raytracer->castPrimaryRays(width, height);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		AccelStats scene_stats, mesh_stats;
+		raytracer->getScene().getAccelStats(scene_stats, mesh_stats);
+
+		const AccelStats* stats[] = { &scene_stats, &mesh_stats };
+		static const char* tree_names[] = { "scene", "meshes" };
+		for (int s = 0; s < 2; ++s)
+		{
+			if (s == 0)
+				std::cout << std::left << std::setw(8) << names[t] << std::right << std::fixed << std::setprecision(3)
+					<< std::setw(10) << build_time << std::setprecision(0) << std::setw(14) << ((long)width * height / seconds);
+			else
+				std::cout << std::setw(32) << "";
+			std::cout << std::setw(8) << tree_names[s] << std::setw(10) << stats[s]->nodes << std::setw(10) << stats[s]->leaves
+				<< std::setw(7) << stats[s]->maxDepth << std::setprecision(2) << std::setw(10) << stats[s]->averageLeafSize()
+				<< std::setw(10) << stats[s]->maxLeafSize << std::setw(8) << stats[s]->emptyLeaves << std::endl;
+		}
+	}
+
+	// Leave the scene with the structure that was asked for
+	m_accelType = selected;
+	raytracer->buildAccelerator();
 }
 
-void traceThreadFunc(const int start_x, const int end_x, const int start_y, const int end_y, RayTracer * raytracer)
+// The transforms --animate moves: the first level of the scene's hierarchy
+// with more than one node in it, so a scene wrapped in one outer transform
+// doesn't just move as a whole
+static void animatedNodes(TransformNode* root, vector<TransformNode*>& nodes)
 {
-	for(int y = start_y; y < end_y; ++y)
-		for(int x = start_x; x < end_x; ++x)
-			raytracer->tracePixel(x, y);
+	while (root->endChildren() - root->beginChildren() == 1)
+		root = *root->beginChildren();
+	nodes.assign(root->beginChildren(), root->endChildren());
 }
 
-int CommandLineUI::run()
+// Put the animated transforms where they are in frame f.  Each swings
+// around a circle of its own, at its own phase and tilt, so the objects
+// pass through each other's space and the boxes of a refitted tree grow
+// and overlap the way they would in a real animation.
+static void placeFrame(const vector<TransformNode*>& nodes, const vector<Mat4d>& rest, double radius, int f, int frames)
 {
-	assert( raytracer != 0 );
-	raytracer->loadScene( rayName );
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		double phase = 2.0 * M_PI * f / frames + n * 2.39996;
+		double tilt = n * 1.1;
+		Mat4d move = Mat4d::createTranslation(radius * cos(phase), radius * sin(phase) * cos(tilt), radius * sin(phase) * sin(tilt));
+		nodes[n]->setTransform(move * rest[n]);
+	}
+}
 
-	if( raytracer->sceneLoaded() )
+// Move the scene's transforms through animateFrames frames twice: once
+// keeping its tree up to date by refitting (rebuilding only when the refit
+// tree has got too bad), and once building the tree from scratch every
+// frame.  Times both, and checks that every primary ray hits at the same
+// distance through the refitted tree as through the rebuilt one.
+void CommandLineUI::benchAnimation(int width, int height, AnimationBench& result)
+{
+	Scene& scene = raytracer->getScene();
+	vector<TransformNode*> nodes;
+	animatedNodes(&scene.transformRoot, nodes);
+	vector<Mat4d> rest;
+	for (size_t n = 0; n < nodes.size(); ++n)
+		rest.push_back(nodes[n]->localTransform());
+
+	const BoundingBox& bounds = scene.bounds();
+	double radius = 0.125 * (bounds.getMax() - bounds.getMin()).length();
+
+	vector< vector<double> > refitDepths(animateFrames);
+	for (int f = 0; f < animateFrames; ++f)
 	{
-		int width = m_nSize;
-		int height = (int)(width / raytracer->aspectRatio() + 0.5);
+		placeFrame(nodes, rest, radius, f + 1, animateFrames);
+		result.refitSeconds += raytracer->refitAccelerator();
+		if (raytracer->lastRefitRebuilt())
+			++result.refitRebuilds;
+		raytracer->castPrimaryRays(width, height, &refitDepths[f]);
+	}
 
-		raytracer->traceSetup( width, height );
+	vector<double> depths;
+	for (int f = 0; f < animateFrames; ++f)
+	{
+		placeFrame(nodes, rest, radius, f + 1, animateFrames);
+		result.rebuildSeconds += raytracer->refitAccelerator(true);
+		raytracer->castPrimaryRays(width, height, &depths);
+		for (size_t p = 0; p < depths.size(); ++p)
+			if (depths[p] != refitDepths[f][p])
+				++result.mismatches;
+		result.checked += (long)depths.size();
+	}
 
-		clock_t start, end;
+	// Put everything back where the scene file had it
+	for (size_t n = 0; n < nodes.size(); ++n)
+		nodes[n]->setTransform(rest[n]);
+	raytracer->refitAccelerator(true);
+}
 
-		// Handle tracing via multiple threads if possible
-		const int num_threads_sqrt = max(m_nMultiThreadSqrt, (int)sqrt(thread::hardware_concurrency()));
+// Write s as a JSON string
+static void writeJSONString(ostream& out, const char* s)
+{
+	out << '"';
+	for (; *s; ++s)
+	{
+		if (*s == '"' || *s == '\\')
+			out << '\\' << *s;
+		else if ((unsigned char)*s < 0x20)
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)*s << std::dec << std::setfill(' ');
+		else
+			out << *s;
+	}
+	out << '"';
+}
 
-		// Do we even want to use multiple threads?
-		if (num_threads_sqrt > 1)
-		{
-			// We need to break up the image into a grid of regions where there are the same number of regions for length and height
-			// Each region is handled by a thread so that each thread has approximately the same amount of work (edge regions may be larger)
-			const int x_thread_sample_inc = width / num_threads_sqrt;
-			const int y_thread_sample_inc = height / num_threads_sqrt;
+// Render the scene benchRuns times with the current settings and print the
+// timings and ray counts as JSON on stdout, so runs of different builds can
+// be compared.  load_time is how long loadScene() took.  The counts come from the last run; every run traces the same
+// rays.
+void CommandLineUI::bench(int width, int height, double load_time)
+{
+	static const char* ray_names[] = { "visibility", "reflection", "refraction", "shadow" };
+	static const char* kernel_names[] = { "plane", "mt", "watertight" };
 
-			vector<thread> trace_threads;
+	double build_time = raytracer->buildAccelerator();
+	raytracer->traceSetup(width, height);
 
-			start = clock();
+	vector<double> times;
+	RayCounts counts;
+	RayStats::countTests(true);
+	for (int run = 0; run < benchRuns; ++run)
+	{
+		RayStats::reset();
+		TextureCache::global().resetStats();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		raytracer->startRender(m_nThreads);
+		raytracer->waitRender();
+		times.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+		counts = RayStats::total();
+	}
+	TextureCacheStats textures = TextureCache::global().stats();
 
-			// Create a thread to handle ray tracing for each region
-			for (int y_thread_sample = 0; y_thread_sample < num_threads_sqrt; ++y_thread_sample)
-			{
-				bool not_last_row = (y_thread_sample != (num_threads_sqrt - 1));
-				int y_thread_sample_start = y_thread_sample * y_thread_sample_inc;
-				int y_thread_sample_end = (not_last_row ? y_thread_sample_start + y_thread_sample_inc : height); // Ensure that the last row region covers all remaining pixels height-wise
+	AnimationBench animation;
+	if (animateFrames)
+		benchAnimation(width, height, animation);
 
-				for (int x_thread_sample = 0; x_thread_sample < num_threads_sqrt; ++x_thread_sample)
-				{
-					bool not_last_column = (x_thread_sample != (num_threads_sqrt - 1));
-					int x_thread_sample_start = x_thread_sample * x_thread_sample_inc;
-					int x_thread_sample_end = (not_last_column ? x_thread_sample_start + x_thread_sample_inc : width); // Ensure that the last column region covers remaining pixels width-wise
+	double min_time = times[0], max_time = times[0], mean_time = 0.0;
+	for (size_t t = 0; t < times.size(); ++t)
+	{
+		min_time = min(min_time, times[t]);
+		max_time = max(max_time, times[t]);
+		mean_time += times[t];
+	}
+	mean_time /= times.size();
+
+	long rays = counts.totalRays();
+	ostream& out = std::cout;
+	out << std::setprecision(6);
+	out << "{" << std::endl;
+	out << "  \"scene\": ";
+	writeJSONString(out, rayName);
+	out << "," << std::endl;
+	out << "  \"width\": " << width << "," << std::endl;
+	out << "  \"height\": " << height << "," << std::endl;
+	out << "  \"threads\": " << m_nThreads << "," << std::endl;
+	out << "  \"depth\": " << m_nDepth << "," << std::endl;
+	out << "  \"accel\": \"" << (m_accelType == ACCEL_BVH ? "bvh" : "kdtree") << "\"," << std::endl;
+	out << "  \"triangle_test\": \"" << kernel_names[m_triangleKernel] << "\"," << std::endl;
+	out << "  \"float_triangles\": " << (m_floatTriangles ? "true" : "false") << "," << std::endl;
+	out << "  \"mesh_precision\": \"" << (sizeof(Real) < sizeof(double) ? "single" : "double") << "\"," << std::endl;
+	out << "  \"packets\": " << (m_usingPackets ? "true" : "false") << "," << std::endl;
+	out << "  \"aa_samples\": " << m_nAASampleSqrt * m_nAASampleSqrt << "," << std::endl;
+	out << "  \"adaptive_aa\": ";
+	if (m_adaptiveAA)
+		out << m_aaThreshold;
+	else
+		out << "false";
+	out << "," << std::endl;
+	out << "  \"progressive_passes\": " << m_nPasses << "," << std::endl;
+	out << "  \"depth_limits\": {";
+	for (int type = ray::REFLECTION; type <= ray::SHADOW; ++type)
+		out << (type == ray::REFLECTION ? " \"" : ", \"") << ray_names[type] << "\": " << m_typeDepth[type];
+	out << " }," << std::endl;
+	out << "  \"min_contribution\": " << m_minContribution << "," << std::endl;
+	out << "  \"russian_roulette\": " << (m_russianRoulette ? "true" : "false") << "," << std::endl;
+	out << "  \"light_samples\": " << m_nLightSamples << "," << std::endl;
+	out << "  \"texture_cache\": { \"budget_mb\": " << m_nTextureCacheMB << ", \"hits\": " << textures.hits
+		<< ", \"misses\": " << textures.misses << ", \"evictions\": " << textures.evictions
+		<< ", \"peak_mb\": " << textures.peakBytes / 1048576.0 << " }," << std::endl;
+	if (animateFrames)
+	{
+		out << "  \"animation\": { \"frames\": " << animateFrames
+			<< ", \"refit_seconds\": " << animation.refitSeconds
+			<< ", \"refit_rebuilds\": " << animation.refitRebuilds
+			<< ", \"rebuild_seconds\": " << animation.rebuildSeconds
+			<< ", \"refit_speedup\": " << (animation.refitSeconds > 0.0 ? animation.rebuildSeconds / animation.refitSeconds : 0.0)
+			<< ", \"rays_checked\": " << animation.checked
+			<< ", \"mismatches\": " << animation.mismatches << " }," << std::endl;
+	}
+	out << "  \"runs\": " << benchRuns << "," << std::endl;
+	out << "  \"load_seconds\": " << load_time << "," << std::endl;
+	out << "  \"build_seconds\": " << build_time << "," << std::endl;
+	out << "  \"render_seconds\": { \"min\": " << min_time << ", \"mean\": " << mean_time
+		<< ", \"max\": " << max_time << ", \"runs\": [";
+	for (size_t t = 0; t < times.size(); ++t)
+		out << (t ? ", " : "") << times[t];
+	out << "] }," << std::endl;
+	out << "  \"rays\": { \"total\": " << rays;
+	for (int type = 0; type < RayCounts::RAY_TYPES; ++type)
+		out << ", \"" << ray_names[type] << "\": " << counts.rays[type];
+	out << " }," << std::endl;
+	out << "  \"rays_per_second\": " << (mean_time > 0.0 ? rays / mean_time : 0.0) << "," << std::endl;
+	out << "  \"node_tests_per_ray\": " << (rays ? (double)counts.nodeTests / rays : 0.0) << "," << std::endl;
+	out << "  \"triangle_tests_per_ray\": " << (rays ? (double)counts.triangleTests / rays : 0.0) << std::endl;
+	out << "}" << std::endl;
+}
 
-					// Run thread given bounds for region
-					trace_threads.push_back(thread(traceThreadFunc, x_thread_sample_start, x_thread_sample_end, y_thread_sample_start, y_thread_sample_end, raytracer));
-				}
-			}
+int CommandLineUI::run()
+{
+	assert( raytracer != 0 );
+	chrono::steady_clock::time_point load_start = chrono::steady_clock::now();
+	raytracer->loadScene( rayName );
+	double load_time = chrono::duration<double>(chrono::steady_clock::now() - load_start).count();
+
+	if( raytracer->sceneLoaded() )
+	{
+		int width = m_nSize;
+		int height = (int)(width / raytracer->aspectRatio() + 0.5);
 
-			// Wait for all threads to finish
-			const int num_threads = num_threads_sqrt * num_threads_sqrt;
-			for (int i = 0; i < num_threads; ++i)
-				trace_threads[i].join();
+		if (!benchRuns)
+			std::cout << "load time = " << load_time << " seconds, acceleration build = " << raytracer->lastBuildTime() << " seconds" << std::endl;
 
-			end = clock();
+		if (compareAccel)
+		{
+			compareAccelerators(width, height);
+			return 0;
 		}
+
+		if (benchRuns)
+			bench(width, height, load_time);
 		else
 		{
-			// Regular single-thread ray tracing
-			start=clock();
+			raytracer->traceSetup( width, height );
 
-			for (int j = 0; j < height; ++j)
-				for (int i = 0; i < width; ++i)
-					raytracer->tracePixel(i, j);
+			// Wall time; clock() would add up the CPU time of every thread
+			RayStats::reset();
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			raytracer->startRender(m_nThreads);
+			if (m_nPasses > 0)
+			{
+				// Write out the image as it stands after every pass, so it can
+				// be looked at long before the last one is done
+				int passesShown = 0;
+				bool done = false;
+				vector<unsigned char> image;
+				while (!done)
+				{
+					done = raytracer->waitRender(0.05);
+					int passes = raytracer->renderPassesDone();
+					if (passes == passesShown)
+						continue;
+					passesShown = passes;
+
+					if (imgName && raytracer->getPassImage(image))
+						writeBMP(imgName, width, height, &image[0]);
+					if (passes == 1)
+						std::cout << "preview";
+					else
+						std::cout << "pass " << passes - 1 << "/" << m_nPasses;
+					std::cout << " at " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " seconds" << std::endl;
+				}
+			}
+			else
+				raytracer->waitRender();
+			double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-			end=clock();
+			std::cout << "total time = " << t << " seconds, rays traced = " << RayStats::total().totalRays() << std::endl;
 		}
 
 		// save image
@@ -137,12 +510,9 @@ int CommandLineUI::run()
 
 		raytracer->getBuffer(buf, width, height);
 
-		if (buf)
+		if (buf && imgName)
 			writeBMP(imgName, width, height, buf);
 
-		double t=(double)(end-start)/CLOCKS_PER_SEC;
-//		int totalRays = TraceUI::resetCount();
-//		std::cout << "total time = " << t << " seconds, rays traced = " << totalRays << std::endl;
         return 0;
 	}
 	else
@@ -160,6 +530,26 @@ void CommandLineUI::alert( const string& msg )
 void CommandLineUI::usage()
 {
 	std::cerr << "usage: " << progName << " [options] [input.ray output.bmp]" << std::endl;
+	std::cerr << "  -t <#>      set number of rendering threads (default " << m_nThreads << ")" << std::endl;
 	std::cerr << "  -r <#>      set recursion level (default " << m_nDepth << ")" << std::endl; 
 	std::cerr << "  -w <#>      set output image width (default " << m_nSize << ")" << std::endl;
+	std::cerr << "  -a <type>   acceleration structure: kdtree or bvh (default " << (m_accelType == ACCEL_BVH ? "bvh" : "kdtree") << ")" << std::endl;
+	std::cerr << "  -k <test>   ray-triangle test: plane, mt or watertight (default "
+		<< (m_triangleKernel == TRIANGLE_PLANE ? "plane" : m_triangleKernel == TRIANGLE_MOLLER ? "mt" : "watertight") << ")" << std::endl;
+	std::cerr << "  -f          run the ray-triangle test in single precision" << std::endl;
+	std::cerr << "  -n <#>      anti-alias with # x # samples per pixel (default " << m_nAASampleSqrt << ")" << std::endl;
+	std::cerr << "  -e <x>      only supersample pixels whose corners differ by more than x (0-1) or see different objects" << std::endl;
+	std::cerr << "  -p <#>      render progressively: a quick preview, then # passes of one jittered sample per pixel" << std::endl;
+	std::cerr << "  -l <type>=<#> allow at most # reflection, refraction or shadow rays per path (shadow: transmissive" << std::endl;
+	std::cerr << "              surfaces a shadow ray passes through); the recursion level still limits the total" << std::endl;
+	std::cerr << "  -m <x>      don't trace rays that would add less than x (0-1) to every channel of a pixel" << std::endl;
+	std::cerr << "  -o          Russian roulette: trace faint rays only some of the time, weighted to make up for it" << std::endl;
+	std::cerr << "  -i <#>      shade with # lights picked at random, by brightness, where more can reach a point" << std::endl;
+	std::cerr << "  -b <MB>     keep at most this many megabytes of texture tiles in memory (default " << m_nTextureCacheMB << ", 0 for no limit)" << std::endl;
+	std::cerr << "  -d <dir>    save built BVHs in dir and reuse them when the same geometry is loaded again" << std::endl;
+	std::cerr << "  -s          trace camera rays one at a time instead of in packets" << std::endl;
+	std::cerr << "  -c          compare acceleration structures on the scene instead of rendering it" << std::endl;
+	std::cerr << "  --bench <#> render the scene # times and print timings and ray counts as JSON" << std::endl;
+	std::cerr << "  --animate <#> with --bench, also move the scene's transforms over # frames and time refitting" << std::endl;
+	std::cerr << "              its tree against rebuilding it, checking the refitted tree's hits against the rebuilt one's" << std::endl;
 }
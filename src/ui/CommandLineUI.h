@@ -31,17 +31,34 @@ class CommandLineUI : public TraceUI {
 
 public:
 	CommandLineUI( int argc, char* const* argv );
-    friend void traceThreadFunc(const int start_x, const int end_x, const int start_y, const int end_y, RayTracer * raytracer);
 	int		run();
 
 	void		alert( const string& msg );
 
 private:
 	void		usage();
+	void		compareAccelerators(int width, int height);
+	void		bench(int width, int height, double load_time);
+
+	// What --animate measured over its frames
+	struct AnimationBench
+	{
+		AnimationBench() : refitSeconds(0.0), rebuildSeconds(0.0), refitRebuilds(0), mismatches(0), checked(0) {}
+
+		double	refitSeconds;	// keeping the scene's tree up to date by refitting it
+		double	rebuildSeconds;	// building it from scratch every frame instead
+		int		refitRebuilds;	// frames where refitting built it again anyway
+		long	mismatches;		// primary rays whose hit differed between the two
+		long	checked;
+	};
+	void		benchAnimation(int width, int height, AnimationBench& result);
 
 	char*	rayName;
 	char*	imgName;
 	char*	progName;
+	bool	compareAccel;	// benchmark the acceleration structures instead of rendering
+	int		benchRuns;		// renders to time with --bench, or 0 to just render once
+	int		animateFrames;	// frames of moving transforms to time with --bench, or 0
 };
 
 #endif
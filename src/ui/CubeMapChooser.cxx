@@ -116,6 +116,7 @@ void CubeMapChooser::cb_ok(Fl_Widget* o, void* v) {
 		cm->setYnegMap(ch->cubeFace[3]);
 		cm->setZposMap(ch->cubeFace[4]);
 		cm->setZnegMap(ch->cubeFace[5]);
+		cm->prefilter();
 		ch->caller->setCubeMap(true);
 		ch->caller->useCubeMap(true);
 		ch->caller->m_filterSlider->activate();
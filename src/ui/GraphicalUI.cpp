@@ -23,8 +23,8 @@
 #include "GraphicalUI.h"
 #include "../RayTracer.h"
 
-#include <thread>
 #include <cmath>
+#include <algorithm>
 
 #define MAX_INTERVAL 500
 
@@ -34,7 +34,6 @@
 #define print sprintf
 #endif
 
-bool GraphicalUI::stopTrace = false;
 bool GraphicalUI::doneTrace = true;
 GraphicalUI* GraphicalUI::pUI = NULL;
 char* GraphicalUI::traceWindowLabel = "Raytraced Image";
@@ -92,6 +91,15 @@ void GraphicalUI::cb_kdCheckButton(Fl_Widget* o, void* v)
 	pUI->m_usingKdTree = ((Fl_Check_Button *)o)->value();
 }
 
+void GraphicalUI::cb_bvhCheckButton(Fl_Widget* o, void* v)
+{
+	pUI = (GraphicalUI*)(o->user_data());
+	pUI->m_accelType = (((Fl_Check_Button *)o)->value() ? ACCEL_BVH : ACCEL_KDTREE);
+
+	// The tree may be in use by a running trace, so it is rebuilt when the next render starts
+	pUI->m_accelDirty = true;
+}
+
 void GraphicalUI::cb_filterWidthSlides(Fl_Widget* o, void* v)
 {
 	((GraphicalUI*)(o->user_data()))->m_nFilterWidth=int( ((Fl_Slider *)o)->value() );
@@ -102,9 +110,44 @@ void GraphicalUI::cb_aaSamplesSlides(Fl_Widget* o, void* v)
 	((GraphicalUI*)(o->user_data()))->m_nAASampleSqrt=int( ((Fl_Slider *)o)->value() );
 }
 
+void GraphicalUI::cb_aaThreshSlides(Fl_Widget* o, void* v)
+{
+	((GraphicalUI*)(o->user_data()))->m_aaThreshold=double( ((Fl_Slider *)o)->value() );
+}
+
+void GraphicalUI::cb_aaCheckButton(Fl_Widget* o, void* v)
+{
+	((GraphicalUI*)(o->user_data()))->m_adaptiveAA = (((Fl_Check_Button*)o)->value() == 1);
+}
+
+void GraphicalUI::cb_passesSlides(Fl_Widget* o, void* v)
+{
+	((GraphicalUI*)(o->user_data()))->m_nPasses=int( ((Fl_Slider *)o)->value() );
+}
+
+void GraphicalUI::cb_contributionSlides(Fl_Widget* o, void* v)
+{
+	((GraphicalUI*)(o->user_data()))->m_minContribution=double( ((Fl_Slider *)o)->value() );
+}
+
+void GraphicalUI::cb_lightSamplesSlides(Fl_Widget* o, void* v)
+{
+	((GraphicalUI*)(o->user_data()))->m_nLightSamples=int( ((Fl_Slider *)o)->value() );
+}
+
+void GraphicalUI::cb_textureCacheSlides(Fl_Widget* o, void* v)
+{
+	((GraphicalUI*)(o->user_data()))->m_nTextureCacheMB=int( ((Fl_Slider *)o)->value() );
+}
+
+void GraphicalUI::cb_rouletteCheckButton(Fl_Widget* o, void* v)
+{
+	((GraphicalUI*)(o->user_data()))->m_russianRoulette = (((Fl_Check_Button*)o)->value() == 1);
+}
+
 void GraphicalUI::cb_multiThreadSlides(Fl_Widget* o, void* v)
 {
-	((GraphicalUI*)(o->user_data()))->m_nMultiThreadSqrt=int( ((Fl_Slider *)o)->value() );
+	((GraphicalUI*)(o->user_data()))->m_nThreads=int( ((Fl_Slider *)o)->value() );
 }
 
 void GraphicalUI::cb_save_image(Fl_Menu_* o, void* v) 
@@ -187,30 +230,26 @@ void GraphicalUI::cb_debuggingDisplayCheckButton(Fl_Widget* o, void* v)
 	  }
 }
 
-void traceThreadFunc(const int start_x, const int end_x, const int start_y, const int end_y, GraphicalUI * pUI)
-{
-	for(int y = start_y; y < end_y; ++y)
-	{
-		for(int x = start_x; x < end_x; ++x)
-		{
-			if (pUI->stopTrace) break;
-
-			pUI->raytracer->tracePixel(x, y);
-			pUI->m_debuggingWindow->m_debuggingView->setDirty();
-		}
-
-		if (pUI->stopTrace) break;
-	}
-}
-
 void GraphicalUI::cb_render(Fl_Widget* o, void* v) {
 
 	char buffer[256];
 
 	pUI = (GraphicalUI*)(o->user_data());
-	doneTrace = stopTrace = false;
+
+	// Render is pressed again while we're still in the refresh loop below
+	if (!doneTrace)
+		return;
+
 	if (pUI->raytracer->sceneLoaded())
 	  {
+		doneTrace = false;
+
+		if (pUI->m_accelDirty)
+		{
+			pUI->raytracer->buildAccelerator();
+			pUI->m_accelDirty = false;
+		}
+
 		int width = pUI->getSize();
 		int height = (int)(width / pUI->raytracer->aspectRatio() + 0.5);
 		int origPixels = width * height;
@@ -225,95 +264,40 @@ void GraphicalUI::cb_render(Fl_Widget* o, void* v) {
 		now = prev = clock();
 		clock_t intervalMS = pUI->refreshInterval * 100;
 
-		// Handle tracing via multiple threads if possible
-		std::vector<std::thread> trace_threads;
-		const int num_threads_sqrt = pUI->m_nMultiThreadSqrt;
-		const int x_thread_sample_inc = width / num_threads_sqrt;
-		const int y_thread_sample_inc = height / num_threads_sqrt;
-
-		// Do we even want to use multiple threads?
-		if (num_threads_sqrt > 1)
+		// The render pool does all of the tracing; this thread just keeps the window
+		// up to date and handles input (e.g. the stop button) until the image is done
+		pUI->raytracer->startRender(pUI->m_nThreads);
+		int passesShown = 0;
+		while (!pUI->raytracer->waitRender(0.05))
 		{
-			// We need to break up the image into a grid of regions where there are the same number of regions for length and height
-			// Each region is handled by a thread so that each thread has approximately the same amount of work (edge regions may be larger)
-
-			// Create a thread to handle ray tracing for each region
-			for (int y_thread_sample = 0; y_thread_sample < num_threads_sqrt; ++y_thread_sample)
+			// check for input and refresh view every so often while tracing,
+			// and right away whenever a progressive pass has been finished
+			now = clock();
+			int passes = pUI->raytracer->renderPassesDone();
+			if ((now - prev)/CLOCKS_PER_SEC * 1000 >= intervalMS || passes != passesShown)
 			{
-				bool not_last_row = (y_thread_sample != (num_threads_sqrt - 1));
-				int y_thread_sample_start = y_thread_sample * y_thread_sample_inc;
-				int y_thread_sample_end = (not_last_row ? y_thread_sample_start + y_thread_sample_inc : height); // Ensure that the last row region covers all remaining pixels height-wise
-
-				for (int x_thread_sample = 0; x_thread_sample < num_threads_sqrt; ++x_thread_sample)
-				{
-					bool not_last_column = (x_thread_sample != (num_threads_sqrt - 1));
-
-					// We want to save the last region for the current thread in order to use refresh intervals without having race conditions
-					if (!not_last_column && !not_last_row)
-						break;
-
-					int x_thread_sample_start = x_thread_sample * x_thread_sample_inc;
-					int x_thread_sample_end = (not_last_column ? x_thread_sample_start + x_thread_sample_inc : width); // Ensure that the last column region covers remaining pixels width-wise
-
-					// Run thread given bounds for region
-					trace_threads.push_back(std::thread(traceThreadFunc, x_thread_sample_start, x_thread_sample_end, y_thread_sample_start, y_thread_sample_end, pUI));
-				}
-			}
-		}
-
-		// Current thread takes care of final region
-		int start_y = (num_threads_sqrt - 1) * y_thread_sample_inc;
-		int start_x = (num_threads_sqrt - 1) * x_thread_sample_inc;
-		for (int y = start_y; y < height; ++y)
-		{
-			for (int x = start_x; x < width; ++x)
-			{
-				if (stopTrace) 
-					break;
-
-				// check for input and refresh view every so often while tracing
-				now = clock();
-				if ((now - prev)/CLOCKS_PER_SEC * 1000 >= intervalMS)
-		  		{
-		    		prev = now;
-				    sprintf(buffer, "(%d%%) %s", (int)((double)y / (double)height * 100.0), old_label);
-				    pUI->m_traceGlWindow->label(buffer);
-				    pUI->m_traceGlWindow->refresh();
-				    Fl::check();
-
-				    if (Fl::damage())
-				    	Fl::flush();
-				}
-
-				// look for input and refresh window
-				pUI->raytracer->tracePixel(x, y);
+				prev = now;
+				passesShown = passes;
+				if (pUI->m_nPasses > 0)
+					sprintf(buffer, "(%d%%, %d/%d spp) %s", (int)(pUI->raytracer->renderProgress() * 100.0),
+						std::max(0, passes - 1), pUI->m_nPasses, old_label);
+				else
+					sprintf(buffer, "(%d%%) %s", (int)(pUI->raytracer->renderProgress() * 100.0), old_label);
+				pUI->m_traceGlWindow->label(buffer);
+				pUI->m_traceGlWindow->refresh();
 				pUI->m_debuggingWindow->m_debuggingView->setDirty();
-	      	}
-
-	    	if (stopTrace) 
-	    		break;
-		}
+			}
 
-		// Wait for all threads to finish
-		const int num_threads = num_threads_sqrt * num_threads_sqrt;
-		for (int i = 0; i < (num_threads - 1); ++i)
-		{
-			// Can't exactly use the refresh rate here so I'll just have to refresh every time a thread finishes
-		    pUI->m_traceGlWindow->refresh();
-		    Fl::check();
-		    
-		    if (Fl::damage())
-		    	Fl::flush();
-
-		    // Wait for thread to finish
-			trace_threads[i].join();
+			Fl::check();
+			if (Fl::damage())
+				Fl::flush();
 		}
 
 		doneTrace = true;
-		stopTrace = false;
 		// Restore the window label
 		pUI->m_traceGlWindow->label(old_label);
 		pUI->m_traceGlWindow->refresh();
+		pUI->m_debuggingWindow->m_debuggingView->setDirty();
 	  }
 }
 
@@ -362,12 +346,14 @@ Fl_Menu_Item GraphicalUI::menuitems[] = {
 
 void GraphicalUI::stopTracing()
 {
-	stopTrace = true;
+	// The workers stop picking up new tiles; cb_render's loop sees the render finish
+	if (pUI && pUI->raytracer)
+		pUI->raytracer->cancelRender();
 }
 
-GraphicalUI::GraphicalUI() : refreshInterval(10) {
+GraphicalUI::GraphicalUI() : refreshInterval(10), m_accelDirty(false) {
 	// init.
-	m_mainWindow = new Fl_Window(100, 40, 450, 459, "Ray <Not Loaded>");
+	m_mainWindow = new Fl_Window(100, 40, 450, 484, "Ray <Not Loaded>");
 	m_mainWindow->user_data((void*)(this));	// record self to be used by static callback functions
 	// install menu bar
 	m_menubar = new Fl_Menu_Bar(0, 0, 440, 25);
@@ -423,7 +409,7 @@ GraphicalUI::GraphicalUI() : refreshInterval(10) {
 	m_refreshSlider->callback(cb_refreshSlides);
 
 	// set up debugging display checkbox
-	m_debuggingDisplayCheckButton = new Fl_Check_Button(10, 425, 140, 20, "Debugging display");
+	m_debuggingDisplayCheckButton = new Fl_Check_Button(10, 450, 140, 20, "Debugging display");
 	m_debuggingDisplayCheckButton->user_data((void*)(this));
 	m_debuggingDisplayCheckButton->callback(cb_debuggingDisplayCheckButton);
 	m_debuggingDisplayCheckButton->value(m_displayDebuggingInfo);
@@ -441,8 +427,85 @@ GraphicalUI::GraphicalUI() : refreshInterval(10) {
 	m_aaSamplesSlider->align(FL_ALIGN_RIGHT);
 	m_aaSamplesSlider->callback(cb_aaSamplesSlides);
 
+	// how much a pixel's corners may differ before adaptive anti-aliasing supersamples it
+	m_aaThreshSlider = new Fl_Value_Slider(10, 190, 180, 20, "AA Threshold");
+	m_aaThreshSlider->user_data((void*)(this));	// record self to be used by static callback functions
+	m_aaThreshSlider->type(FL_HOR_NICE_SLIDER);
+	m_aaThreshSlider->labelfont(FL_COURIER);
+	m_aaThreshSlider->labelsize(12);
+	m_aaThreshSlider->minimum(0);
+	m_aaThreshSlider->maximum(1);
+	m_aaThreshSlider->step(0.01);
+	m_aaThreshSlider->value(m_aaThreshold);
+	m_aaThreshSlider->align(FL_ALIGN_RIGHT);
+	m_aaThreshSlider->callback(cb_aaThreshSlides);
+
+	// samples per pixel for progressive rendering (0 renders in one pass)
+	m_passesSlider = new Fl_Value_Slider(10, 215, 180, 20, "Progressive Passes");
+	m_passesSlider->user_data((void*)(this));	// record self to be used by static callback functions
+	m_passesSlider->type(FL_HOR_NICE_SLIDER);
+	m_passesSlider->labelfont(FL_COURIER);
+	m_passesSlider->labelsize(12);
+	m_passesSlider->minimum(0);
+	m_passesSlider->maximum(256);
+	m_passesSlider->step(1);
+	m_passesSlider->value(m_nPasses);
+	m_passesSlider->align(FL_ALIGN_RIGHT);
+	m_passesSlider->callback(cb_passesSlides);
+
+	// reflection and refraction rays fainter than this aren't traced
+	m_contributionSlider = new Fl_Value_Slider(10, 240, 180, 20, "Min Contribution");
+	m_contributionSlider->user_data((void*)(this));	// record self to be used by static callback functions
+	m_contributionSlider->type(FL_HOR_NICE_SLIDER);
+	m_contributionSlider->labelfont(FL_COURIER);
+	m_contributionSlider->labelsize(12);
+	m_contributionSlider->minimum(0);
+	m_contributionSlider->maximum(0.1);
+	m_contributionSlider->step(0.001);
+	m_contributionSlider->value(m_minContribution);
+	m_contributionSlider->align(FL_ALIGN_RIGHT);
+	m_contributionSlider->callback(cb_contributionSlides);
+
+	// lights to pick at random per shading point (0 shades with all of them)
+	m_lightSamplesSlider = new Fl_Value_Slider(10, 265, 180, 20, "Light Samples");
+	m_lightSamplesSlider->user_data((void*)(this));	// record self to be used by static callback functions
+	m_lightSamplesSlider->type(FL_HOR_NICE_SLIDER);
+	m_lightSamplesSlider->labelfont(FL_COURIER);
+	m_lightSamplesSlider->labelsize(12);
+	m_lightSamplesSlider->minimum(0);
+	m_lightSamplesSlider->maximum(16);
+	m_lightSamplesSlider->step(1);
+	m_lightSamplesSlider->value(m_nLightSamples);
+	m_lightSamplesSlider->align(FL_ALIGN_RIGHT);
+	m_lightSamplesSlider->callback(cb_lightSamplesSlides);
+
+	// texture cache budget
+	m_textureCacheSlider = new Fl_Value_Slider(10, 290, 180, 20, "Texture Cache (MB)");
+	m_textureCacheSlider->user_data((void*)(this));	// record self to be used by static callback functions
+	m_textureCacheSlider->type(FL_HOR_NICE_SLIDER);
+	m_textureCacheSlider->labelfont(FL_COURIER);
+	m_textureCacheSlider->labelsize(12);
+	m_textureCacheSlider->minimum(0);
+	m_textureCacheSlider->maximum(4096);
+	m_textureCacheSlider->step(16);
+	m_textureCacheSlider->value(m_nTextureCacheMB);
+	m_textureCacheSlider->align(FL_ALIGN_RIGHT);
+	m_textureCacheSlider->callback(cb_textureCacheSlides);
+
+	// Russian roulette checkbox
+	m_rouletteCheckButton = new Fl_Check_Button(10, 325, 140, 20, "Russian Roulette");
+	m_rouletteCheckButton->user_data((void*)this);
+	m_rouletteCheckButton->value(m_russianRoulette);
+	m_rouletteCheckButton->callback(cb_rouletteCheckButton);
+
+	// adaptive anti-aliasing checkbox
+	m_aaCheckButton = new Fl_Check_Button(10, 350, 140, 20, "Adaptive AA");
+	m_aaCheckButton->user_data((void*)this);
+	m_aaCheckButton->value(m_adaptiveAA);
+	m_aaCheckButton->callback(cb_aaCheckButton);
+
 	// cubemap checkbox
-	m_cubeMapCheckButton = new Fl_Check_Button(10, 400, 140, 20, "Cubemap");
+	m_cubeMapCheckButton = new Fl_Check_Button(10, 425, 140, 20, "Cubemap");
 	m_cubeMapCheckButton->user_data((void*)this);
 	m_cubeMapCheckButton->value(m_usingCubeMap);
 	m_cubeMapCheckButton->callback(cb_cubeMapCheckButton);
@@ -463,24 +526,30 @@ GraphicalUI::GraphicalUI() : refreshInterval(10) {
 	m_filterSlider->deactivate();
 
 	// multi-threading count filter
-	m_multiThreadSlider = new Fl_Value_Slider(10, 165, 180, 20, "Multi-Threading Factor");
+	m_multiThreadSlider = new Fl_Value_Slider(10, 165, 180, 20, "Threads");
 	m_multiThreadSlider->user_data((void*)(this));	// record self to be used by static callback functions
 	m_multiThreadSlider->type(FL_HOR_NICE_SLIDER);
 	m_multiThreadSlider->labelfont(FL_COURIER);
 	m_multiThreadSlider->labelsize(12);
 	m_multiThreadSlider->minimum(1);
-	m_multiThreadSlider->maximum(4); // Max thread count: 16
+	m_multiThreadSlider->maximum(std::max(16, TileScheduler::defaultThreadCount()));
 	m_multiThreadSlider->step(1);
-	m_multiThreadSlider->value(m_nMultiThreadSqrt);
+	m_multiThreadSlider->value(m_nThreads);
 	m_multiThreadSlider->align(FL_ALIGN_RIGHT);
 	m_multiThreadSlider->callback(cb_multiThreadSlides);
 
 	// kd-tree checkbox
-	m_kdCheckButton = new Fl_Check_Button(10, 375, 140, 20, "KD-Tree");
+	m_kdCheckButton = new Fl_Check_Button(10, 400, 140, 20, "KD-Tree");
 	m_kdCheckButton->user_data((void*)this);
 	m_kdCheckButton->value(m_usingKdTree);
 	m_kdCheckButton->callback(cb_kdCheckButton);
 
+	// SAH BVH checkbox (a midpoint kd-tree is built when unchecked)
+	m_bvhCheckButton = new Fl_Check_Button(10, 375, 140, 20, "SAH BVH");
+	m_bvhCheckButton->user_data((void*)this);
+	m_bvhCheckButton->value(m_accelType == ACCEL_BVH);
+	m_bvhCheckButton->callback(cb_bvhCheckButton);
+
 	// cubemap chooser
 	m_cubeMapChooser = new CubeMapChooser();
 	m_cubeMapChooser->setCaller(this);
@@ -32,7 +32,6 @@ class ModelerView;
 class GraphicalUI : public TraceUI {
 public:
 	GraphicalUI();
-	friend void traceThreadFunc(const int start_x, const int end_x, const int start_y, const int end_y, GraphicalUI * pUI);
 
 	int run();
 
@@ -49,6 +48,10 @@ public:
 	Fl_Slider*			m_aaSamplesSlider;
 	Fl_Slider*			m_multiThreadSlider;
 	Fl_Slider*			m_aaThreshSlider;
+	Fl_Slider*			m_passesSlider;
+	Fl_Slider*			m_contributionSlider;
+	Fl_Slider*			m_lightSamplesSlider;
+	Fl_Slider*			m_textureCacheSlider;
 	Fl_Slider*			m_refreshSlider;
 	Fl_Slider*			m_treeDepthSlider;
 	Fl_Slider*			m_leafSizeSlider;
@@ -56,7 +59,9 @@ public:
 
 	Fl_Check_Button*	m_debuggingDisplayCheckButton;
 	Fl_Check_Button*	m_aaCheckButton;
+	Fl_Check_Button*	m_rouletteCheckButton;
 	Fl_Check_Button*	m_kdCheckButton;
+	Fl_Check_Button*	m_bvhCheckButton;
 	Fl_Check_Button*	m_cubeMapCheckButton;
 	Fl_Check_Button*	m_ssCheckButton;
 	Fl_Check_Button*	m_shCheckButton;
@@ -83,6 +88,7 @@ public:
 private:
 
 	clock_t refreshInterval;
+	bool m_accelDirty;	// acceleration structure type changed since the last build
 
 	// static class members
 	static Fl_Menu_Item menuitems[];
@@ -93,6 +99,7 @@ private:
 	static void cb_load_cubemap(Fl_Menu_* o, void* v);
 	static void cb_cubeMapCheckButton(Fl_Widget* o, void* v);
 	static void cb_kdCheckButton(Fl_Widget* o, void* v);
+	static void cb_bvhCheckButton(Fl_Widget* o, void* v);
 	static void cb_save_image(Fl_Menu_* o, void* v);
 	static void cb_exit(Fl_Menu_* o, void* v);
 	static void cb_about(Fl_Menu_* o, void* v);
@@ -105,6 +112,13 @@ private:
 	static void cb_refreshSlides(Fl_Widget* o, void* v);
 	static void cb_filterWidthSlides(Fl_Widget* o, void* v);
 	static void cb_aaSamplesSlides(Fl_Widget* o, void* v);
+	static void cb_aaThreshSlides(Fl_Widget* o, void* v);
+	static void cb_aaCheckButton(Fl_Widget* o, void* v);
+	static void cb_passesSlides(Fl_Widget* o, void* v);
+	static void cb_contributionSlides(Fl_Widget* o, void* v);
+	static void cb_lightSamplesSlides(Fl_Widget* o, void* v);
+	static void cb_textureCacheSlides(Fl_Widget* o, void* v);
+	static void cb_rouletteCheckButton(Fl_Widget* o, void* v);
 	static void cb_multiThreadSlides(Fl_Widget* o, void* v);
 
 	static void cb_render(Fl_Widget* o, void* v);
@@ -114,7 +128,6 @@ private:
 	static void cb_shCheckButton(Fl_Widget* o, void* v);
 	static void cb_bfCheckButton(Fl_Widget* o, void* v);
 
-	static bool stopTrace;
 	static bool doneTrace;
 	static GraphicalUI* pUI;
 };
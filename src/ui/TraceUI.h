@@ -19,17 +19,42 @@
 
 #include <string>
 
+#include "../TileScheduler.h"
+
 using std::string;
 
 class RayTracer;
 
 class TraceUI {
 public:
-	TraceUI() : m_nDepth(5), m_nSize(512), m_displayDebuggingInfo(false),
-                    m_shadows(true), m_smoothshade(true), raytracer(0),
-                    m_nFilterWidth(1), m_usingCubeMap(false), m_gotCubeMap(false),
-                    m_usingKdTree(true), m_nAASampleSqrt(1), m_nMultiThreadSqrt(2)
-                    {}
+	// Acceleration structures that Scene::buildKdTree() knows how to build
+	enum AccelType
+	{
+		ACCEL_KDTREE,	// midpoint-split kd-tree
+		ACCEL_BVH		// binned SAH bounding volume hierarchy
+	};
+
+	// Ray-triangle tests that Trimesh knows how to run
+	enum TriangleKernel
+	{
+		TRIANGLE_PLANE,			// plane hit, then barycentrics from dot products (the original test)
+		TRIANGLE_MOLLER,		// Moller-Trumbore
+		TRIANGLE_WATERTIGHT		// watertight test of Woop, Benthin and Wald
+	};
+
+	TraceUI() : raytracer(0), m_nSize(512), m_nDepth(5),
+                    m_minContribution(0.0), m_russianRoulette(false), m_nLightSamples(0),
+                    m_nTextureCacheMB(256), m_nAASampleSqrt(1),
+                    m_adaptiveAA(false), m_aaThreshold(0.1), m_nPasses(0),
+                    m_nThreads(TileScheduler::defaultThreadCount()), m_displayDebuggingInfo(false),
+                    m_shadows(true), m_smoothshade(true), m_usingCubeMap(false), m_gotCubeMap(false),
+                    m_usingKdTree(true), m_accelType(ACCEL_BVH), m_usingPackets(true),
+                    m_triangleKernel(TRIANGLE_WATERTIGHT), m_floatTriangles(false),
+                    m_nFilterWidth(1)
+                    {
+                        for (int type = 0; type < RAY_TYPES; ++type)
+                            m_typeDepth[type] = -1;
+                    }
 
 	virtual int	run() = 0;
 
@@ -40,19 +65,36 @@ public:
 	virtual void setRayTracer( RayTracer* r ) { raytracer = r; }
 	void setCubeMap(bool b) { m_gotCubeMap = b; }
 	void useCubeMap(bool b) { m_usingCubeMap = b; }
+	void setAccelType(AccelType type) { m_accelType = type; }
+	void setTriangleKernel(TriangleKernel kernel) { m_triangleKernel = kernel; }
+	void setCacheDir(const string& dir) { m_cacheDir = dir; }
+	void setTypeDepth(int type, int depth) { m_typeDepth[type] = depth; }
 
 	// accessors:
 	int	getSize() const { return m_nSize; }
 	int	getDepth() const { return m_nDepth; }
+	int getTypeDepth(int type) const { return m_typeDepth[type]; }
+	double getMinContribution() const { return m_minContribution; }
+	bool russianRoulette() const { return m_russianRoulette; }
+	int getLightSamples() const { return m_nLightSamples; }
+	int getTextureCacheMB() const { return m_nTextureCacheMB; }
 	int		getFilterWidth() const { return m_nFilterWidth; }
 	int getAASampleSqrt() const { return m_nAASampleSqrt; }
-	int getMultiThreadSqrt() const { return m_nMultiThreadSqrt; }
+	bool adaptiveAA() const { return m_adaptiveAA; }
+	double getAAThreshold() const { return m_aaThreshold; }
+	int getProgressivePasses() const { return m_nPasses; }
+	int getThreads() const { return m_nThreads; }
 
 	bool	shadowSw() const { return m_shadows; }
 	bool	smShadSw() const { return m_smoothshade; }
 	bool	usingCubeMap() const { return m_usingCubeMap; }
 	bool	gotCubeMap() const { return m_gotCubeMap; }
 	bool	usingKdTree() const { return m_usingKdTree; }
+	bool	usingPackets() const { return m_usingPackets; }
+	AccelType	getAccelType() const { return m_accelType; }
+	TriangleKernel	getTriangleKernel() const { return m_triangleKernel; }
+	bool	floatTriangles() const { return m_floatTriangles; }
+	const string&	getCacheDir() const { return m_cacheDir; }
 
 	static bool m_debug;
 
@@ -61,8 +103,21 @@ protected:
 
 	int	m_nSize;	// Size of the traced image
 	int	m_nDepth;	// Max depth of recursion
+
+	// How many rays of each ray::RayType a path may have, on top of m_nDepth
+	// limiting the total: reflection and refraction bounces, and transmissive
+	// surfaces a shadow ray passes through.  -1 for no limit of its own.
+	enum { RAY_TYPES = 4 };
+	int m_typeDepth[RAY_TYPES];
+	double m_minContribution; // Rays that would add less than this to any channel of a pixel aren't traced
+	bool m_russianRoulette; // Trace faint rays only some of the time, weighted up to make up for the rest
+	int m_nLightSamples; // Shade with this many lights picked at random when more than that can reach a point; 0 to use them all
+	int m_nTextureCacheMB; // Megabytes of texture tiles to keep in memory; 0 for no limit
 	int m_nAASampleSqrt; // Square root of the number of pixel samples to take for anti-aliasing
-	int m_nMultiThreadSqrt; // Square root of the number of threads to use when rendering
+	bool m_adaptiveAA; // Only take all of those samples where a pixel's corners differ
+	double m_aaThreshold; // How much a color channel may vary across a pixel's corners before it's supersampled
+	int m_nPasses; // Jittered samples per pixel to render progressively, one pass over the image each; 0 to render normally
+	int m_nThreads; // Number of threads to use when rendering
 
 	// Determines whether or not to show debugging information
 	// for individual rays.  Disabled by default for efficiency
@@ -73,6 +128,11 @@ protected:
 	bool		m_usingCubeMap;  // render with cubemap
 	bool		m_gotCubeMap;  // cubemap defined
 	bool		m_usingKdTree; // Use a kd-tree for intersections
+	AccelType	m_accelType; // Which acceleration structure to build when m_usingKdTree is set
+	bool		m_usingPackets; // Trace camera rays in SIMD packets
+	TriangleKernel	m_triangleKernel; // Ray-triangle test used by every trimesh
+	bool		m_floatTriangles; // Run that test in single precision
+	string		m_cacheDir; // Where built BVHs are saved and reloaded from; empty to always build them
 	int m_nFilterWidth;  // width of cubemap filter
 };
 
@@ -16,6 +16,7 @@
 #include "../SceneObjects/Sphere.h"
 #include "../SceneObjects/Square.h"
 #include "../SceneObjects/trimesh.h"
+#include "../SceneObjects/MeshInstance.h"
 
 using namespace std;
 
@@ -355,17 +356,17 @@ void Trimesh::glDrawLocal(int quality, bool actualMaterials, bool actualTextures
 		glNewList( displayList, GL_COMPILE );
 
 		glBegin( GL_TRIANGLES );
-		for( Faces::const_iterator itr = faces.begin(); itr != faces.end(); ++itr )
+		for( std::vector<int>::const_iterator itr = faceIds.begin(); itr != faceIds.end(); itr += 3 )
 		{
-			const int vert1 = (*(*itr))[0];
-			const int vert2 = (*(*itr))[1];
-			const int vert3 = (*(*itr))[2];
+			const int vert1 = itr[0];
+			const int vert2 = itr[1];
+			const int vert3 = itr[2];
 
 			if( normals.empty() )
 			{
-				const Vec3d& a = vertices[vert1];
-				const Vec3d& b = vertices[vert2];
-				const Vec3d& c = vertices[vert3];
+				Vec3d a = toVec3d(vertices[vert1]);
+				Vec3d b = toVec3d(vertices[vert2]);
+				Vec3d c = toVec3d(vertices[vert3]);
 
 				Vec3d cv=(b - a) ^ (c - a);
 
@@ -376,22 +377,22 @@ void Trimesh::glDrawLocal(int quality, bool actualMaterials, bool actualTextures
 			}
 
 			if( ! normals.empty() )
-				glNormal3dv( normals[vert1].getPointer() );
+				glNormal3dv( toVec3d(normals[vert1]).getPointer() );
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert1], *itr );
-			glVertex3dv( vertices[vert1].getPointer() );
+				setGLMaterial( *materials[vert1], this );
+			glVertex3dv( toVec3d(vertices[vert1]).getPointer() );
 
 			if( ! normals.empty() )
-				glNormal3dv( normals[vert2].getPointer() );
+				glNormal3dv( toVec3d(normals[vert2]).getPointer() );
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert2], *itr );
-			glVertex3dv( vertices[vert2].getPointer() );
+				setGLMaterial( *materials[vert2], this );
+			glVertex3dv( toVec3d(vertices[vert2]).getPointer() );
 
 			if( ! normals.empty() )
-				glNormal3dv( normals[vert3].getPointer() );
+				glNormal3dv( toVec3d(normals[vert3]).getPointer() );
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert3], *itr );
-			glVertex3dv( vertices[vert3].getPointer() );
+				setGLMaterial( *materials[vert3], this );
+			glVertex3dv( toVec3d(vertices[vert3]).getPointer() );
 		}
 		glEnd();
 
@@ -401,6 +402,13 @@ void Trimesh::glDrawLocal(int quality, bool actualMaterials, bool actualTextures
 	glCallList(displayList);
 }
 
+// The instance's transform and material are already set up by
+// SceneObject::glDraw(); the mesh's display lists do the rest
+void MeshInstance::glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const
+{
+	mesh->glDrawLocal(quality, actualMaterials, actualTextures);
+}
+
 void PointLight::glDraw(GLenum lightID) const
 {
 
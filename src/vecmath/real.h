@@ -0,0 +1,58 @@
+/*
+* Assignment #6
+* Name: Jason Palacios
+* UT EID: jap4839
+* UTCS: jason777
+*/
+
+//
+// real.h
+//
+// The precision the bulk geometry is stored in: trimesh vertices, normals
+// and precomputed edges, and BVH node boxes.  That's double unless the
+// tracer is built with -DSINGLE_PRECISION (see the makefiles), which halves
+// the memory the intersection loops stream through.  Rays, hits and the
+// arithmetic done on them stay in double either way.
+//
+
+#ifndef __REAL_H__
+#define __REAL_H__
+
+#include <cmath>
+
+#include "vec.h"
+
+#ifdef SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
+typedef Vec3<Real> Vec3r;
+
+template <class T>
+inline Vec3d toVec3d(const Vec3<T>& v)
+{
+  return Vec3d(v[0], v[1], v[2]);
+}
+
+inline Vec3r toVec3r(const Vec3d& v)
+{
+  return Vec3r(Real(v[0]), Real(v[1]), Real(v[2]));
+}
+
+// x in Real, rounded toward -infinity or +infinity rather than to nearest,
+// so that a box stored in Real still contains everything it was built around
+inline Real roundDown(double x)
+{
+  Real r = Real(x);
+  return r > x ? std::nextafter(r, Real(-HUGE_VAL)) : r;
+}
+
+inline Real roundUp(double x)
+{
+  Real r = Real(x);
+  return r < x ? std::nextafter(r, Real(HUGE_VAL)) : r;
+}
+
+#endif // __REAL_H__